@@ -0,0 +1,172 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+
+#include "tvout-ctl-batch.h"
+
+void batch_init(Batch *batch, xcb_connection_t *conn)
+{
+	batch->conn = conn;
+	batch->slots = NULL;
+	batch->num_slots = 0;
+	batch->max_slots = 0;
+	batch->num_done = 0;
+}
+
+void batch_clear(Batch *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->num_slots; i++) {
+		BatchSlot *slot = &batch->slots[i];
+
+		if (slot->done)
+			free(slot->reply);
+		else
+			xcb_discard_reply(batch->conn, slot->sequence);
+	}
+
+	free(batch->slots);
+
+	batch_init(batch, batch->conn);
+}
+
+/*
+ * Checked requests without a reply can be added as well,
+ * as long as some request with a reply follows them in the
+ * same batch. Their result is available via batch_error().
+ *
+ * Returns the slot index, or -1 if we ran out of memory.
+ * The reply is discarded in the latter case so that it
+ * doesn't linger in the connection.
+ */
+int batch_add(Batch *batch, unsigned int sequence)
+{
+	BatchSlot *slot;
+
+	if (batch->num_slots == batch->max_slots) {
+		int max_slots = batch->max_slots ? 2 * batch->max_slots : 16;
+		BatchSlot *slots = realloc(batch->slots, max_slots * sizeof slots[0]);
+
+		if (!slots) {
+			xcb_discard_reply(batch->conn, sequence);
+			return -1;
+		}
+
+		batch->slots = slots;
+		batch->max_slots = max_slots;
+	}
+
+	slot = &batch->slots[batch->num_slots];
+
+	slot->sequence = sequence;
+	slot->reply = NULL;
+	slot->error = 0;
+	slot->done = false;
+
+	return batch->num_slots++;
+}
+
+/*
+ * Only the error code is kept. For requests with a reply
+ * a missing reply is usually all the caller needs to know.
+ */
+static void slot_complete(BatchSlot *slot, void *reply,
+			  xcb_generic_error_t *error)
+{
+	slot->error = error ? error->error_code : 0;
+	free(error);
+
+	slot->reply = reply;
+	slot->done = true;
+}
+
+bool batch_wait(Batch *batch)
+{
+	while (batch->num_done < batch->num_slots) {
+		BatchSlot *slot = &batch->slots[batch->num_done];
+		xcb_generic_error_t *error = NULL;
+		void *reply;
+
+		reply = xcb_wait_for_reply(batch->conn, slot->sequence, &error);
+
+		slot_complete(slot, reply, error);
+		batch->num_done++;
+	}
+
+	return !xcb_connection_has_error(batch->conn);
+}
+
+/*
+ * Collect whatever replies have arrived without blocking.
+ * Replies come back in request order so we can stop at the
+ * first one that's still missing. Returns true once every
+ * reply is in.
+ */
+bool batch_poll(Batch *batch)
+{
+	while (batch->num_done < batch->num_slots) {
+		BatchSlot *slot = &batch->slots[batch->num_done];
+		xcb_generic_error_t *error = NULL;
+		void *reply = NULL;
+
+		if (!xcb_poll_for_reply(batch->conn, slot->sequence, &reply, &error))
+			return false;
+
+		slot_complete(slot, reply, error);
+		batch->num_done++;
+	}
+
+	return true;
+}
+
+void *batch_reply(const Batch *batch, int slot)
+{
+	if (slot < 0 || slot >= batch->num_done)
+		return NULL;
+
+	return batch->slots[slot].reply;
+}
+
+/* Like batch_reply() but the caller becomes the owner of the reply. */
+void *batch_take(Batch *batch, int slot)
+{
+	void *reply = batch_reply(batch, slot);
+
+	if (reply)
+		batch->slots[slot].reply = NULL;
+
+	return reply;
+}
+
+/*
+ * Returns the X error code for the request, 0 if it
+ * succeeded, or -1 if the request hasn't completed.
+ */
+int batch_error(const Batch *batch, int slot)
+{
+	if (slot < 0 || slot >= batch->num_done)
+		return -1;
+
+	return batch->slots[slot].error;
+}
@@ -0,0 +1,60 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_BATCH_H
+#define TVOUT_CTL_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <xcb/xcb.h>
+
+/*
+ * A group of requests which have all been sent out
+ * before any of their replies are looked at. This
+ * turns N round trips into one.
+ */
+typedef struct {
+	unsigned int sequence;
+	void *reply;
+	uint8_t error;
+	bool done;
+} BatchSlot;
+
+typedef struct {
+	xcb_connection_t *conn;
+	BatchSlot *slots;
+	int num_slots;
+	int max_slots;
+	int num_done;
+} Batch;
+
+void batch_init(Batch *batch, xcb_connection_t *conn);
+void batch_clear(Batch *batch);
+
+int batch_add(Batch *batch, unsigned int sequence);
+
+bool batch_wait(Batch *batch);
+bool batch_poll(Batch *batch);
+
+void *batch_reply(const Batch *batch, int slot);
+void *batch_take(Batch *batch, int slot);
+int batch_error(const Batch *batch, int slot);
+
+#endif
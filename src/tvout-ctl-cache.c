@@ -0,0 +1,181 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+
+#include "tvout-ctl-cache.h"
+
+#define CACHE_MAGIC 0x54564f43 /* "TVOC" */
+#define CACHE_VERSION 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	int32_t release;
+	int32_t screen;
+	char vendor[64];
+	char display[64];
+} CacheHeader;
+
+/*
+ * Each display and screen gets a file of its own, so that clients
+ * of different servers do not keep overwriting each other's cache.
+ */
+static bool cache_path(Display *dpy, const char *backend,
+		       char *path, size_t len)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	char *p;
+	int r;
+
+	if (!dir || !*dir)
+		return false;
+
+	r = snprintf(path, len, "%s/tvout-ctl-%s-", dir, backend);
+	if (r <= 0 || (size_t) r >= len)
+		return false;
+
+	/* The display name may contain a host name with slashes. */
+	p = path + r;
+	r = snprintf(p, len - r, "%s-%d.cache",
+		     DisplayString(dpy), DefaultScreen(dpy));
+	if (r <= 0 || (size_t) r >= len - (p - path))
+		return false;
+
+	for (; *p; p++)
+		if (*p == '/')
+			*p = '_';
+
+	return true;
+}
+
+static void cache_header(Display *dpy, CacheHeader *hdr, size_t size)
+{
+	memset(hdr, 0, sizeof *hdr);
+
+	hdr->magic = CACHE_MAGIC;
+	hdr->version = CACHE_VERSION;
+	hdr->size = size;
+	hdr->release = VendorRelease(dpy);
+	hdr->screen = DefaultScreen(dpy);
+	strncpy(hdr->vendor, ServerVendor(dpy), sizeof hdr->vendor - 1);
+	strncpy(hdr->display, DisplayString(dpy), sizeof hdr->display - 1);
+}
+
+static bool read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+
+	while (len) {
+		ssize_t r = read(fd, p, len);
+
+		if (r <= 0)
+			return false;
+
+		p += r;
+		len -= r;
+	}
+
+	return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t r = write(fd, p, len);
+
+		if (r <= 0)
+			return false;
+
+		p += r;
+		len -= r;
+	}
+
+	return true;
+}
+
+bool cache_load(Display *dpy, const char *backend, void *data, size_t size)
+{
+	char path[PATH_MAX];
+	CacheHeader hdr, file_hdr;
+	bool ret;
+	int fd;
+
+	if (!cache_path(dpy, backend, path, sizeof path))
+		return false;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	cache_header(dpy, &hdr, size);
+
+	ret = read_full(fd, &file_hdr, sizeof file_hdr) &&
+		memcmp(&hdr, &file_hdr, sizeof hdr) == 0 &&
+		read_full(fd, data, size);
+
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Write to a temporary file and rename it over the old one
+ * so that readers never see a partially written cache.
+ */
+void cache_store(Display *dpy, const char *backend, const void *data, size_t size)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	CacheHeader hdr;
+	bool ok;
+	int fd, r;
+
+	if (!cache_path(dpy, backend, path, sizeof path))
+		return;
+
+	r = snprintf(tmp, sizeof tmp, "%s.%ld", path, (long) getpid());
+	if (r < 0 || (size_t) r >= sizeof tmp)
+		return;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return;
+
+	cache_header(dpy, &hdr, size);
+
+	ok = write_full(fd, &hdr, sizeof hdr) &&
+		write_full(fd, data, size);
+
+	if (close(fd) < 0)
+		ok = false;
+
+	if (!ok || rename(tmp, path) < 0)
+		unlink(tmp);
+}
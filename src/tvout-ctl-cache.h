@@ -0,0 +1,38 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_CACHE_H
+#define TVOUT_CTL_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <X11/Xlib.h>
+
+/*
+ * Probe results are cached in $XDG_RUNTIME_DIR so that the next
+ * process can skip most of the probing. The cache is keyed by the
+ * display name, X server vendor/release and screen. The contents
+ * are opaque to this code, and the backend is expected to validate
+ * them against the server before trusting them.
+ */
+bool cache_load(Display *dpy, const char *backend, void *data, size_t size);
+void cache_store(Display *dpy, const char *backend, const void *data, size_t size);
+
+#endif
@@ -0,0 +1,341 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "tvout-ctl-private.h"
+#include "tvout-ctl-client.h"
+
+/* The daemon answers without talking to X, so this is generous. */
+#define CLIENT_TIMEOUT_MS 5000
+
+static bool connect_daemon(TVoutCtlClient *client)
+{
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+
+	if (!proto_path("sock", addr.sun_path, sizeof addr.sun_path))
+		return false;
+
+	client->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (client->fd < 0)
+		return false;
+
+	return connect(client->fd, (struct sockaddr *) &addr, sizeof addr) == 0;
+}
+
+static bool map_page(TVoutCtlClient *client)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	void *page;
+	int fd;
+
+	if (!proto_path("state", path, sizeof path))
+		return false;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof (ProtoPage)) {
+		close(fd);
+		return false;
+	}
+
+	page = mmap(NULL, sizeof (ProtoPage), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+		return false;
+
+	client->page = page;
+
+	return client->page->magic == PROTO_MAGIC &&
+		client->page->version == PROTO_VERSION;
+}
+
+/* Returns 1 if a message was received, 0 if none and -1 on EOF. */
+static int recv_msg(TVoutCtlClient *client, ProtoMsg *msg)
+{
+	ssize_t r;
+
+	do {
+		r = recv(client->fd, msg, sizeof *msg, 0);
+	} while (r < 0 && errno == EINTR);
+
+	if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+
+	if (r != sizeof *msg ||
+	    msg->num_values < 0 || msg->num_values > PROTO_MAX_VALUES)
+		return -1;
+
+	return 1;
+}
+
+/*
+ * The daemon greets each client it takes on. If it's full it
+ * closes the socket instead, and we go to the X server directly.
+ */
+static bool wait_welcome(TVoutCtlClient *client)
+{
+	struct pollfd pfd = {
+		.fd = client->fd,
+		.events = POLLIN,
+	};
+	ProtoMsg msg;
+	int r;
+
+	for (;;) {
+		r = recv_msg(client, &msg);
+		if (r > 0)
+			return msg.type == PROTO_WELCOME;
+		if (r < 0)
+			return false;
+
+		r = poll(&pfd, 1, CLIENT_TIMEOUT_MS);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return false;
+	}
+}
+
+static void free_client(TVoutCtlClient *client)
+{
+	while (client->sets) {
+		TVoutCtlClientSet *set = client->sets;
+
+		client->sets = set->next;
+		free(set);
+	}
+
+	if (client->page)
+		munmap((void *) client->page, sizeof (ProtoPage));
+	if (client->fd >= 0)
+		close(client->fd);
+	free(client);
+}
+
+bool client_start(TVoutCtl *ctl, bool async)
+{
+	TVoutCtlClient *client;
+
+	client = calloc(1, sizeof *client);
+	if (!client)
+		return false;
+
+	client->fd = -1;
+
+	/* Without a daemon this fails right at connect(). */
+	if (!connect_daemon(client) || !map_page(client) ||
+	    snapshot_get(&client->page->snapshot, TVOUT_CTL_READY) != 1 ||
+	    !wait_welcome(client)) {
+		free_client(client);
+		return false;
+	}
+
+	/* tvout_ctl_init_async() users wait for TVOUT_CTL_READY. */
+	client->announce = async;
+
+	ctl->client = client;
+	ctl->view = &client->page->snapshot;
+
+	return true;
+}
+
+void client_stop(TVoutCtl *ctl)
+{
+	free_client(ctl->client);
+	ctl->client = NULL;
+}
+
+static void set_done(TVoutCtlClient *client, const ProtoMsg *msg)
+{
+	TVoutCtlClientSet **pp, *set;
+
+	for (pp = &client->sets; *pp; pp = &(*pp)->next) {
+		set = *pp;
+
+		if (set->serial != msg->serial)
+			continue;
+
+		*pp = set->next;
+
+		if (set->done && msg->num_values == 1)
+			set->done(set->data, msg->values[0].attr,
+				  msg->values[0].value, msg->result);
+
+		free(set);
+		return;
+	}
+}
+
+static void handle_msg(TVoutCtl *ctl, const ProtoMsg *msg)
+{
+	int i;
+
+	switch (msg->type) {
+	case PROTO_NOTIFY:
+		for (i = 0; i < msg->num_values; i++) {
+			const TVoutCtlAttrValue *v = &msg->values[i];
+
+			if (v->attr >= 0 && v->attr < TVOUT_CTL_NUM_ATTRS)
+				ctl_notify(ctl, v->attr, v->value);
+		}
+		break;
+	case PROTO_SET_DONE:
+		set_done(ctl->client, msg);
+		break;
+	default:
+		/* A reply nobody waits for anymore */
+		break;
+	}
+}
+
+/*
+ * Whatever else arrives meanwhile is handled right away, like
+ * the events that tvout_ctl_set() drains in direct mode.
+ */
+int client_request(TVoutCtl *ctl, ProtoMsg *msg)
+{
+	TVoutCtlClient *client = ctl->client;
+	ProtoMsg reply;
+	ssize_t r;
+
+	msg->serial = ++client->serial;
+
+	do {
+		r = send(client->fd, msg, sizeof *msg, MSG_NOSIGNAL);
+	} while (r < 0 && errno == EINTR);
+
+	if (r != sizeof *msg)
+		return -1;
+
+	for (;;) {
+		struct pollfd pfd = {
+			.fd = client->fd,
+			.events = POLLIN,
+		};
+
+		r = recv_msg(client, &reply);
+		if (r < 0)
+			return -1;
+
+		if (r == 0) {
+			r = poll(&pfd, 1, CLIENT_TIMEOUT_MS);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r <= 0)
+				return -1;
+			continue;
+		}
+
+		if (reply.type == PROTO_REPLY && reply.serial == msg->serial)
+			return reply.result;
+
+		handle_msg(ctl, &reply);
+	}
+}
+
+int client_set_async(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value,
+		     int timeout_ms, TVoutCtlSetDone done, void *data)
+{
+	TVoutCtlClient *client = ctl->client;
+	TVoutCtlClientSet *set, **pp;
+	ProtoMsg msg;
+	int r;
+
+	memset(&msg, 0, sizeof msg);
+	msg.type = PROTO_SET_ASYNC;
+	msg.args[0] = timeout_ms;
+	msg.num_values = 1;
+	msg.values[0].attr = attr;
+	msg.values[0].value = value;
+
+	set = calloc(1, sizeof *set);
+	if (!set)
+		return -1;
+
+	/*
+	 * The daemon may finish the set before it replies,
+	 * so the set has to be known before it's sent.
+	 */
+	set->serial = client->serial + 1;
+	set->done = done;
+	set->data = data;
+	set->next = client->sets;
+	client->sets = set;
+
+	r = client_request(ctl, &msg);
+	if (r >= 0)
+		return 0;
+
+	for (pp = &client->sets; *pp; pp = &(*pp)->next) {
+		if (*pp != set)
+			continue;
+
+		*pp = set->next;
+		free(set);
+		break;
+	}
+
+	return -1;
+}
+
+int client_dispatch(TVoutCtl *ctl, int max_events)
+{
+	TVoutCtlClient *client = ctl->client;
+	ProtoMsg msg;
+	int n = 0;
+
+	if (client->announce) {
+		client->announce = false;
+		ctl_notify(ctl, TVOUT_CTL_READY, 1);
+	}
+
+	while (max_events <= 0 || n < max_events) {
+		int r = recv_msg(client, &msg);
+
+		if (r <= 0)
+			return r;
+
+		handle_msg(ctl, &msg);
+		n++;
+	}
+
+	return 1;
+}
+
+bool client_pending(TVoutCtl *ctl)
+{
+	return ctl->client->announce;
+}
@@ -0,0 +1,67 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_CLIENT_H
+#define TVOUT_CTL_CLIENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tvout-ctl.h"
+#include "tvout-ctl-proto.h"
+
+typedef struct _TVoutCtlClientSet TVoutCtlClientSet;
+
+/* A tvout_ctl_set_async() call the daemon hasn't finished yet */
+struct _TVoutCtlClientSet {
+	TVoutCtlClientSet *next;
+	uint32_t serial;
+	TVoutCtlSetDone done;
+	void *data;
+};
+
+typedef struct {
+	int fd;
+	const ProtoPage *page;
+	uint32_t serial;
+	TVoutCtlClientSet *sets;
+	/* TVOUT_CTL_READY hasn't been notified yet */
+	bool announce;
+} TVoutCtlClient;
+
+/* Returns false if there's no daemon to talk to. */
+bool client_start(TVoutCtl *ctl, bool async);
+void client_stop(TVoutCtl *ctl);
+
+/* Sends the request and waits for the reply. Returns its result. */
+int client_request(TVoutCtl *ctl, ProtoMsg *msg);
+
+int client_set_async(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value,
+		     int timeout_ms, TVoutCtlSetDone done, void *data);
+
+/*
+ * Handles at most max_events messages from the daemon, all of
+ * them if that's <= 0. Returns 1 if some may be left, 0 if not
+ * and -1 if the daemon went away.
+ */
+int client_dispatch(TVoutCtl *ctl, int max_events);
+
+bool client_pending(TVoutCtl *ctl);
+
+#endif
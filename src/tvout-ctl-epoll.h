@@ -0,0 +1,93 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_EPOLL_H
+#define TVOUT_CTL_EPOLL_H
+
+/*
+ * epoll integration:
+ *
+ *   tvout_ctl_epoll_add(ctl, epfd, ctl);
+ *
+ *   for (;;) {
+ *           n = epoll_wait(epfd, events, max, tvout_ctl_epoll_timeout(ctl));
+ *
+ *           for (i = 0; i < n; i++)
+ *                   if (events[i].data.ptr == ctl)
+ *                           tvout_ctl_fd_ready(ctl);
+ *
+ *           if (n == 0)
+ *                   tvout_ctl_dispatch_pending(ctl);
+ *   }
+ *
+ * Real loops will want to take the smaller of their own timeout
+ * and tvout_ctl_epoll_timeout(), and treat a zero timeout the same
+ * way as n == 0 above.
+ */
+
+#include <stddef.h>
+#include <sys/epoll.h>
+
+#include "tvout-ctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Both fds are added with data.ptr set to data. */
+static inline int tvout_ctl_epoll_add(TVoutCtl *ctl, int epfd, void *data)
+{
+	struct epoll_event ev;
+	int fd;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = data;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, tvout_ctl_fd(ctl), &ev) < 0)
+		return -1;
+
+	fd = tvout_ctl_timer_fd(ctl);
+	if (fd >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, tvout_ctl_fd(ctl), NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+static inline void tvout_ctl_epoll_del(TVoutCtl *ctl, int epfd)
+{
+	int fd = tvout_ctl_timer_fd(ctl);
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, tvout_ctl_fd(ctl), NULL);
+	if (fd >= 0)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/* 0 if there's already something to dispatch, -1 otherwise */
+static inline int tvout_ctl_epoll_timeout(TVoutCtl *ctl)
+{
+	return tvout_ctl_needs_dispatch(ctl) ? 0 : -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
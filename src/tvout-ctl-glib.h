@@ -0,0 +1,109 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_GLIB_H
+#define TVOUT_CTL_GLIB_H
+
+/*
+ * GLib main loop integration. Header only so that the library
+ * itself doesn't depend on GLib.
+ *
+ *   GSource *source = tvout_ctl_source_new(ctl);
+ *   g_source_attach(source, NULL);
+ *   g_source_unref(source);
+ *
+ * Destroy the source before calling tvout_ctl_exit().
+ */
+
+#include <glib.h>
+
+#include "tvout-ctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	GSource source;
+	TVoutCtl *ctl;
+	GPollFD fd;
+	GPollFD timer_fd;
+} TVoutCtlSource;
+
+static inline gboolean tvout_ctl_source_prepare(GSource *source, gint *timeout)
+{
+	TVoutCtlSource *s = (TVoutCtlSource *) source;
+
+	*timeout = -1;
+
+	return tvout_ctl_needs_dispatch(s->ctl);
+}
+
+static inline gboolean tvout_ctl_source_check(GSource *source)
+{
+	TVoutCtlSource *s = (TVoutCtlSource *) source;
+
+	if (s->fd.revents || s->timer_fd.revents)
+		return TRUE;
+
+	return tvout_ctl_needs_dispatch(s->ctl);
+}
+
+static inline gboolean tvout_ctl_source_dispatch(GSource *source,
+						 GSourceFunc callback,
+						 gpointer user_data)
+{
+	TVoutCtlSource *s = (TVoutCtlSource *) source;
+
+	tvout_ctl_dispatch_pending(s->ctl);
+
+	return TRUE;
+}
+
+static inline GSource *tvout_ctl_source_new(TVoutCtl *ctl)
+{
+	static GSourceFuncs funcs = {
+		tvout_ctl_source_prepare,
+		tvout_ctl_source_check,
+		tvout_ctl_source_dispatch,
+		NULL,
+	};
+	TVoutCtlSource *s;
+
+	s = (TVoutCtlSource *) g_source_new(&funcs, sizeof *s);
+	s->ctl = ctl;
+
+	s->fd.fd = tvout_ctl_fd(ctl);
+	s->fd.events = G_IO_IN | G_IO_HUP | G_IO_ERR;
+	g_source_add_poll(&s->source, &s->fd);
+
+	s->timer_fd.fd = tvout_ctl_timer_fd(ctl);
+	if (s->timer_fd.fd >= 0) {
+		s->timer_fd.events = G_IO_IN;
+		g_source_add_poll(&s->source, &s->timer_fd);
+	}
+
+	return &s->source;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
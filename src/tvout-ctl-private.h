@@ -0,0 +1,321 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_PRIVATE_H
+#define TVOUT_CTL_PRIVATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <X11/Xlib.h>
+#include <xcb/xcb.h>
+
+#include "tvout-ctl.h"
+#include "tvout-ctl-batch.h"
+#include "tvout-ctl-client.h"
+#include "tvout-ctl-snapshot.h"
+#include "tvout-ctl-thread.h"
+
+#define MAX_BACKENDS 4
+
+/* Attributes that can be set */
+#define NUM_CTL_ATTRS TVOUT_CTL_READY
+
+typedef struct {
+	const char *name;
+
+	/*
+	 * Extension the backend needs, or NULL. It's prefetched for
+	 * all backends at once, and probe_start() is only called once
+	 * the replies are in, so xcb_get_extension_data() won't block.
+	 */
+	xcb_extension_t *ext;
+
+	/*
+	 * Doesn't talk to the X server at all. Such a backend is
+	 * only used when $TVOUT_CTL_BACKEND asks for it, or when it
+	 * is the only one built, and then no Display is opened.
+	 */
+	bool standalone;
+
+	/*
+	 * Sends the first batch of probe requests and returns the
+	 * backend private data, or NULL if the backend is unusable.
+	 */
+	void *(*probe_start)(TVoutCtl *ctl);
+
+	/*
+	 * With wait, blocks for the current batch and advances one
+	 * step. Without, advances as far as the already received
+	 * replies allow. Returns 1 once the backend is ready, -1 if
+	 * it failed and 0 if probing is still in progress.
+	 */
+	int (*probe_step)(void *priv, bool wait);
+
+	void (*exit)(void *priv);
+
+	/*
+	 * Returns true if the event was one of the backend's own.
+	 * Anything else must be left alone, since with a shared
+	 * Display the events belong to the application as well.
+	 */
+	bool (*handle_event)(void *priv, const XEvent *e);
+
+	/*
+	 * Called once the event queue has been drained, so that
+	 * work triggered by a burst of events is done only once.
+	 * Can be NULL.
+	 */
+	void (*events_done)(void *priv);
+
+	/*
+	 * Whether replies the backend is waiting for have already
+	 * been read off the socket. Can be NULL.
+	 */
+	bool (*needs_dispatch)(void *priv);
+
+	/*
+	 * Returns 1 if the value differs from the current one, 0 if
+	 * it doesn't and -1 if it is invalid. Nothing is sent.
+	 */
+	int (*check)(void *priv, enum TVoutCtlAttr attr, int value);
+
+	/*
+	 * Returns 1 if a request was sent, 0 if there was nothing
+	 * to do and -1 if the value is invalid. The request is not
+	 * flushed. With a non-NULL sequence the last request is
+	 * sent checked and its sequence number is stored there.
+	 */
+	int (*set)(void *priv, enum TVoutCtlAttr attr, int value,
+		   unsigned int *sequence);
+
+	/*
+	 * If the checked request from set() has a reply, tells
+	 * whether the reply says it succeeded. Can be NULL.
+	 */
+	bool (*reply_ok)(void *priv, enum TVoutCtlAttr attr, const void *reply);
+
+	int (*get)(void *priv, enum TVoutCtlAttr attr);
+
+	/*
+	 * For backends that handle more than one output. Output 0
+	 * is the one the calls above work on. The output index is
+	 * checked by the caller. All can be NULL.
+	 */
+	int (*num_outputs)(void *priv);
+	const char *(*output_name)(void *priv, int output);
+	int (*set_output)(void *priv, int output, enum TVoutCtlAttr attr,
+			  int value);
+	int (*get_output)(void *priv, int output, enum TVoutCtlAttr attr);
+
+	/*
+	 * The fd to poll in place of the X connection. Only for
+	 * standalone backends, and called before probing is done.
+	 */
+	int (*fd)(void *priv);
+
+	/*
+	 * Whether the set() that stored sequence has been processed.
+	 * Standalone backends need this for tvout_ctl_set_async(),
+	 * with X it's a fence on the connection that tells.
+	 */
+	bool (*set_done)(void *priv, unsigned int sequence);
+} TVoutCtlBackend;
+
+extern const TVoutCtlBackend xrandr_backend;
+extern const TVoutCtlBackend xv_backend;
+extern const TVoutCtlBackend sim_backend;
+
+typedef struct {
+	const TVoutCtlBackend *backend;
+	void *priv;
+} TVoutCtlCandidate;
+
+/* When a change was first seen */
+typedef struct {
+	/* CLOCK_MONOTONIC in ns, 0 if unknown */
+	uint64_t received;
+	/* X server time of the event, 0 if unknown */
+	unsigned long server_time;
+} CtlEventTime;
+
+typedef struct _TVoutCtlPendingSet TVoutCtlPendingSet;
+
+/* A tvout_ctl_set_async() call waiting for the server */
+struct _TVoutCtlPendingSet {
+	TVoutCtlPendingSet *next;
+	enum TVoutCtlAttr attr;
+	int value;
+	/* The set request and the fence after it */
+	Batch batch;
+	/* From set(), for standalone backends */
+	unsigned int sequence;
+	/* CLOCK_MONOTONIC in ns, 0 for none */
+	uint64_t deadline;
+	/* When it was sent, if statistics are being collected */
+	uint64_t start;
+	TVoutCtlSetDone done;
+	void *data;
+};
+
+/* Latest value handed to tvout_ctl_set_coalesced() */
+typedef struct {
+	bool pending;
+	int target;
+	/* Last value sent */
+	int value;
+	/* Flushes left to reach the target */
+	int steps;
+} TVoutCtlCoalesce;
+
+struct _TVoutCtl {
+	Display *dpy;
+	xcb_connection_t *conn;
+	/*
+	 * The Display belongs to the application, which reads the
+	 * events and hands ours over with tvout_ctl_filter_event().
+	 */
+	bool shared;
+	/* Events filtered since the last events_done() */
+	bool filtered;
+
+	/*
+	 * Copied from the chosen backend so that the
+	 * hot paths don't have to go through it.
+	 */
+	void *priv;
+	bool (*handle_event)(void *priv, const XEvent *e);
+	int (*set)(void *priv, enum TVoutCtlAttr attr, int value,
+		   unsigned int *sequence);
+	int (*get)(void *priv, enum TVoutCtlAttr attr);
+	const TVoutCtlBackend *backend;
+
+	/* The extension queries, until their replies are in */
+	Batch exts;
+	/* Backends still being probed */
+	TVoutCtlCandidate candidates[MAX_BACKENDS];
+	int num_candidates;
+	int status;
+
+	/* In request order */
+	TVoutCtlPendingSet *pending;
+	int timer_fd;
+
+	TVoutCtlCoalesce coalesce[NUM_CTL_ATTRS];
+	/* In ns, CLOCK_MONOTONIC */
+	uint64_t pace_interval;
+	uint64_t last_flush;
+	uint64_t next_flush;
+	int smooth_steps;
+
+	/* What tvout_ctl_get() returns, safe to read from any thread */
+	TVoutCtlSnapshot snapshot;
+	/* The snapshot above, or the one published by tvout-ctld */
+	const TVoutCtlSnapshot *view;
+
+	TVoutCtlNotify ui_notify;
+	TVoutCtlBatchNotify batch_notify;
+	TVoutCtlOutputNotify output_notify;
+	TVoutCtlNotifyExt notify_ext;
+	void *ui_data;
+	/* Bitmask of attributes notified since the last batch_notify */
+	unsigned int changed;
+
+	/*
+	 * For notify_ext, the attributes of output 0 we've set
+	 * whose notification hasn't come yet, and the values.
+	 */
+	unsigned int self_pending;
+	int self_values[NUM_CTL_ATTRS];
+
+	/* TVOUT_CTL_INIT_THREAD */
+	TVoutCtlThread *thread;
+
+	/* Talking to tvout-ctld instead of the X server */
+	TVoutCtlClient *client;
+
+	/* Only updated while enabled */
+	bool stats_enabled;
+	TVoutCtlStats stats;
+	/* CLOCK_MONOTONIC in ns */
+	uint64_t init_time;
+	/*
+	 * When the first of the events handled since the last
+	 * drain was read, 0 if there were none or nobody's
+	 * measuring.
+	 */
+	uint64_t event_time;
+};
+
+/* Whether anyone wants to know when events come in */
+static inline bool ctl_timing(const TVoutCtl *ctl)
+{
+	return ctl->stats_enabled || ctl->notify_ext;
+}
+
+/* A disabled counter costs a branch */
+#define CTL_STATS_INC(ctl, counter)			\
+	do {						\
+		if ((ctl)->stats_enabled)		\
+			(ctl)->stats.counter++;		\
+	} while (0)
+
+/* CLOCK_MONOTONIC, which the latencies are measured with */
+uint64_t ctl_monotonic_ns(void);
+
+/* Adds the time since start, unless start is 0. */
+void ctl_stats_latency(TVoutCtl *ctl, enum TVoutCtlHist hist, uint64_t start);
+
+/* For the backends to report attribute changes */
+void ctl_notify(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value);
+void ctl_notify_output(TVoutCtl *ctl, int output, enum TVoutCtlAttr attr,
+		       int value);
+/*
+ * For changes that come with a server timestamp, or that take
+ * a round trip to find out about after the event. NULL means
+ * the event being handled, without a timestamp.
+ */
+void ctl_notify_received(TVoutCtl *ctl, int output, enum TVoutCtlAttr attr,
+			 int value, const CtlEventTime *when);
+
+struct _xEvent;
+
+typedef Bool (*CtlWireToEvent)(Display *dpy, XEvent *event,
+			       struct _xEvent *wire);
+
+/*
+ * Lets Xlib convert an extension event without the blocking
+ * extension query that the extension's own library would make.
+ * A converter that is already there is left in place.
+ */
+void ctl_wire_to_event(TVoutCtl *ctl, int event, CtlWireToEvent proc);
+
+/* Handles whatever the X connection and the timer have for us */
+void ctl_dispatch(TVoutCtl *ctl);
+
+/*
+ * Whether ctl_dispatch() has work the fd won't wake anyone
+ * up for, such as events Xlib has already read.
+ */
+bool ctl_needs_dispatch(TVoutCtl *ctl);
+
+/* The X connection, or a standalone backend's own fd */
+int ctl_event_fd(TVoutCtl *ctl);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tvout-ctl-proto.h"
+
+/*
+ * Keyed by $DISPLAY rather than by what the X server says, so
+ * that clients can find the daemon without connecting to X.
+ */
+bool proto_path(const char *suffix, char *path, size_t len)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	const char *display = getenv("DISPLAY");
+	char *p;
+	int r;
+
+	if (!dir || !*dir || !display || !*display)
+		return false;
+
+	r = snprintf(path, len, "%s/tvout-ctld-", dir);
+	if (r <= 0 || (size_t) r >= len)
+		return false;
+
+	/* The display name may contain a host name with slashes. */
+	p = path + r;
+	r = snprintf(p, len - r, "%s.%s", display, suffix);
+	if (r <= 0 || (size_t) r >= len - (p - path))
+		return false;
+
+	for (; *p; p++)
+		if (*p == '/')
+			*p = '_';
+
+	return true;
+}
@@ -0,0 +1,84 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_PROTO_H
+#define TVOUT_CTL_PROTO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tvout-ctl.h"
+#include "tvout-ctl-snapshot.h"
+
+/*
+ * What tvout-ctld and its clients share. The state is published
+ * in a page the clients map read-only, so that reading it costs
+ * no syscalls. Everything else goes over a SOCK_SEQPACKET socket,
+ * one ProtoMsg per packet. Both live in $XDG_RUNTIME_DIR and are
+ * named after $DISPLAY.
+ */
+
+#define PROTO_MAGIC 0x54564344 /* "TVCD" */
+#define PROTO_VERSION 2
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	TVoutCtlSnapshot snapshot;
+} ProtoPage;
+
+enum {
+	/* Client to daemon, each one gets a PROTO_REPLY */
+	PROTO_SET,
+	/* args[0] is the timeout, PROTO_SET_DONE follows later */
+	PROTO_SET_ASYNC,
+	PROTO_SET_COALESCED,
+	PROTO_SET_MANY,
+	/* args[0] is the interval, args[1] the smoothing steps */
+	PROTO_SET_PACING,
+
+	/*
+	 * Daemon to client. PROTO_WELCOME comes first, a daemon
+	 * that has no room for another client closes the socket
+	 * instead.
+	 */
+	PROTO_WELCOME,
+	PROTO_REPLY,
+	PROTO_SET_DONE,
+	/* values has everything that changed */
+	PROTO_NOTIFY,
+};
+
+#define PROTO_MAX_VALUES 32
+
+typedef struct {
+	uint32_t type;
+	/* Matches the replies to the requests */
+	uint32_t serial;
+	int32_t result;
+	int32_t args[2];
+	int32_t num_values;
+	TVoutCtlAttrValue values[PROTO_MAX_VALUES];
+} ProtoMsg;
+
+/* suffix is "sock" or "state" */
+bool proto_path(const char *suffix, char *path, size_t len);
+
+#endif
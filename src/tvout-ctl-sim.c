@@ -0,0 +1,376 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "tvout-ctl.h"
+#include "tvout-ctl-sim.h"
+#include "tvout-ctl-private.h"
+
+/*
+ * What the RandR properties and Xv attributes
+ * of the N900 TV out look like.
+ */
+static const struct {
+	int min;
+	int max;
+	int value;
+} sim_attrs[NUM_CTL_ATTRS] = {
+	[TVOUT_CTL_ENABLE] = { 0, 1, 0, },
+	/* SignalProperties: PAL, NTSC */
+	[TVOUT_CTL_TV_STD] = { 0, 1, 0, },
+	/* TVAspectRatio: 4:3, 16:9 */
+	[TVOUT_CTL_ASPECT] = { 0, 1, 0, },
+	[TVOUT_CTL_SCALE] = { 1, 100, 90, },
+	[TVOUT_CTL_DYNAMIC_ASPECT] = { 0, 1, 0, },
+	[TVOUT_CTL_XOFFSET] = { -128, 128, 0, },
+	[TVOUT_CTL_YOFFSET] = { -128, 128, 0, },
+	[TVOUT_CTL_FULLSCREEN_VIDEO] = { 0, 1, 1, },
+};
+
+/* A change the "server" hasn't reported yet */
+typedef struct {
+	enum TVoutCtlAttr attr;
+	int value;
+	/* CLOCK_MONOTONIC in ns */
+	uint64_t due;
+	/* Of the set() that made it, 0 for tvout_ctl_sim_change() */
+	unsigned int sequence;
+} SimChange;
+
+typedef struct {
+	TVoutCtl *tvout;
+
+	/* timerfd, readable once the oldest change is due */
+	int fd;
+	/* In ns */
+	uint64_t latency;
+
+	/* As last reported */
+	int values[NUM_CTL_ATTRS];
+
+	/* Like X request sequence numbers, but only counting sets */
+	unsigned int last_sequence;
+	unsigned int done_sequence;
+
+	/* Oldest first, starting at head */
+	SimChange *queue;
+	int head;
+	int num_queued;
+	int max_queued;
+} SimCtl;
+
+static bool valid_value(enum TVoutCtlAttr attr, int value)
+{
+	if (attr < 0 || attr >= NUM_CTL_ATTRS)
+		return false;
+
+	return value >= sim_attrs[attr].min && value <= sim_attrs[attr].max;
+}
+
+static void sim_arm(SimCtl *ctl)
+{
+	struct itimerspec its = {};
+	uint64_t due;
+
+	if (ctl->num_queued) {
+		/* Zero would disarm it, and anything in the past fires. */
+		due = ctl->queue[ctl->head].due ?: 1;
+		its.it_value.tv_sec = due / 1000000000ULL;
+		its.it_value.tv_nsec = due % 1000000000ULL;
+	}
+
+	timerfd_settime(ctl->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int sim_queue(SimCtl *ctl, enum TVoutCtlAttr attr, int value,
+		     unsigned int sequence)
+{
+	SimChange *c;
+	uint64_t due = ctl_monotonic_ns() + ctl->latency;
+
+	if (ctl->head + ctl->num_queued == ctl->max_queued) {
+		if (ctl->head) {
+			memmove(ctl->queue, ctl->queue + ctl->head,
+				ctl->num_queued * sizeof *c);
+			ctl->head = 0;
+		} else {
+			int max = ctl->max_queued ? ctl->max_queued * 2 : 16;
+
+			c = realloc(ctl->queue, max * sizeof *c);
+			if (!c)
+				return -1;
+
+			ctl->queue = c;
+			ctl->max_queued = max;
+		}
+	}
+
+	/* Like a real server, report changes in the order they were made. */
+	if (ctl->num_queued) {
+		c = &ctl->queue[ctl->head + ctl->num_queued - 1];
+		if (due < c->due)
+			due = c->due;
+	}
+
+	c = &ctl->queue[ctl->head + ctl->num_queued];
+	c->attr = attr;
+	c->value = value;
+	c->due = due;
+	c->sequence = sequence;
+
+	if (ctl->num_queued++ == 0)
+		sim_arm(ctl);
+
+	return 0;
+}
+
+static void *sim_probe_start(TVoutCtl *tvout)
+{
+	/* Async init waits for the fd before taking the next step. */
+	struct itimerspec its = { .it_value.tv_nsec = 1, };
+	SimCtl *ctl;
+	int i;
+
+	ctl = calloc(1, sizeof *ctl);
+	if (!ctl)
+		return NULL;
+
+	ctl->tvout = tvout;
+
+	ctl->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (ctl->fd < 0) {
+		free(ctl);
+		return NULL;
+	}
+
+	for (i = 0; i < NUM_CTL_ATTRS; i++)
+		ctl->values[i] = sim_attrs[i].value;
+
+	timerfd_settime(ctl->fd, 0, &its, NULL);
+
+	return ctl;
+}
+
+static int sim_probe_step(void *priv, bool wait)
+{
+	(void) priv;
+	(void) wait;
+
+	return 1;
+}
+
+static void sim_exit(void *priv)
+{
+	SimCtl *ctl = priv;
+
+	close(ctl->fd);
+	free(ctl->queue);
+	free(ctl);
+}
+
+static bool sim_handle_event(void *priv, const XEvent *e)
+{
+	(void) priv;
+	(void) e;
+
+	return false;
+}
+
+static void sim_events_done(void *priv)
+{
+	SimCtl *ctl = priv;
+	uint64_t now = ctl_monotonic_ns();
+	uint64_t expirations;
+
+	/* Only clears the readiness, the queue says what is due. */
+	while (read(ctl->fd, &expirations, sizeof expirations) > 0)
+		;
+
+	while (ctl->num_queued && ctl->queue[ctl->head].due <= now) {
+		/* The notify callback may queue more. */
+		SimChange c = ctl->queue[ctl->head];
+		/* As if the event had been read when it was due */
+		CtlEventTime when = {
+			.received = ctl_timing(ctl->tvout) ? c.due : 0,
+		};
+
+		ctl->head++;
+		ctl->num_queued--;
+
+		if (c.sequence)
+			ctl->done_sequence = c.sequence;
+
+		CTL_STATS_INC(ctl->tvout, events);
+
+		/* Like the X backends, only changes get reported. */
+		if (ctl->values[c.attr] == c.value)
+			continue;
+
+		ctl->values[c.attr] = c.value;
+		ctl_notify_received(ctl->tvout, 0, c.attr, c.value, &when);
+	}
+
+	if (!ctl->num_queued)
+		ctl->head = 0;
+
+	sim_arm(ctl);
+}
+
+static bool sim_needs_dispatch(void *priv)
+{
+	const SimCtl *ctl = priv;
+
+	return ctl->num_queued && ctl->queue[ctl->head].due <= ctl_monotonic_ns();
+}
+
+static int sim_check(void *priv, enum TVoutCtlAttr attr, int value)
+{
+	const SimCtl *ctl = priv;
+
+	if (!valid_value(attr, value))
+		return -1;
+
+	return ctl->values[attr] != value;
+}
+
+/*
+ * Like the X backends, only a change is sent. The "server"
+ * processes it once the latency has passed, which is when
+ * the notification comes in and tvout_ctl_set_async() is done.
+ */
+static int sim_set(void *priv, enum TVoutCtlAttr attr, int value,
+		   unsigned int *sequence)
+{
+	SimCtl *ctl = priv;
+	unsigned int seq;
+
+	if (!valid_value(attr, value))
+		return -1;
+
+	if (ctl->values[attr] == value) {
+		CTL_STATS_INC(ctl->tvout, redundant_sets);
+		return 0;
+	}
+
+	/* Zero is for changes nobody waits for. */
+	seq = ++ctl->last_sequence ?: ++ctl->last_sequence;
+
+	if (sim_queue(ctl, attr, value, seq) < 0)
+		return -1;
+
+	if (sequence)
+		*sequence = seq;
+
+	return 1;
+}
+
+static int sim_get(void *priv, enum TVoutCtlAttr attr)
+{
+	const SimCtl *ctl = priv;
+
+	return ctl->values[attr];
+}
+
+static int sim_fd(void *priv)
+{
+	const SimCtl *ctl = priv;
+
+	return ctl->fd;
+}
+
+static bool sim_set_done(void *priv, unsigned int sequence)
+{
+	const SimCtl *ctl = priv;
+
+	/* Wraps around like the X sequence numbers */
+	return (int) (ctl->done_sequence - sequence) >= 0;
+}
+
+const TVoutCtlBackend sim_backend = {
+	.name = "sim",
+	.standalone = true,
+	.probe_start = sim_probe_start,
+	.probe_step = sim_probe_step,
+	.exit = sim_exit,
+	.handle_event = sim_handle_event,
+	.events_done = sim_events_done,
+	.needs_dispatch = sim_needs_dispatch,
+	.check = sim_check,
+	.set = sim_set,
+	.get = sim_get,
+	.fd = sim_fd,
+	.set_done = sim_set_done,
+};
+
+/* The event thread may be looking at the queue. */
+static SimCtl *sim_lock(TVoutCtl *tvout)
+{
+	if (!tvout || tvout->backend != &sim_backend)
+		return NULL;
+
+	if (tvout->thread)
+		thread_lock(tvout);
+
+	return tvout->priv;
+}
+
+static void sim_unlock(TVoutCtl *tvout)
+{
+	if (tvout->thread)
+		thread_unlock(tvout);
+}
+
+int tvout_ctl_sim_change(TVoutCtl *tvout, enum TVoutCtlAttr attr, int value)
+{
+	SimCtl *ctl;
+	int r = -1;
+
+	ctl = sim_lock(tvout);
+	if (!ctl)
+		return -1;
+
+	if (valid_value(attr, value))
+		r = sim_queue(ctl, attr, value, 0);
+
+	sim_unlock(tvout);
+
+	return r;
+}
+
+int tvout_ctl_sim_set_latency(TVoutCtl *tvout, unsigned int latency_us)
+{
+	SimCtl *ctl;
+
+	ctl = sim_lock(tvout);
+	if (!ctl)
+		return -1;
+
+	ctl->latency = latency_us * 1000ULL;
+
+	sim_unlock(tvout);
+
+	return 0;
+}
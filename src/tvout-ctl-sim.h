@@ -0,0 +1,63 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_SIM_H
+#define TVOUT_CTL_SIM_H
+
+/*
+ * Controls for the "sim" backend, which keeps the attributes in
+ * memory instead of talking to the X server. It's picked with
+ * TVOUT_CTL_BACKEND=sim, or when no other backend was built, and
+ * is meant for measuring the library's own overhead without X
+ * getting in the way. The tvout-ctl-xtrace.so preload module
+ * replays recorded X traffic through the real backends instead.
+ *
+ * Changes, whether from tvout_ctl_set() and friends or from
+ * tvout_ctl_sim_change(), are reported through tvout_ctl_fd()
+ * like server events would be, once the latency has passed.
+ * As with the X backends, a value the attribute already has by
+ * then isn't reported again.
+ *
+ * All of these fail with -1 if the sim backend isn't in use.
+ */
+
+#include "tvout-ctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pretends someone else changed the attribute on the server.
+ * Returns -1 if the value is out of range.
+ */
+int tvout_ctl_sim_change(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value);
+
+/*
+ * How long it takes for a change to be reported, in
+ * microseconds. Zero, the default, reports changes on the next
+ * tvout_ctl_fd_ready(). Changes already queued aren't affected.
+ */
+int tvout_ctl_sim_set_latency(TVoutCtl *ctl, unsigned int latency_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_SNAPSHOT_H
+#define TVOUT_CTL_SNAPSHOT_H
+
+#include "tvout-ctl.h"
+
+/*
+ * Two copies of the attribute values so that readers always
+ * have one that isn't being written to.
+ */
+typedef struct {
+	unsigned int seq;
+	TVoutCtlState copies[2];
+} TVoutCtlSnapshot;
+
+/*
+ * The snapshot is a seqcount latch: the writer updates the two
+ * copies one after the other, and the sequence number tells
+ * readers which copy is not being written to right now. Readers
+ * never wait for the writer, and there's only ever one writer
+ * since that's whoever owns the X connection. The snapshot can
+ * live in memory shared with other processes, see tvout-ctld.
+ */
+static inline void snapshot_write(TVoutCtlSnapshot *snap, const TVoutCtlState *state,
+			   int attr, int value)
+{
+	int i, j;
+
+	for (i = 0; i < 2; i++) {
+		__atomic_store_n(&snap->seq, snap->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		if (!state) {
+			__atomic_store_n(&snap->copies[i].values[attr], value,
+					 __ATOMIC_RELAXED);
+			continue;
+		}
+
+		for (j = 0; j < TVOUT_CTL_NUM_ATTRS; j++)
+			__atomic_store_n(&snap->copies[i].values[j], state->values[j],
+					 __ATOMIC_RELAXED);
+	}
+}
+
+static inline void snapshot_read(const TVoutCtlSnapshot *snap, TVoutCtlState *state)
+{
+	unsigned int seq;
+	int i;
+
+	do {
+		const TVoutCtlState *copy;
+
+		seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+		copy = &snap->copies[seq & 1];
+
+		for (i = 0; i < TVOUT_CTL_NUM_ATTRS; i++)
+			state->values[i] = __atomic_load_n(&copy->values[i],
+							   __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq != __atomic_load_n(&snap->seq, __ATOMIC_RELAXED));
+}
+
+/* A single value can't be torn, so no need to retry. */
+static inline int snapshot_get(const TVoutCtlSnapshot *snap, int attr)
+{
+	unsigned int seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&snap->copies[seq & 1].values[attr],
+			       __ATOMIC_RELAXED);
+}
+
+#endif
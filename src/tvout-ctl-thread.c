@@ -0,0 +1,282 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <xcb/xcb.h>
+
+#include "tvout-ctl-private.h"
+#include "tvout-ctl-thread.h"
+
+static bool ring_push(ThreadRing *r, const ThreadEvent *ev)
+{
+	unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	if (r->tail - head == THREAD_RING_SIZE)
+		return false;
+
+	r->events[r->tail % THREAD_RING_SIZE] = *ev;
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static bool ring_pop(ThreadRing *r, ThreadEvent *ev)
+{
+	unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	if (r->head == tail)
+		return false;
+
+	*ev = r->events[r->head % THREAD_RING_SIZE];
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static bool spill_push(ThreadRing *r, const ThreadEvent *ev)
+{
+	if (r->num_spill == r->max_spill) {
+		int max_spill = r->max_spill ? 2 * r->max_spill : THREAD_RING_SIZE;
+		ThreadEvent *spill = realloc(r->spill, max_spill * sizeof spill[0]);
+
+		if (!spill)
+			return false;
+
+		r->spill = spill;
+		r->max_spill = max_spill;
+	}
+
+	r->spill[r->num_spill++] = *ev;
+	__atomic_store_n(&r->spilled, 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+void thread_push(TVoutCtl *ctl, const ThreadEvent *ev)
+{
+	TVoutCtlThread *t = ctl->thread;
+	ThreadRing *r = &t->ring;
+
+	if ((r->spilled || !ring_push(r, ev)) && !spill_push(r, ev)) {
+		fprintf(stderr, "tvout-ctl: out of memory, event lost\n");
+		return;
+	}
+
+	t->pushed = true;
+}
+
+static void eventfd_signal(int fd)
+{
+	uint64_t one = 1;
+
+	while (write(fd, &one, sizeof one) < 0 && errno == EINTR)
+		;
+}
+
+static void eventfd_clear(int fd)
+{
+	uint64_t count;
+
+	while (read(fd, &count, sizeof count) > 0)
+		;
+}
+
+/* One wakeup per lock section is enough. */
+static void unlock_and_wake(TVoutCtlThread *t)
+{
+	bool pushed = t->pushed;
+
+	t->pushed = false;
+	pthread_mutex_unlock(&t->lock);
+
+	if (pushed)
+		eventfd_signal(t->wake_fd);
+}
+
+void thread_lock(TVoutCtl *ctl)
+{
+	pthread_mutex_lock(&ctl->thread->lock);
+}
+
+/*
+ * The application may have read events or replies off the
+ * socket while it had the lock, so the thread has to take
+ * another look even if the socket itself stays quiet.
+ */
+void thread_unlock(TVoutCtl *ctl)
+{
+	TVoutCtlThread *t = ctl->thread;
+
+	unlock_and_wake(t);
+	eventfd_signal(t->kick_fd);
+}
+
+void thread_ack(TVoutCtl *ctl)
+{
+	eventfd_clear(ctl->thread->wake_fd);
+}
+
+bool thread_pop(TVoutCtl *ctl, ThreadEvent *ev)
+{
+	TVoutCtlThread *t = ctl->thread;
+	ThreadRing *r = &t->ring;
+
+	for (;;) {
+		if (r->drain_pos < r->num_drain) {
+			*ev = r->drain[r->drain_pos++];
+			return true;
+		}
+
+		free(r->drain);
+		r->drain = NULL;
+		r->num_drain = 0;
+		r->drain_pos = 0;
+
+		if (ring_pop(r, ev))
+			return true;
+
+		if (!__atomic_load_n(&r->spilled, __ATOMIC_ACQUIRE))
+			return false;
+
+		/* The ring is empty, so the spilled events are next. */
+		pthread_mutex_lock(&t->lock);
+		r->drain = r->spill;
+		r->num_drain = r->num_spill;
+		r->spill = NULL;
+		r->num_spill = 0;
+		r->max_spill = 0;
+		__atomic_store_n(&r->spilled, 0, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&t->lock);
+	}
+}
+
+bool thread_pending(TVoutCtl *ctl)
+{
+	const ThreadRing *r = &ctl->thread->ring;
+
+	return r->drain_pos < r->num_drain ||
+		r->head != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) ||
+		__atomic_load_n(&r->spilled, __ATOMIC_ACQUIRE);
+}
+
+static void *thread_main(void *data)
+{
+	TVoutCtl *ctl = data;
+	TVoutCtlThread *t = ctl->thread;
+	struct pollfd fds[3] = {
+		{ .fd = ctl_event_fd(ctl), .events = POLLIN, },
+		{ .fd = t->kick_fd, .events = POLLIN, },
+		{ .fd = ctl->timer_fd, .events = POLLIN, },
+	};
+
+	for (;;) {
+		bool queued;
+
+		pthread_mutex_lock(&t->lock);
+
+		ctl_dispatch(ctl);
+
+		/*
+		 * Don't go to sleep on events Xlib has already read,
+		 * replies XCB has, or changes the backend has due.
+		 */
+		queued = ctl_needs_dispatch(ctl);
+
+		/* Nothing more to hear from a dead connection */
+		if (ctl->conn && xcb_connection_has_error(ctl->conn))
+			fds[0].fd = -1;
+
+		unlock_and_wake(t);
+
+		if (queued)
+			continue;
+
+		if (poll(fds, 3, -1) < 0 && errno != EINTR)
+			break;
+
+		if (fds[1].revents & POLLIN) {
+			eventfd_clear(t->kick_fd);
+
+			if (__atomic_load_n(&t->quit, __ATOMIC_ACQUIRE))
+				break;
+		}
+	}
+
+	return NULL;
+}
+
+bool thread_start(TVoutCtl *ctl)
+{
+	TVoutCtlThread *t;
+
+	t = calloc(1, sizeof *t);
+	if (!t)
+		return false;
+
+	t->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	t->kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (t->wake_fd < 0 || t->kick_fd < 0)
+		goto err;
+
+	if (pthread_mutex_init(&t->lock, NULL))
+		goto err;
+
+	ctl->thread = t;
+
+	if (pthread_create(&t->thread, NULL, thread_main, ctl)) {
+		ctl->thread = NULL;
+		pthread_mutex_destroy(&t->lock);
+		goto err;
+	}
+
+	return true;
+
+ err:
+	if (t->wake_fd >= 0)
+		close(t->wake_fd);
+	if (t->kick_fd >= 0)
+		close(t->kick_fd);
+	free(t);
+	return false;
+}
+
+void thread_stop(TVoutCtl *ctl)
+{
+	TVoutCtlThread *t = ctl->thread;
+
+	__atomic_store_n(&t->quit, 1, __ATOMIC_RELEASE);
+	eventfd_signal(t->kick_fd);
+	pthread_join(t->thread, NULL);
+
+	ctl->thread = NULL;
+
+	pthread_mutex_destroy(&t->lock);
+	close(t->wake_fd);
+	close(t->kick_fd);
+	free(t->ring.spill);
+	free(t->ring.drain);
+	free(t);
+}
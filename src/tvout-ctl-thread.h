@@ -0,0 +1,105 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_THREAD_H
+#define TVOUT_CTL_THREAD_H
+
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include "tvout-ctl.h"
+
+enum {
+	THREAD_EVENT_NOTIFY,
+	THREAD_EVENT_SET_DONE,
+};
+
+/* What the event thread hands over to the application */
+typedef struct {
+	int type;
+	int output;
+	enum TVoutCtlAttr attr;
+	int value;
+	int result;
+	TVoutCtlSetDone done;
+	void *data;
+	/* For notify_ext */
+	uint64_t received;
+	unsigned long server_time;
+	enum TVoutCtlOrigin origin;
+} ThreadEvent;
+
+#define THREAD_RING_SIZE 256
+
+/*
+ * Single producer, single consumer. The producer is whoever
+ * holds the handle lock, the consumer is tvout_ctl_fd_ready().
+ * Events that don't fit spill into a list protected by the
+ * lock, and the ring isn't used again until the consumer has
+ * taken the spilled events so that the order is kept.
+ */
+typedef struct {
+	unsigned int head;
+	unsigned int tail;
+	ThreadEvent events[THREAD_RING_SIZE];
+
+	int spilled;
+	ThreadEvent *spill;
+	int num_spill;
+	int max_spill;
+
+	/* Spilled events taken over by the consumer */
+	ThreadEvent *drain;
+	int num_drain;
+	int drain_pos;
+} ThreadRing;
+
+typedef struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/* Readable when there are events for the application */
+	int wake_fd;
+	/* Wakes up the thread */
+	int kick_fd;
+	int quit;
+	/* Events were pushed since the last wakeup */
+	bool pushed;
+	ThreadRing ring;
+} TVoutCtlThread;
+
+/*
+ * The thread owns the X connection. The application side
+ * only touches it with the lock held.
+ */
+bool thread_start(TVoutCtl *ctl);
+void thread_stop(TVoutCtl *ctl);
+
+void thread_lock(TVoutCtl *ctl);
+void thread_unlock(TVoutCtl *ctl);
+
+/* With the lock held */
+void thread_push(TVoutCtl *ctl, const ThreadEvent *ev);
+
+/* Application side */
+void thread_ack(TVoutCtl *ctl);
+bool thread_pop(TVoutCtl *ctl, ThreadEvent *ev);
+bool thread_pending(TVoutCtl *ctl);
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TVOUT_CTL_USDT_H
+#define TVOUT_CTL_USDT_H
+
+/*
+ * Static probes for perf and bpftrace, built in with --enable-sdt.
+ * They all belong to the tvout_ctl provider, and cost a nop each
+ * while nobody is tracing. contrib/ has scripts that use them.
+ */
+
+#ifdef ENABLE_SDT
+
+#include <sys/sdt.h>
+
+#define USDT(name) DTRACE_PROBE(tvout_ctl, name)
+#define USDT1(name, a) DTRACE_PROBE1(tvout_ctl, name, a)
+#define USDT2(name, a, b) DTRACE_PROBE2(tvout_ctl, name, a, b)
+#define USDT3(name, a, b, c) DTRACE_PROBE3(tvout_ctl, name, a, b, c)
+
+#else
+
+#define USDT(name) do { } while (0)
+#define USDT1(name, a) do { } while (0)
+#define USDT2(name, a, b) do { } while (0)
+#define USDT3(name, a, b, c) do { } while (0)
+
+#endif
+
+#endif
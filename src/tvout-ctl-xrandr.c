@@ -17,24 +17,38 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdbool.h>
-#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
-#include <X11/Xmd.h>
+#include <X11/Xlibint.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/extensions/Xrandr.h>
+#include <xcb/xcb.h>
+#include <xcb/randr.h>
 
 #include "tvout-ctl.h"
+#include "tvout-ctl-batch.h"
+#include "tvout-ctl-cache.h"
+#include "tvout-ctl-private.h"
+#include "tvout-ctl-usdt.h"
 
 typedef struct {
 	Atom atom;
 	Atom type;
 
 	long value;
-	XRRPropertyInfo *info;
+
+	bool range;
+	int num_values;
+	long *values;
 } RRProp;
 
 enum {
@@ -71,302 +85,644 @@ static const Atom prop_types[NUM_PROPS] = {
 	[PROP_XV_CLONE_FULLSCREEN] = XA_INTEGER,
 };
 
-struct _TVoutCtl {
-	Display *dpy;
-	int event_base;
+/* SignalFormat isn't exposed to the user */
+static const int prop_attrs[NUM_PROPS] = {
+	[PROP_SIGNAL_FORMAT] = -1,
+	[PROP_SIGNAL_PROPERTIES] = TVOUT_CTL_TV_STD,
+	[PROP_TV_ASPECT_RATIO] = TVOUT_CTL_ASPECT,
+	[PROP_TV_SCALE] = TVOUT_CTL_SCALE,
+	[PROP_TV_DYNAMIC_ASPECT_RATIO] = TVOUT_CTL_DYNAMIC_ASPECT,
+	[PROP_TV_X_OFFSET] = TVOUT_CTL_XOFFSET,
+	[PROP_TV_Y_OFFSET] = TVOUT_CTL_YOFFSET,
+	[PROP_XV_CLONE_FULLSCREEN] = TVOUT_CTL_FULLSCREEN_VIDEO,
+};
+
+/*
+ * The X driver forgot to provide the list of valid
+ * values for some properties. These are the names
+ * of the values we fill in ourselves.
+ */
+static const char *fixup_names[NUM_PROPS][2] = {
+	[PROP_SIGNAL_FORMAT] = { "Composite-PAL", "Composite-NTSC", },
+	[PROP_SIGNAL_PROPERTIES] = { "PAL", "NTSC", },
+	[PROP_TV_ASPECT_RATIO] = { "4:3", "16:9", },
+};
+
+#define CACHE_MAX_VALUES 8
+#define CACHE_MAX_OUTPUTS 4
+
+#define OUTPUT_NAME_LEN 32
+
+/* What gets stored in the probe cache */
+typedef struct {
+	uint32_t num_outputs;
+	struct {
+		uint32_t output;
+		uint32_t crtc;
+		uint32_t mode;
+		char name[OUTPUT_NAME_LEN];
+		struct {
+			uint32_t atom;
+			int32_t range;
+			int32_t num_values;
+			int32_t values[CACHE_MAX_VALUES];
+		} props[NUM_PROPS];
+	} outputs[CACHE_MAX_OUTPUTS];
+} RRCache;
+
+enum {
+	PROBE_CACHED,
+	PROBE_SCREEN,
+	PROBE_OUTPUTS,
+	PROBE_PROPERTIES,
+	PROBE_DONE,
+	PROBE_FAILED,
+};
 
+typedef struct {
+	RROutput output;
 	RRCrtc crtc;
 	RRMode mode;
-	RROutput output;
+	char name[OUTPUT_NAME_LEN];
 	bool enabled;
 	RRProp props[NUM_PROPS];
 
-	TVoutCtlNotify ui_notify;
-	void *ui_data;
-};
+	/*
+	 * What the CRTC last ran with, kept across our own disables.
+	 * None when there's nothing to restore.
+	 */
+	RRMode crtc_mode;
+	int crtc_x, crtc_y;
+	uint16_t crtc_rotation;
+	/* A disable of ours is on its way */
+	bool crtc_disabling;
+	/* When the last enable was sent, for the stats */
+	uint64_t enable_start;
+
+	/*
+	 * Props whose value changed on the server, and the
+	 * ones whose new values we're waiting for.
+	 */
+	unsigned int dirty;
+	unsigned int refetching;
+	/* Links for the dirty and refetch lists, -1 ends them */
+	int next_dirty;
+	int next_refetch;
+} RROut;
 
-static bool rr_init(TVoutCtl *ctl)
-{
-	Display *dpy;
-	int minor, major, event_base, error_base;
+/*
+ * Maps XIDs to output indices. Open addressing with linear
+ * probing, and at most half full so lookups stay short no
+ * matter how many outputs there are.
+ */
+typedef struct {
+	uint32_t *keys;
+	int *values;
+	unsigned int mask;
+} RRIndex;
 
-	dpy = XOpenDisplay(NULL);
-	if (!dpy)
-		return false;
+typedef struct {
+	TVoutCtl *tvout;
 
-	if (!XRRQueryVersion(dpy, &major, &minor)) {
-		XCloseDisplay(dpy);
+	Display *dpy;
+	xcb_connection_t *conn;
+	xcb_window_t root;
+	/* $TVOUT_CTL_OUTPUT, or NULL for the usual TV outputs */
+	const char *output_name;
+	/* Where the events are selected, see rr_events_init() */
+	xcb_window_t window;
+	int event_base;
+	bool selected;
+
+	/* The first one is the primary output */
+	RROut *outputs;
+	int num_outputs;
+	RRIndex output_index;
+	RRIndex crtc_index;
+
+	Atom atoms[NUM_PROPS];
+	Atom fixup_atoms[NUM_PROPS][2];
+
+	/*
+	 * Kept up to date by the screen and CRTC change
+	 * notifications so that turning an output on or off
+	 * is a single request.
+	 */
+	xcb_timestamp_t config_timestamp;
+	bool config_valid;
+	/* Cleared when the modes may have changed, see update_config() */
+	bool modes_valid;
+	/*
+	 * SetCrtcConfig requests nobody waits for. The last one is
+	 * sent again, once, if the config timestamp was stale.
+	 */
+	Batch crtc_set;
+	int crtc_set_idx;
+	int crtc_set_value;
+	bool crtc_set_retried;
+
+	/* Outputs with dirty props, and the ones being refetched */
+	int dirty_head;
+	int refetch_head;
+	Batch refetch;
+	/* The first event behind each list */
+	CtlEventTime dirty_time;
+	CtlEventTime refetch_time;
+
+	int probe_state;
+	Batch probe;
+	int probe_slot;
+	xcb_randr_get_screen_resources_reply_t *resources;
+} RRCtl;
+
+static bool index_init(RRIndex *idx, int num)
+{
+	unsigned int size = 4;
+
+	while (size < 2 * (unsigned int) num)
+		size <<= 1;
+
+	idx->keys = calloc(size, sizeof idx->keys[0]);
+	idx->values = calloc(size, sizeof idx->values[0]);
+	if (!idx->keys || !idx->values) {
+		free(idx->keys);
+		free(idx->values);
+		idx->keys = NULL;
+		idx->values = NULL;
 		return false;
 	}
 
-	printf("RandR extension %d.%d\n", major, minor);
+	idx->mask = size - 1;
 
-	if (!XRRQueryExtension(dpy, &event_base, &error_base)) {
-		XCloseDisplay(dpy);
-		return false;
-	}
+	return true;
+}
+
+static void index_free(RRIndex *idx)
+{
+	free(idx->keys);
+	free(idx->values);
+	idx->keys = NULL;
+	idx->values = NULL;
+	idx->mask = 0;
+}
+
+static unsigned int index_hash(const RRIndex *idx, uint32_t key)
+{
+	return (key * 2654435761u) & idx->mask;
+}
 
-	printf("RandR event_base=%d error_base=%d\n", event_base, error_base);
+/* The first value added for a key wins. */
+static void index_add(RRIndex *idx, uint32_t key, int value)
+{
+	unsigned int i;
 
-	XRRSelectInput(dpy, DefaultRootWindow(dpy),
-		       RROutputChangeNotifyMask | RROutputPropertyNotifyMask);
+	if (key == 0)
+		return;
 
-	ctl->dpy = dpy;
-	ctl->event_base = event_base;
+	for (i = index_hash(idx, key); idx->keys[i]; i = (i + 1) & idx->mask)
+		if (idx->keys[i] == key)
+			return;
 
-	return true;
+	idx->keys[i] = key;
+	idx->values[i] = value;
 }
 
-static void rr_exit(TVoutCtl *ctl)
+static int index_lookup(const RRIndex *idx, uint32_t key)
 {
-	XRRSelectInput(ctl->dpy, DefaultRootWindow(ctl->dpy), 0);
-	XCloseDisplay(ctl->dpy);
+	unsigned int i;
+
+	if (!idx->keys || key == 0)
+		return -1;
+
+	for (i = index_hash(idx, key); idx->keys[i]; i = (i + 1) & idx->mask)
+		if (idx->keys[i] == key)
+			return idx->values[i];
+
+	return -1;
 }
 
-static bool realloc_property_info(RRProp *prop, int num_values)
+static bool build_index(RRCtl *ctl)
 {
-	/* FIXME somewhat questionable to use malloc()+XFree() */
-	XRRPropertyInfo *info = malloc(sizeof(XRRPropertyInfo) + num_values * sizeof(long));
-	if (!info)
+	int i;
+
+	if (!index_init(&ctl->output_index, ctl->num_outputs) ||
+	    !index_init(&ctl->crtc_index, ctl->num_outputs))
 		return false;
 
-	memcpy(info, prop->info, sizeof(XRRPropertyInfo));
+	for (i = 0; i < ctl->num_outputs; i++) {
+		index_add(&ctl->output_index, ctl->outputs[i].output, i);
+		index_add(&ctl->crtc_index, ctl->outputs[i].crtc, i);
+	}
+
+	return true;
+}
+
+static void wire_to_any(Display *dpy, XEvent *event, xEvent *wire)
+{
+	XAnyEvent *any = &event->xany;
 
-	info->num_values = num_values;
-	info->values = (long *) (info + 1);
+	any->type = wire->u.u.type & 0x7f;
+	any->serial = _XSetLastRequestRead(dpy, (xGenericReply *) wire);
+	any->send_event = (wire->u.u.type & 0x80) != 0;
+	any->display = dpy;
+}
 
-	XFree(prop->info);
-	prop->info = info;
+static Bool rr_wire_to_screen_change(Display *dpy, XEvent *event,
+				     xEvent *wire)
+{
+	const xcb_randr_screen_change_notify_event_t *w = (const void *) wire;
+	XRRScreenChangeNotifyEvent *e = (XRRScreenChangeNotifyEvent *) event;
+
+	wire_to_any(dpy, event, wire);
+	e->window = w->request_window;
+	e->root = w->root;
+	e->timestamp = w->timestamp;
+	e->config_timestamp = w->config_timestamp;
+	e->size_index = w->sizeID;
+	e->subpixel_order = w->subpixel_order;
+	e->rotation = w->rotation;
+	e->width = w->width;
+	e->height = w->height;
+	e->mwidth = w->mwidth;
+	e->mheight = w->mheight;
+
+	return True;
+}
 
-	return true;
+static Bool rr_wire_to_notify(Display *dpy, XEvent *event, xEvent *wire)
+{
+	const xcb_randr_notify_event_t *w = (const void *) wire;
+	XRRCrtcChangeNotifyEvent *cc = (XRRCrtcChangeNotifyEvent *) event;
+	XRROutputChangeNotifyEvent *oc = (XRROutputChangeNotifyEvent *) event;
+	XRROutputPropertyNotifyEvent *op = (XRROutputPropertyNotifyEvent *) event;
+
+	wire_to_any(dpy, event, wire);
+	((XRRNotifyEvent *) event)->subtype = w->subCode;
+
+	switch (w->subCode) {
+	case RRNotify_CrtcChange:
+		cc->window = w->u.cc.window;
+		cc->crtc = w->u.cc.crtc;
+		cc->mode = w->u.cc.mode;
+		cc->rotation = w->u.cc.rotation;
+		cc->x = w->u.cc.x;
+		cc->y = w->u.cc.y;
+		cc->width = w->u.cc.width;
+		cc->height = w->u.cc.height;
+		return True;
+	case RRNotify_OutputChange:
+		oc->window = w->u.oc.window;
+		oc->output = w->u.oc.output;
+		oc->crtc = w->u.oc.crtc;
+		oc->mode = w->u.oc.mode;
+		oc->rotation = w->u.oc.rotation;
+		oc->connection = w->u.oc.connection;
+		oc->subpixel_order = w->u.oc.subpixel_order;
+		return True;
+	case RRNotify_OutputProperty:
+		op->window = w->u.op.window;
+		op->output = w->u.op.output;
+		op->property = w->u.op.atom;
+		op->timestamp = w->u.op.timestamp;
+		op->state = w->u.op.status;
+		return True;
+	default:
+		return False;
+	}
 }
 
 /*
- * The X driver forgot to provide the list of valid
- * values for some properties. Fix it up manually.
+ * The event base comes from the prefetched extension reply, and
+ * we convert the events for Xlib ourselves, since XRRQueryExtension()
+ * would be a blocking round trip.
  */
-static bool fixup_property_info(TVoutCtl *ctl, RRProp *prop, const char *name)
+static void rr_events_init(RRCtl *ctl)
 {
-	if (strcmp(name, RR_PROPERTY_SIGNAL_FORMAT) == 0) {
-		if (!realloc_property_info(prop, 2))
-			return false;
-		prop->info->values[0] = XInternAtom(ctl->dpy, "Composite-PAL", True);
-		prop->info->values[1] = XInternAtom(ctl->dpy, "Composite-NTSC", True);
-		if (prop->info->values[0] == None ||
-		    prop->info->values[1] == None)
-			return false;
-	} else if (strcmp(name, RR_PROPERTY_SIGNAL_PROPERTIES) == 0) {
-		if (!realloc_property_info(prop, 2))
-			return false;
-		prop->info->values[0] = XInternAtom(ctl->dpy, "PAL", True);
-		prop->info->values[1] = XInternAtom(ctl->dpy, "NTSC", True);
-		if (prop->info->values[0] == None ||
-		    prop->info->values[1] == None)
-			return false;
-	} else if (strcmp(name, "TVAspectRatio") == 0) {
-		if (!realloc_property_info(prop, 2))
-			return false;
-		prop->info->values[0] = XInternAtom(ctl->dpy, "4:3", True);
-		prop->info->values[1] = XInternAtom(ctl->dpy, "16:9", True);
-		if (prop->info->values[0] == None ||
-		    prop->info->values[1] == None)
-			return false;
-	} else
+	if (ctl->selected)
+		return;
+
+	ctl_wire_to_event(ctl->tvout, ctl->event_base + RRScreenChangeNotify,
+			  rr_wire_to_screen_change);
+	ctl_wire_to_event(ctl->tvout, ctl->event_base + RRNotify,
+			  rr_wire_to_notify);
+
+	/*
+	 * RandR keeps one event mask per client and window, so on a
+	 * shared Display selecting on the root window would clobber
+	 * the application's own mask. Any window on the screen gets
+	 * the events, so use an unmapped one of our own instead.
+	 */
+	ctl->window = ctl->root;
+	if (ctl->tvout->shared) {
+		ctl->window = xcb_generate_id(ctl->conn);
+		xcb_create_window(ctl->conn, XCB_COPY_FROM_PARENT,
+				  ctl->window, ctl->root, 0, 0, 1, 1, 0,
+				  XCB_WINDOW_CLASS_INPUT_ONLY,
+				  XCB_COPY_FROM_PARENT, 0, NULL);
+	}
+
+	xcb_randr_select_input(ctl->conn, ctl->window,
+			       XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+			       XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
+			       XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE |
+			       XCB_RANDR_NOTIFY_MASK_OUTPUT_PROPERTY);
+	ctl->selected = true;
+}
+
+static void rr_events_exit(RRCtl *ctl)
+{
+	if (!ctl->selected)
+		return;
+
+	if (ctl->window != ctl->root)
+		xcb_destroy_window(ctl->conn, ctl->window);
+	else
+		xcb_randr_select_input(ctl->conn, ctl->root, 0);
+}
+
+static bool set_property_values(RRProp *prop, const int32_t *values, int num_values)
+{
+	int i;
+
+	if (num_values == 0)
+		return true;
+
+	prop->values = calloc(num_values, sizeof prop->values[0]);
+	if (!prop->values)
 		return false;
 
+	for (i = 0; i < num_values; i++)
+		prop->values[i] = values[i];
+
+	prop->num_values = num_values;
+
 	return true;
 }
 
-static bool probe_property(TVoutCtl *ctl, RRProp *prop, const char *name)
+static void free_property_values(RRProp *prop)
 {
-	Atom type;
-	int format;
-	unsigned long nitems, bytes_after;
-	unsigned char *data;
-	long value;
+	free(prop->values);
+	prop->values = NULL;
+	prop->num_values = 0;
+}
 
-	if (XRRGetOutputProperty(ctl->dpy, ctl->output, prop->atom,
-				 0, 100, False, False,
-				 prop->type, &type, &format,
-				 &nitems, &bytes_after, &data) != Success)
-		return false;
+static bool fixup_property_info(RRCtl *ctl, RRProp *prop, int i)
+{
+	int32_t values[2];
+	int j;
+
+	for (j = 0; j < 2; j++) {
+		if (ctl->fixup_atoms[i][j] == None)
+			return false;
+
+		values[j] = ctl->fixup_atoms[i][j];
+	}
+
+	return set_property_values(prop, values, 2);
+}
 
+static bool parse_property_value(const RRProp *prop,
+				 const xcb_randr_get_output_property_reply_t *reply,
+				 long *value)
+{
 	/* sanity check */
-	if (type != prop->type || format != 32 || nitems != 1) {
-		XFree(data);
+	if (!reply || reply->type != prop->type ||
+	    reply->format != 32 || reply->num_items != 1)
 		return false;
-	}
 
-	value = *(long *) data;
-	XFree(data);
+	if (prop->type == XA_INTEGER)
+		*value = *(int32_t *) xcb_randr_get_output_property_data(reply);
+	else
+		*value = *(uint32_t *) xcb_randr_get_output_property_data(reply);
+
+	return true;
+}
+
+static bool probe_property(RRProp *prop,
+			   const xcb_randr_get_output_property_reply_t *value_reply,
+			   const xcb_randr_query_output_property_reply_t *info)
+{
+	long value;
+
+	if (!parse_property_value(prop, value_reply, &value))
+		return false;
 
-	prop->info = XRRQueryOutputProperty(ctl->dpy, ctl->output, prop->atom);
-	if (!prop->info)
+	if (!info)
 		return false;
 
-	switch (type) {
+	prop->range = info->range;
+
+	switch (prop->type) {
 	case XA_INTEGER:
 		/* sanity check */
-		if (!prop->info->range || prop->info->num_values != 2) {
-			XFree(prop->info);
-			prop->info = NULL;
+		if (!info->range ||
+		    xcb_randr_query_output_property_valid_values_length(info) != 2)
 			return false;
-		}
-
-		prop->value = value;
 		break;
 	case XA_ATOM:
-		/* sanity check & fixup */
-		if (prop->info->range ||
-		    (prop->info->num_values == 0 &&
-		     !fixup_property_info(ctl, prop, name))) {
-			XFree(prop->info);
-			prop->info = NULL;
+		/* sanity check, fixup is done by the caller if needed */
+		if (info->range)
 			return false;
-		}
-
-		prop->value = value;
 		break;
 	default:
-		XFree(prop->info);
-		prop->info = NULL;
 		return false;
 	}
 
+	if (!set_property_values(prop,
+				 xcb_randr_query_output_property_valid_values(info),
+				 xcb_randr_query_output_property_valid_values_length(info)))
+		return false;
+
+	prop->value = value;
+
 	return true;
 }
 
-static void init_property(TVoutCtl *ctl, Atom atom, const char *name)
+static void free_output_properties(RROut *out)
 {
-	RRProp *prop;
 	int i;
 
-	for (i = 0; i < NUM_PROPS; i++) {
-		prop = &ctl->props[i];
+	for (i = 0; i < NUM_PROPS; i++)
+		free_property_values(&out->props[i]);
+}
 
-		if (strcmp(prop_names[i], name) != 0)
-			continue;
+static void free_outputs(RRCtl *ctl)
+{
+	int i;
 
-		prop->atom = atom;
-		prop->type = prop_types[i];
+	if (!ctl)
+		return;
 
-		break;
-	}
+	for (i = 0; i < ctl->num_outputs; i++)
+		free_output_properties(&ctl->outputs[i]);
 
-	if (i == NUM_PROPS)
-		return;
+	free(ctl->outputs);
+	ctl->outputs = NULL;
+	ctl->num_outputs = 0;
 
-	probe_property(ctl, prop, name);
+	index_free(&ctl->output_index);
+	index_free(&ctl->crtc_index);
 }
 
-static void free_properties(TVoutCtl *ctl)
+static void init_output(RRCtl *ctl, RROut *out)
 {
 	int i;
 
-	if (!ctl)
-		return;
+	memset(out, 0, sizeof *out);
 
 	for (i = 0; i < NUM_PROPS; i++) {
-		RRProp *prop = &ctl->props[i];
-		XFree(prop->info);
-		prop->info = NULL;
+		out->props[i].atom = ctl->atoms[i];
+		out->props[i].type = prop_types[i];
 	}
+
+	out->next_dirty = -1;
+	out->next_refetch = -1;
 }
 
-static bool init_properties(TVoutCtl *ctl)
+/*
+ * Intern every atom we are interested in up front. Properties
+ * are then matched by atom, so there's no need to fetch the
+ * names of all the properties the driver happens to expose.
+ */
+static int send_atoms(RRCtl *ctl, Batch *batch)
 {
-	int i;
-	Atom *props;
-	int nprop = 0;
-	char **names;
+	int first = batch->num_slots;
+	int i, j;
 
-	props = XRRListOutputProperties(ctl->dpy, ctl->output, &nprop);
-	if (!props)
-		return false;
+	for (i = 0; i < NUM_PROPS; i++) {
+		const char *name = prop_names[i];
 
-	names = calloc(nprop, sizeof names[0]);
-	if (!names) {
-		XFree(props);
-		return false;
+		if (batch_add(batch, xcb_intern_atom(ctl->conn, True,
+						     strlen(name), name).sequence) < 0)
+			return -1;
 	}
 
-	XGetAtomNames(ctl->dpy, props, nprop, names);
+	for (i = 0; i < NUM_PROPS; i++) {
+		for (j = 0; j < 2; j++) {
+			const char *name = fixup_names[i][j];
+
+			if (!name)
+				continue;
 
-	for (i = 0; i < nprop; i++) {
-		init_property(ctl, props[i], names[i]);
-		XFree(names[i]);
+			if (batch_add(batch, xcb_intern_atom(ctl->conn, True,
+							     strlen(name), name).sequence) < 0)
+				return -1;
+		}
 	}
 
-	free(names);
+	return first;
+}
 
-	XFree(props);
+static bool recv_atoms(RRCtl *ctl, const Batch *batch, int slot)
+{
+	xcb_intern_atom_reply_t *reply;
+	int i, j;
 
-	/* Did we find them all? */
 	for (i = 0; i < NUM_PROPS; i++) {
-		if (ctl->props[i].atom == None) {
-			free_properties(ctl);
+		reply = batch_reply(batch, slot++);
+
+		/* only_if_exists, so None means the driver doesn't have it */
+		if (!reply || reply->atom == None)
 			return false;
+
+		ctl->atoms[i] = reply->atom;
+	}
+
+	for (i = 0; i < NUM_PROPS; i++) {
+		for (j = 0; j < 2; j++) {
+			if (!fixup_names[i][j])
+				continue;
+
+			reply = batch_reply(batch, slot++);
+			if (reply)
+				ctl->fixup_atoms[i][j] = reply->atom;
 		}
 	}
 
 	return true;
 }
 
-static void update_ui(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value)
+static RROut *lookup_output(RRCtl *ctl, RROutput output, int *idx)
 {
-	if (!ctl->ui_notify)
-		return;
+	*idx = index_lookup(&ctl->output_index, output);
+	if (*idx < 0)
+		return NULL;
 
-	ctl->ui_notify(ctl->ui_data, attr, value);
+	return &ctl->outputs[*idx];
 }
 
-static void handle_output_change(TVoutCtl *ctl,
+static void handle_output_change(RRCtl *ctl,
 				 const XRROutputChangeNotifyEvent *e)
 {
+	RROut *out;
 	bool enabled;
+	int idx;
 
-	if (e->output != ctl->output)
+	out = lookup_output(ctl, e->output, &idx);
+	if (!out)
 		return;
 
 	enabled = e->crtc != 0;
 
-	if (enabled == ctl->enabled)
+	if (enabled == out->enabled)
 		return;
 
-	ctl->enabled = enabled;
+	out->enabled = enabled;
+
+	if (enabled) {
+		ctl_stats_latency(ctl->tvout, TVOUT_CTL_HIST_ENABLE,
+				  out->enable_start);
+		out->enable_start = 0;
+	}
 
-	update_ui(ctl, TVOUT_CTL_ENABLE, ctl->enabled);
+	/* The event has no timestamp */
+	ctl_notify_output(ctl->tvout, idx, TVOUT_CTL_ENABLE, out->enabled);
 }
 
-static bool update_property(TVoutCtl *ctl, RRProp *prop)
+/*
+ * Our own SetCrtcConfig requests cause these as well, but the
+ * config timestamp only moves when the outputs or the modes
+ * change. Only then may the CRTC snapshots refer to modes that
+ * are gone, and they're checked before they're used again.
+ */
+static void handle_screen_change(RRCtl *ctl,
+				 const XRRScreenChangeNotifyEvent *e)
 {
-	Atom type;
-	int format;
-	unsigned long nitems, bytes_after;
-	unsigned char *data;
-	long value;
-
-	if (XRRGetOutputProperty(ctl->dpy, ctl->output, prop->atom,
-				 0, 100, False, False,
-				 prop->type, &type, &format,
-				 &nitems, &bytes_after, &data) != Success)
-		return false;
+	if (!ctl->config_valid || e->config_timestamp != ctl->config_timestamp)
+		ctl->modes_valid = false;
 
-	/* sanity check */
-	if (type != prop->type || format != 32 || nitems != 1) {
-		XFree(data);
-		return false;
-	}
+	ctl->config_timestamp = e->config_timestamp;
+	ctl->config_valid = true;
+}
 
-	value = *(long *) data;
-	XFree(data);
+static void handle_crtc_change(RRCtl *ctl,
+			       const XRRCrtcChangeNotifyEvent *e)
+{
+	RROut *out;
+	int idx;
 
-	if (prop->value == value)
-		return false;
+	idx = index_lookup(&ctl->crtc_index, e->crtc);
+	if (idx < 0)
+		return;
 
-	prop->value = value;
+	out = &ctl->outputs[idx];
+
+	/*
+	 * Someone else turning the CRTC off may well not want it
+	 * back the way it was, so only our own disables keep the
+	 * snapshot.
+	 */
+	if (e->mode == None) {
+		if (!out->crtc_disabling)
+			out->crtc_mode = None;
+		out->crtc_disabling = false;
+		return;
+	}
 
-	return true;
+	out->crtc_mode = e->mode;
+	out->crtc_x = e->x;
+	out->crtc_y = e->y;
+	out->crtc_rotation = e->rotation;
 }
 
 static int prop_value_to_attr_value(const RRProp *prop)
@@ -377,8 +733,8 @@ static int prop_value_to_attr_value(const RRProp *prop)
 	case XA_INTEGER:
 		return prop->value;
 	case XA_ATOM:
-		for (i = 0; i < prop->info->num_values; i++)
-			if (prop->value == prop->info->values[i])
+		for (i = 0; i < prop->num_values; i++)
+			if (prop->value == prop->values[i])
 				return i;
 		return -1;
 	default:
@@ -386,310 +742,1193 @@ static int prop_value_to_attr_value(const RRProp *prop)
 	}
 }
 
-static void handle_output_property(TVoutCtl *ctl,
+/*
+ * Only the final value matters, so the prop is just marked
+ * dirty here. It gets refetched once the queue is drained.
+ */
+static void handle_output_property(RRCtl *ctl,
 				   const XRROutputPropertyNotifyEvent *e)
 {
-	int i;
+	RROut *out;
+	int i, idx;
 
-	if (e->output != ctl->output)
+	out = lookup_output(ctl, e->output, &idx);
+	if (!out)
 		return;
 
 	for (i = 0; i < NUM_PROPS; i++) {
-		int value;
-		RRProp *prop = &ctl->props[i];
-
-		if (e->property != prop->atom)
+		if (e->property != ctl->atoms[i])
 			continue;
 
 		if (e->state != PropertyNewValue)
 			return;
 
-		if (!update_property(ctl, prop))
-			return;
+		CTL_STATS_INC(ctl->tvout, checked_notifies);
 
-		value = prop_value_to_attr_value(prop);
-		if (value < 0)
-			return;
+		if (ctl->dirty_head < 0) {
+			ctl->dirty_time.received = ctl->tvout->event_time;
+			ctl->dirty_time.server_time = e->timestamp;
+		}
 
-		update_ui(ctl, i, value);
+		if (!out->dirty) {
+			out->next_dirty = ctl->dirty_head;
+			ctl->dirty_head = idx;
+		}
+		out->dirty |= 1 << i;
 		return;
 	}
 }
 
-typedef union {
-	XEvent event;
-	XRRNotifyEvent notify_event;
-	XRROutputChangeNotifyEvent output_change_noitfy_event;
-	XRROutputPropertyNotifyEvent output_property_notify_event;
-} XRREvent;
-
-static void handle_notify(TVoutCtl *ctl, const XRREvent *rre)
+static bool update_property(RRProp *prop,
+			    const xcb_randr_get_output_property_reply_t *reply)
 {
-	const XRRNotifyEvent *e = &rre->notify_event;
-
-	switch (e->subtype) {
-	case RRNotify_OutputChange:
-		handle_output_change(ctl, &rre->output_change_noitfy_event);
-		break;
-	case RRNotify_OutputProperty:
-		handle_output_property(ctl, &rre->output_property_notify_event);
-		break;
-	default:
-		printf("Unknown RandR event subtype %d\n", e->subtype);
-		break;
-	}
-}
+	long value;
 
-static void process_events(TVoutCtl *ctl)
-{
-	XRREvent rre;
-	XEvent *e = &rre.event;
+	if (!parse_property_value(prop, reply, &value) ||
+	    prop->value == value)
+		return false;
 
-	while (XPending(ctl->dpy) > 0) {
-		XNextEvent(ctl->dpy, e);
+	prop->value = value;
 
-		if (e->type == ctl->event_base + RRNotify)
-			handle_notify(ctl, &rre);
-	}
+	return true;
 }
 
-static bool probe_output(TVoutCtl *ctl,
-			 XRRScreenResources *resources,
-			 RROutput output)
+static void refetch_send(RRCtl *ctl)
 {
-	XRROutputInfo *info;
-	bool ret = false;
-
-	info = XRRGetOutputInfo(ctl->dpy, resources, output);
-	if (!info)
-		return false;
+	int i, idx;
 
-	if (strcmp(info->name, "TV") == 0 &&
-	    info->ncrtc == 1 && info->nmode > 0) {
-		ctl->output = output;
-		ctl->crtc = info->crtcs[0];
-		ctl->mode = info->modes[0];
-		ctl->enabled = info->crtc != 0;
-		ret = true;
-	}
+	if (ctl->dirty_head < 0 || ctl->refetch_head >= 0)
+		return;
 
-	XRRFreeOutputInfo(info);
+	for (idx = ctl->dirty_head; idx >= 0; idx = ctl->outputs[idx].next_dirty) {
+		const RROut *out = &ctl->outputs[idx];
 
-	return ret;
-}
+		for (i = 0; i < NUM_PROPS; i++) {
+			const RRProp *prop = &out->props[i];
 
-static bool probe_outputs(TVoutCtl *ctl)
-{
-	XRRScreenResources *resources;
-	int i;
+			if (!(out->dirty & (1 << i)))
+				continue;
 
-	resources = XRRGetScreenResources(ctl->dpy, DefaultRootWindow(ctl->dpy));
-	if (!resources)
-		return false;
+			if (batch_add(&ctl->refetch,
+				      xcb_randr_get_output_property(ctl->conn, out->output,
+								    prop->atom, prop->type,
+								    0, 100, False, False).sequence) < 0) {
+				batch_clear(&ctl->refetch);
+				return;
+			}
+		}
+	}
 
-	for (i = 0; i < resources->noutput; i++)
-		if (probe_output(ctl, resources, resources->outputs[i]))
-			break;
+	/* The dirty list becomes the refetch list, in the same order. */
+	for (idx = ctl->dirty_head; idx >= 0; idx = ctl->outputs[idx].next_dirty) {
+		RROut *out = &ctl->outputs[idx];
 
-	XRRFreeScreenResources(resources);
+		out->refetching = out->dirty;
+		out->dirty = 0;
+		out->next_refetch = out->next_dirty;
+	}
 
-	return ctl->output != 0;
-}
+	ctl->refetch_head = ctl->dirty_head;
+	ctl->refetch_time = ctl->dirty_time;
+	ctl->dirty_head = -1;
 
-static Atom index_to_atom(const RRProp *prop, int i)
-{
-	if (i < 0 || i >= prop->info->num_values)
-		return None;
+	CTL_STATS_INC(ctl->tvout, property_round_trips);
 
-	return prop->info->values[i];
+	xcb_flush(ctl->conn);
 }
 
-static int set_property(TVoutCtl *ctl, int i, long value)
+static void refetch_recv(RRCtl *ctl)
 {
-	RRProp *prop;
+	int i, idx, slot = 0;
 
-	if (i >= NUM_PROPS)
-		return -1;
+	if (ctl->refetch_head < 0 || !batch_poll(&ctl->refetch))
+		return;
 
-	prop = &ctl->props[i];
+	for (idx = ctl->refetch_head; idx >= 0; idx = ctl->outputs[idx].next_refetch) {
+		RROut *out = &ctl->outputs[idx];
 
-	switch (prop->type) {
-	case XA_INTEGER:
-		if (value < prop->info->values[0] ||
-		    value > prop->info->values[1])
-			return -1;
+		for (i = 0; i < NUM_PROPS; i++) {
+			RRProp *prop = &out->props[i];
+			int value;
 
-		if (value == prop->value)
-			return 0;
-		break;
-	case XA_ATOM:
-		value = (long) index_to_atom(prop, value);
-		if (value == None)
-			return -1;
+			if (!(out->refetching & (1 << i)))
+				continue;
 
-		if (value == prop->value)
-			return 0;
-		break;
-	default:
-		return -1;
-	}
+			if (!update_property(prop, batch_reply(&ctl->refetch, slot++)))
+				continue;
 
-	XRRChangeOutputProperty(ctl->dpy, ctl->output, prop->atom, prop->type,
-				32, PropModeReplace, (unsigned char *) &value, 1);
+			value = prop_value_to_attr_value(prop);
+			if (value < 0 || prop_attrs[i] < 0)
+				continue;
 
-	/* FIXME are we sure to get a notification? */
+			ctl_notify_received(ctl->tvout, idx, prop_attrs[i], value,
+					    &ctl->refetch_time);
+		}
 
-	process_events(ctl);
+		out->refetching = 0;
+	}
 
-	return 0;
+	batch_clear(&ctl->refetch);
+	ctl->refetch_head = -1;
 }
 
-static int set_crtc_config(TVoutCtl *ctl, int value)
-{
-	XRRScreenResources *resources;
+static void crtc_set_recv(RRCtl *ctl);
 
-	if (value != 0 && value != 1)
-		return -1;
+static bool rr_needs_dispatch(void *priv)
+{
+	RRCtl *ctl = priv;
 
-	resources = XRRGetScreenResourcesCurrent(ctl->dpy, DefaultRootWindow(ctl->dpy));
-	if (!resources)
-		return -1;
+	return (ctl->refetch_head >= 0 && batch_poll(&ctl->refetch)) ||
+		(ctl->crtc_set.num_slots && batch_poll(&ctl->crtc_set));
+}
 
-	if (value)
-		XRRSetCrtcConfig(ctl->dpy, resources, ctl->crtc, CurrentTime,
-				 0, 0, ctl->mode, RR_Rotate_0, &ctl->output, 1);
-	else
-		XRRSetCrtcConfig(ctl->dpy, resources, ctl->crtc, CurrentTime,
-				 0, 0, None, RR_Rotate_0, NULL, 0);
+/*
+ * All the dirty props are refetched with one batch per drain.
+ * The replies are picked up by a later drain, and whatever got
+ * dirty in the meantime goes out in the next batch.
+ */
+static void rr_events_done(void *priv)
+{
+	RRCtl *ctl = priv;
 
-	XRRFreeScreenResources(resources);
+	refetch_recv(ctl);
+	refetch_send(ctl);
+	crtc_set_recv(ctl);
+}
 
-	process_events(ctl);
+typedef union {
+	XEvent event;
+	XRRScreenChangeNotifyEvent screen_change_notify_event;
+	XRRNotifyEvent notify_event;
+	XRRCrtcChangeNotifyEvent crtc_change_notify_event;
+	XRROutputChangeNotifyEvent output_change_noitfy_event;
+	XRROutputPropertyNotifyEvent output_property_notify_event;
+} XRREvent;
+
+static bool rr_handle_event(void *priv, const XEvent *e)
+{
+	RRCtl *ctl = priv;
+	const XRREvent *rre = (const XRREvent *) e;
+
+	if (!ctl->selected || rre->notify_event.window != ctl->window)
+		return false;
+
+	USDT2(rr_event, e->type - ctl->event_base, rre->notify_event.subtype);
+
+	if (e->type == ctl->event_base + RRScreenChangeNotify) {
+		handle_screen_change(ctl, &rre->screen_change_notify_event);
+		return true;
+	}
+
+	if (e->type != ctl->event_base + RRNotify)
+		return false;
 
-	return 0;
+	switch (rre->notify_event.subtype) {
+	case RRNotify_CrtcChange:
+		handle_crtc_change(ctl, &rre->crtc_change_notify_event);
+		break;
+	case RRNotify_OutputChange:
+		handle_output_change(ctl, &rre->output_change_noitfy_event);
+		break;
+	case RRNotify_OutputProperty:
+		handle_output_property(ctl, &rre->output_property_notify_event);
+		break;
+	default:
+		break;
+	}
+
+	return true;
 }
 
-static int get_property(const TVoutCtl *ctl, int i)
+/* "TV", or "TV" followed by a number, possibly after a dash. */
+static bool is_tv_name(const char *name, int len)
+{
+	if (len < 2 || memcmp(name, "TV", 2) != 0)
+		return false;
+
+	name += 2;
+	len -= 2;
+
+	if (len > 0 && *name == '-') {
+		name++;
+		len--;
+		if (len == 0)
+			return false;
+	}
+
+	for (; len > 0; name++, len--)
+		if (*name < '0' || *name > '9')
+			return false;
+
+	return true;
+}
+
+/*
+ * $TVOUT_CTL_OUTPUT picks a single output by name instead,
+ * for instance one that a test X server has been given the
+ * TV properties on.
+ */
+static bool output_wanted(const RRCtl *ctl, const char *name, int len)
+{
+	if (ctl->output_name)
+		return strlen(ctl->output_name) == (size_t) len &&
+			memcmp(ctl->output_name, name, len) == 0;
+
+	return is_tv_name(name, len);
+}
+
+static bool crtc_taken(const RRCtl *ctl, xcb_randr_crtc_t crtc)
+{
+	int i;
+
+	for (i = 0; i < ctl->num_outputs; i++)
+		if (ctl->outputs[i].crtc == crtc)
+			return true;
+
+	return false;
+}
+
+/*
+ * Each output gets a CRTC of its own, so that the CRTC change
+ * notifications can be told apart. The one the output is on
+ * is preferred.
+ */
+static xcb_randr_crtc_t pick_crtc(const RRCtl *ctl,
+				  const xcb_randr_get_output_info_reply_t *info)
+{
+	const xcb_randr_crtc_t *crtcs = xcb_randr_get_output_info_crtcs(info);
+	xcb_randr_crtc_t crtc = None;
+	int i;
+
+	for (i = 0; i < info->num_crtcs; i++) {
+		if (crtc_taken(ctl, crtcs[i]))
+			continue;
+
+		if (crtc == None || crtcs[i] == info->crtc)
+			crtc = crtcs[i];
+	}
+
+	return crtc;
+}
+
+static bool probe_output(const RRCtl *ctl, RROut *out, RROutput output,
+			 const xcb_randr_get_output_info_reply_t *info)
+{
+	const char *name;
+	int len;
+
+	if (!info)
+		return false;
+
+	name = (const char *) xcb_randr_get_output_info_name(info);
+	len = xcb_randr_get_output_info_name_length(info);
+
+	if (!output_wanted(ctl, name, len) || len >= OUTPUT_NAME_LEN ||
+	    info->num_modes < 1)
+		return false;
+
+	out->crtc = pick_crtc(ctl, info);
+	if (out->crtc == None)
+		return false;
+
+	out->output = output;
+	out->mode = xcb_randr_get_output_info_modes(info)[0];
+	out->enabled = info->crtc != 0;
+	memcpy(out->name, name, len);
+	out->name[len] = '\0';
+
+	return true;
+}
+
+static bool send_screen(RRCtl *ctl)
+{
+	/* The atoms don't depend on anything so they can come along too. */
+	if (batch_add(&ctl->probe, xcb_randr_query_version(ctl->conn, 1, 2).sequence) < 0 ||
+	    batch_add(&ctl->probe, xcb_randr_get_screen_resources(ctl->conn, ctl->root).sequence) < 0)
+		return false;
+
+	ctl->probe_slot = send_atoms(ctl, &ctl->probe);
+
+	return ctl->probe_slot >= 0;
+}
+
+static bool recv_screen(RRCtl *ctl)
+{
+	if (!batch_reply(&ctl->probe, 0))
+		return false;
+
+	if (!recv_atoms(ctl, &ctl->probe, ctl->probe_slot))
+		return false;
+
+	/* Keep the resources around while we look at the outputs. */
+	ctl->resources = batch_take(&ctl->probe, 1);
+	if (!ctl->resources)
+		return false;
+
+	ctl->config_timestamp = ctl->resources->config_timestamp;
+	ctl->config_valid = true;
+	ctl->modes_valid = true;
+
+	return true;
+}
+
+static bool send_outputs(RRCtl *ctl)
+{
+	xcb_randr_output_t *outputs;
+	int i, noutput;
+
+	outputs = xcb_randr_get_screen_resources_outputs(ctl->resources);
+	noutput = xcb_randr_get_screen_resources_outputs_length(ctl->resources);
+
+	for (i = 0; i < noutput; i++)
+		if (batch_add(&ctl->probe,
+			      xcb_randr_get_output_info(ctl->conn, outputs[i],
+							ctl->resources->config_timestamp).sequence) < 0)
+			return false;
+
+	return true;
+}
+
+static bool recv_outputs(RRCtl *ctl)
+{
+	xcb_randr_output_t *outputs;
+	int i, noutput;
+
+	outputs = xcb_randr_get_screen_resources_outputs(ctl->resources);
+	noutput = xcb_randr_get_screen_resources_outputs_length(ctl->resources);
+
+	if (noutput > 0)
+		ctl->outputs = calloc(noutput, sizeof ctl->outputs[0]);
+
+	for (i = 0; ctl->outputs && i < noutput; i++) {
+		RROut *out = &ctl->outputs[ctl->num_outputs];
+
+		init_output(ctl, out);
+
+		if (probe_output(ctl, out, outputs[i], batch_reply(&ctl->probe, i)))
+			ctl->num_outputs++;
+	}
+
+	free(ctl->resources);
+	ctl->resources = NULL;
+
+	return ctl->num_outputs > 0;
+}
+
+static bool send_properties(RRCtl *ctl)
+{
+	int i, j;
+
+	rr_events_init(ctl);
+
+	/* Fetch the value and the valid values of every property in one go. */
+	for (j = 0; j < ctl->num_outputs; j++) {
+		const RROut *out = &ctl->outputs[j];
+
+		for (i = 0; i < NUM_PROPS; i++) {
+			const RRProp *prop = &out->props[i];
+
+			if (batch_add(&ctl->probe,
+				      xcb_randr_get_output_property(ctl->conn, out->output,
+								    prop->atom, prop->type,
+								    0, 100, False, False).sequence) < 0 ||
+			    batch_add(&ctl->probe,
+				      xcb_randr_query_output_property(ctl->conn, out->output,
+								      prop->atom).sequence) < 0)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static bool recv_output_properties(RRCtl *ctl, RROut *out, int slot)
+{
+	int i;
+
+	for (i = 0; i < NUM_PROPS; i++) {
+		RRProp *prop = &out->props[i];
+
+		if (!probe_property(prop, batch_reply(&ctl->probe, slot + 2 * i),
+				    batch_reply(&ctl->probe, slot + 2 * i + 1)))
+			return false;
+
+		if (prop->type == XA_ATOM && prop->num_values == 0 &&
+		    !fixup_property_info(ctl, prop, i))
+			return false;
+	}
+
+	return true;
+}
+
+/* Outputs that lack some of the properties are dropped. */
+static bool recv_properties(RRCtl *ctl)
+{
+	int i, num = 0;
+
+	for (i = 0; i < ctl->num_outputs; i++) {
+		RROut *out = &ctl->outputs[i];
+
+		if (!recv_output_properties(ctl, out, 2 * NUM_PROPS * i)) {
+			free_output_properties(out);
+			continue;
+		}
+
+		if (num != i)
+			ctl->outputs[num] = *out;
+		num++;
+	}
+
+	ctl->num_outputs = num;
+
+	return num > 0 && build_index(ctl);
+}
+
+/* The value reported for TVOUT_CTL_READY */
+static int probe_status(const RRCtl *ctl)
+{
+	switch (ctl->probe_state) {
+	case PROBE_DONE:
+		return 1;
+	case PROBE_FAILED:
+		return -1;
+	default:
+		return 0;
+	}
+}
+
+static void probe_fail(RRCtl *ctl)
+{
+	batch_clear(&ctl->probe);
+	free(ctl->resources);
+	ctl->resources = NULL;
+	free_outputs(ctl);
+	ctl->probe_state = PROBE_FAILED;
+}
+
+static bool cache_to_ctl(RRCtl *ctl, const RRCache *cache)
+{
+	int i, j;
+
+	if (cache->num_outputs < 1 || cache->num_outputs > CACHE_MAX_OUTPUTS)
+		return false;
+
+	ctl->outputs = calloc(cache->num_outputs, sizeof ctl->outputs[0]);
+	if (!ctl->outputs)
+		return false;
+
+	for (j = 0; j < (int) cache->num_outputs; j++) {
+		RROut *out = &ctl->outputs[j];
+
+		init_output(ctl, out);
+		ctl->num_outputs++;
+
+		out->output = cache->outputs[j].output;
+		out->crtc = cache->outputs[j].crtc;
+		out->mode = cache->outputs[j].mode;
+		memcpy(out->name, cache->outputs[j].name, sizeof out->name);
+		out->name[sizeof out->name - 1] = '\0';
+
+		for (i = 0; i < NUM_PROPS; i++) {
+			RRProp *prop = &out->props[i];
+
+			if (cache->outputs[j].props[i].num_values < 0 ||
+			    cache->outputs[j].props[i].num_values > CACHE_MAX_VALUES)
+				return false;
+
+			prop->atom = cache->outputs[j].props[i].atom;
+			prop->type = prop_types[i];
+			prop->range = cache->outputs[j].props[i].range;
+
+			if (!set_property_values(prop, cache->outputs[j].props[i].values,
+						 cache->outputs[j].props[i].num_values))
+				return false;
+		}
+	}
+
+	/* The atoms are the same for every output. */
+	for (i = 0; i < NUM_PROPS; i++)
+		ctl->atoms[i] = ctl->outputs[0].props[i].atom;
+
+	return build_index(ctl);
+}
+
+static void save_cache(RRCtl *ctl)
+{
+	RRCache cache;
+	int i, j, k;
+
+	if (ctl->num_outputs > CACHE_MAX_OUTPUTS)
+		return;
+
+	memset(&cache, 0, sizeof cache);
+
+	cache.num_outputs = ctl->num_outputs;
+
+	for (k = 0; k < ctl->num_outputs; k++) {
+		const RROut *out = &ctl->outputs[k];
+
+		cache.outputs[k].output = out->output;
+		cache.outputs[k].crtc = out->crtc;
+		cache.outputs[k].mode = out->mode;
+		memcpy(cache.outputs[k].name, out->name, sizeof out->name);
+
+		for (i = 0; i < NUM_PROPS; i++) {
+			const RRProp *prop = &out->props[i];
+
+			if (prop->num_values > CACHE_MAX_VALUES)
+				return;
+
+			cache.outputs[k].props[i].atom = prop->atom;
+			cache.outputs[k].props[i].range = prop->range;
+			cache.outputs[k].props[i].num_values = prop->num_values;
+			for (j = 0; j < prop->num_values; j++)
+				cache.outputs[k].props[i].values[j] = prop->values[j];
+		}
+	}
+
+	cache_store(ctl->dpy, "xrandr", &cache, sizeof cache);
+}
+
+/*
+ * The output info tells us whether the cached outputs are still
+ * TV outputs, and we need the property values anyway. If any of
+ * it doesn't add up we do a full probe instead.
+ */
+static bool send_cached(RRCtl *ctl)
+{
+	int i, j;
+
+	rr_events_init(ctl);
+
+	for (j = 0; j < ctl->num_outputs; j++) {
+		const RROut *out = &ctl->outputs[j];
+
+		if (batch_add(&ctl->probe,
+			      xcb_randr_get_output_info(ctl->conn, out->output,
+							XCB_CURRENT_TIME).sequence) < 0)
+			return false;
+
+		for (i = 0; i < NUM_PROPS; i++) {
+			const RRProp *prop = &out->props[i];
+
+			if (batch_add(&ctl->probe,
+				      xcb_randr_get_output_property(ctl->conn, out->output,
+								    prop->atom, prop->type,
+								    0, 100, False, False).sequence) < 0)
+				return false;
+		}
+	}
+
+	/* For the config timestamp */
+	if (batch_add(&ctl->probe,
+		      xcb_randr_get_screen_resources_current(ctl->conn, ctl->root).sequence) < 0)
+		return false;
+
+	return true;
+}
+
+static bool recv_cached_output(RRCtl *ctl, RROut *out, int slot)
+{
+	RRCrtc crtc = out->crtc;
+	RRMode mode = out->mode;
+	char name[OUTPUT_NAME_LEN];
+	int i;
+
+	memcpy(name, out->name, sizeof name);
+
+	if (!probe_output(ctl, out, out->output, batch_reply(&ctl->probe, slot)) ||
+	    out->crtc != crtc || out->mode != mode ||
+	    strcmp(out->name, name) != 0)
+		return false;
+
+	for (i = 0; i < NUM_PROPS; i++) {
+		RRProp *prop = &out->props[i];
+
+		if (!parse_property_value(prop, batch_reply(&ctl->probe, slot + i + 1),
+					  &prop->value))
+			return false;
+
+		if (prop->type == XA_INTEGER) {
+			if (prop->num_values != 2 ||
+			    prop->value < prop->values[0] ||
+			    prop->value > prop->values[1])
+				return false;
+		} else {
+			if (prop_value_to_attr_value(prop) < 0)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static bool recv_cached(RRCtl *ctl)
+{
+	const xcb_randr_get_screen_resources_current_reply_t *resources;
+	int j;
+
+	for (j = 0; j < ctl->num_outputs; j++)
+		if (!recv_cached_output(ctl, &ctl->outputs[j], j * (NUM_PROPS + 1)))
+			return false;
+
+	resources = batch_reply(&ctl->probe, ctl->num_outputs * (NUM_PROPS + 1));
+	if (!resources)
+		return false;
+
+	ctl->config_timestamp = resources->config_timestamp;
+	ctl->config_valid = true;
+	ctl->modes_valid = true;
+
+	return true;
+}
+
+static void reset_outputs(RRCtl *ctl)
+{
+	free_outputs(ctl);
+
+	ctl->config_valid = false;
+}
+
+/*
+ * Each probe step handles the replies to the requests sent by
+ * the previous step and sends out the requests for the next one.
+ */
+static void probe_advance(RRCtl *ctl)
+{
+	bool ok = false;
+
+	switch (ctl->probe_state) {
+	case PROBE_CACHED:
+		ok = recv_cached(ctl);
+		batch_clear(&ctl->probe);
+		if (ok) {
+			USDT3(probe_phase, "xrandr", PROBE_CACHED, ok);
+			ctl->probe_state = PROBE_DONE;
+			return;
+		}
+
+		/* Stale cache, start over. */
+		reset_outputs(ctl);
+		ok = send_screen(ctl);
+		break;
+	case PROBE_SCREEN:
+		ok = recv_screen(ctl);
+		batch_clear(&ctl->probe);
+		ok = ok && send_outputs(ctl);
+		break;
+	case PROBE_OUTPUTS:
+		ok = recv_outputs(ctl);
+		batch_clear(&ctl->probe);
+		ok = ok && send_properties(ctl);
+		break;
+	case PROBE_PROPERTIES:
+		ok = recv_properties(ctl);
+		batch_clear(&ctl->probe);
+		if (ok)
+			save_cache(ctl);
+		break;
+	default:
+		return;
+	}
+
+	USDT3(probe_phase, "xrandr", ctl->probe_state, ok);
+
+	if (!ok) {
+		probe_fail(ctl);
+		return;
+	}
+
+	ctl->probe_state++;
+}
+
+static bool probe_start(RRCtl *ctl)
+{
+	RRCache cache;
+
+	batch_init(&ctl->probe, ctl->conn);
+
+	if (cache_load(ctl->dpy, "xrandr", &cache, sizeof cache)) {
+		if (cache_to_ctl(ctl, &cache)) {
+			ctl->probe_state = PROBE_CACHED;
+			return send_cached(ctl);
+		}
+
+		reset_outputs(ctl);
+	}
+
+	ctl->probe_state = PROBE_SCREEN;
+
+	return send_screen(ctl);
+}
+
+static int rr_probe_step(void *priv, bool wait)
+{
+	RRCtl *ctl = priv;
+
+	if (wait) {
+		if (batch_wait(&ctl->probe))
+			probe_advance(ctl);
+		else
+			probe_fail(ctl);
+	} else {
+		while (ctl->probe_state < PROBE_DONE && batch_poll(&ctl->probe))
+			probe_advance(ctl);
+	}
+
+	return probe_status(ctl);
+}
+
+static Atom index_to_atom(const RRProp *prop, int i)
+{
+	if (i < 0 || i >= prop->num_values)
+		return None;
+
+	return prop->values[i];
+}
+
+/*
+ * Converts the value to what goes on the wire. Returns 1 if
+ * it differs from the current value, 0 if it doesn't and -1
+ * if it's not valid.
+ */
+static int check_property(const RROut *out, int i, long *value)
 {
 	const RRProp *prop;
 
 	if (i >= NUM_PROPS)
 		return -1;
 
-	prop = &ctl->props[i];
+	prop = &out->props[i];
 
-	return prop_value_to_attr_value(prop);
+	switch (prop->type) {
+	case XA_INTEGER:
+		if (*value < prop->values[0] ||
+		    *value > prop->values[1])
+			return -1;
+		break;
+	case XA_ATOM:
+		*value = (long) index_to_atom(prop, *value);
+		if (*value == None)
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+
+	return *value != prop->value;
 }
 
-int tvout_ctl_set(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value)
+static int set_property(RRCtl *ctl, RROut *out, int i, long value,
+			unsigned int *sequence)
 {
-	if (!ctl)
+	RRProp *prop;
+	uint32_t data;
+	int r;
+
+	r = check_property(out, i, &value);
+	if (r == 0)
+		CTL_STATS_INC(ctl->tvout, redundant_sets);
+	if (r <= 0)
+		return r;
+
+	prop = &out->props[i];
+	data = value;
+
+	if (sequence)
+		*sequence = xcb_randr_change_output_property_checked(ctl->conn, out->output,
+								     prop->atom, prop->type, 32,
+								     XCB_PROP_MODE_REPLACE,
+								     1, &data).sequence;
+	else
+		xcb_randr_change_output_property(ctl->conn, out->output, prop->atom,
+						 prop->type, 32, XCB_PROP_MODE_REPLACE,
+						 1, &data);
+
+	return 1;
+}
+
+static int check_crtc_config(const RROut *out, int value)
+{
+	if (value != 0 && value != 1)
 		return -1;
 
-	switch (attr) {
-	case TVOUT_CTL_ENABLE:
-		return set_crtc_config(ctl, value);
-	case TVOUT_CTL_TV_STD:
-		return set_property(ctl, PROP_SIGNAL_PROPERTIES, value);
-	case TVOUT_CTL_ASPECT:
-		return set_property(ctl, PROP_TV_ASPECT_RATIO, value);
-	case TVOUT_CTL_SCALE:
-		return set_property(ctl, PROP_TV_SCALE, value);
-	case TVOUT_CTL_DYNAMIC_ASPECT:
-		return set_property(ctl, PROP_TV_DYNAMIC_ASPECT_RATIO, value);
-	case TVOUT_CTL_XOFFSET:
-		return set_property(ctl, PROP_TV_X_OFFSET, value);
-	case TVOUT_CTL_YOFFSET:
-		return set_property(ctl, PROP_TV_Y_OFFSET, value);
-	case TVOUT_CTL_FULLSCREEN_VIDEO:
-		return set_property(ctl, PROP_XV_CLONE_FULLSCREEN, value);
-	default:
+	return value != out->enabled;
+}
+
+/* Forgets the snapshots whose modes are no longer around. */
+static void check_crtc_modes(RRCtl *ctl,
+			     const xcb_randr_get_screen_resources_current_reply_t *resources)
+{
+	const xcb_randr_mode_info_t *modes;
+	int i, j, num_modes;
+
+	modes = xcb_randr_get_screen_resources_current_modes(resources);
+	num_modes = xcb_randr_get_screen_resources_current_modes_length(resources);
+
+	for (i = 0; i < ctl->num_outputs; i++) {
+		RROut *out = &ctl->outputs[i];
+
+		if (out->crtc_mode == None)
+			continue;
+
+		for (j = 0; j < num_modes; j++)
+			if (modes[j].id == out->crtc_mode)
+				break;
+
+		if (j == num_modes)
+			out->crtc_mode = None;
+	}
+
+	ctl->modes_valid = true;
+}
+
+/*
+ * Normally the timestamp is already known from the probe
+ * and the screen change notifications. Only after a failed
+ * SetCrtcConfig, or before restoring a CRTC snapshot after
+ * the modes have changed, do we have to ask the server again.
+ */
+static bool update_config(RRCtl *ctl, bool need_modes)
+{
+	xcb_randr_get_screen_resources_current_cookie_t cookie;
+	xcb_randr_get_screen_resources_current_reply_t *resources;
+
+	if (ctl->config_valid && (ctl->modes_valid || !need_modes))
+		return true;
+
+	CTL_STATS_INC(ctl->tvout, resource_round_trips);
+
+	cookie = xcb_randr_get_screen_resources_current(ctl->conn, ctl->root);
+	resources = xcb_randr_get_screen_resources_current_reply(ctl->conn, cookie, NULL);
+	if (!resources)
+		return false;
+
+	ctl->config_timestamp = resources->config_timestamp;
+	ctl->config_valid = true;
+
+	check_crtc_modes(ctl, resources);
+
+	free(resources);
+
+	return true;
+}
+
+static void crtc_set_track(RRCtl *ctl, RROut *out, int value,
+			   unsigned int sequence)
+{
+	if (batch_add(&ctl->crtc_set, sequence) < 0) {
+		xcb_discard_reply(ctl->conn, sequence);
+		return;
+	}
+
+	ctl->crtc_set_idx = out - ctl->outputs;
+	ctl->crtc_set_value = value;
+	ctl->crtc_set_retried = false;
+}
+
+static int set_crtc_config(RRCtl *ctl, RROut *out, int value,
+			   unsigned int *sequence)
+{
+	xcb_randr_set_crtc_config_cookie_t set_cookie;
+	xcb_randr_output_t output = out->output;
+
+	if (check_crtc_config(out, value) < 0)
+		return -1;
+
+	if (!update_config(ctl, value && out->crtc_mode))
 		return -1;
+
+	/* Bring the CRTC back the way it was, if we know that. */
+	if (value && out->crtc_mode)
+		set_cookie = xcb_randr_set_crtc_config(ctl->conn, out->crtc,
+						       XCB_CURRENT_TIME,
+						       ctl->config_timestamp,
+						       out->crtc_x, out->crtc_y,
+						       out->crtc_mode,
+						       out->crtc_rotation,
+						       1, &output);
+	else if (value)
+		set_cookie = xcb_randr_set_crtc_config(ctl->conn, out->crtc,
+						       XCB_CURRENT_TIME,
+						       ctl->config_timestamp,
+						       0, 0, out->mode,
+						       XCB_RANDR_ROTATION_ROTATE_0,
+						       1, &output);
+	else
+		set_cookie = xcb_randr_set_crtc_config(ctl->conn, out->crtc,
+						       XCB_CURRENT_TIME,
+						       ctl->config_timestamp,
+						       0, 0, None,
+						       XCB_RANDR_ROTATION_ROTATE_0,
+						       0, NULL);
+
+	if (value)
+		out->enable_start = ctl->tvout->stats_enabled ? ctl_monotonic_ns() : 0;
+	else
+		out->crtc_disabling = true;
+
+	/*
+	 * Unless the caller wants it, the reply is looked at once the
+	 * events have been handled, see crtc_set_recv().
+	 */
+	if (sequence)
+		*sequence = set_cookie.sequence;
+	else
+		crtc_set_track(ctl, out, value, set_cookie.sequence);
+
+	return 1;
+}
+
+/*
+ * A stale config timestamp means we missed a config change
+ * somehow. A fresh one is fetched and the last set goes out
+ * again. Any other failure shows in the output change
+ * notifications, or rather in their absence.
+ */
+static void crtc_set_recv(RRCtl *ctl)
+{
+	const xcb_randr_set_crtc_config_reply_t *reply;
+	RROut *out;
+	bool retry;
+
+	if (!ctl->crtc_set.num_slots || !batch_poll(&ctl->crtc_set))
+		return;
+
+	out = &ctl->outputs[ctl->crtc_set_idx];
+	reply = batch_reply(&ctl->crtc_set, ctl->crtc_set.num_slots - 1);
+
+	if (!reply || reply->status != XCB_RANDR_SET_CONFIG_SUCCESS) {
+		out->crtc_disabling = false;
+		out->enable_start = 0;
+	}
+
+	retry = reply && reply->status == XCB_RANDR_SET_CONFIG_INVALID_CONFIG_TIME;
+	if (retry) {
+		ctl->config_valid = false;
+		ctl->modes_valid = false;
+	}
+
+	retry = retry && !ctl->crtc_set_retried;
+
+	batch_clear(&ctl->crtc_set);
+
+	if (retry && set_crtc_config(ctl, out, ctl->crtc_set_value, NULL) > 0) {
+		ctl->crtc_set_retried = true;
+		xcb_flush(ctl->conn);
 	}
 }
 
-int tvout_ctl_get(TVoutCtl *ctl, enum TVoutCtlAttr attr)
+static int get_property(const RROut *out, int i)
 {
-	if (!ctl)
+	const RRProp *prop;
+
+	if (i >= NUM_PROPS)
 		return -1;
 
+	prop = &out->props[i];
+
+	return prop_value_to_attr_value(prop);
+}
+
+/* The property behind each attribute, -1 for none */
+static int attr_to_prop(enum TVoutCtlAttr attr)
+{
 	switch (attr) {
-	case TVOUT_CTL_ENABLE:
-		return ctl->enabled;
 	case TVOUT_CTL_TV_STD:
-		return get_property(ctl, PROP_SIGNAL_PROPERTIES);
+		return PROP_SIGNAL_PROPERTIES;
 	case TVOUT_CTL_ASPECT:
-		return get_property(ctl, PROP_TV_ASPECT_RATIO);
+		return PROP_TV_ASPECT_RATIO;
 	case TVOUT_CTL_SCALE:
-		return get_property(ctl, PROP_TV_SCALE);
+		return PROP_TV_SCALE;
 	case TVOUT_CTL_DYNAMIC_ASPECT:
-		return get_property(ctl, PROP_TV_DYNAMIC_ASPECT_RATIO);
+		return PROP_TV_DYNAMIC_ASPECT_RATIO;
 	case TVOUT_CTL_XOFFSET:
-		return get_property(ctl, PROP_TV_X_OFFSET);
+		return PROP_TV_X_OFFSET;
 	case TVOUT_CTL_YOFFSET:
-		return get_property(ctl, PROP_TV_Y_OFFSET);
+		return PROP_TV_Y_OFFSET;
 	case TVOUT_CTL_FULLSCREEN_VIDEO:
-		return get_property(ctl, PROP_XV_CLONE_FULLSCREEN);
+		return PROP_XV_CLONE_FULLSCREEN;
 	default:
 		return -1;
 	}
 }
 
-int tvout_ctl_fd(TVoutCtl *ctl)
+static int output_set(RRCtl *ctl, RROut *out, enum TVoutCtlAttr attr,
+		      int value, unsigned int *sequence)
 {
-	if (!ctl)
+	int i;
+
+	if (attr == TVOUT_CTL_ENABLE)
+		return set_crtc_config(ctl, out, value, sequence);
+
+	i = attr_to_prop(attr);
+	if (i < 0)
 		return -1;
 
-	return ConnectionNumber(ctl->dpy);
+	return set_property(ctl, out, i, value, sequence);
 }
 
-void tvout_ctl_fd_ready(TVoutCtl *ctl)
+static int output_check(const RROut *out, enum TVoutCtlAttr attr, int value)
 {
-	if (!ctl)
-		return;
+	long v = value;
+	int i;
+
+	if (attr == TVOUT_CTL_ENABLE)
+		return check_crtc_config(out, value);
 
-	process_events(ctl);
+	i = attr_to_prop(attr);
+	if (i < 0)
+		return -1;
+
+	return check_property(out, i, &v);
 }
 
-TVoutCtl *tvout_ctl_init(TVoutCtlNotify ui_notify, void *ui_data)
+static int output_get(const RROut *out, enum TVoutCtlAttr attr)
 {
-	TVoutCtl *ctl;
+	int i;
 
-	ctl = calloc(1, sizeof *ctl);
-	if (!ctl)
-		return NULL;
+	if (attr == TVOUT_CTL_ENABLE)
+		return out->enabled;
 
-	if (!rr_init(ctl)) {
-		free(ctl);
-		return NULL;
-	}
+	i = attr_to_prop(attr);
+	if (i < 0)
+		return -1;
 
-	if (!probe_outputs(ctl)) {
-		rr_exit(ctl);
-		free(ctl);
-		return NULL;
-	}
+	return get_property(out, i);
+}
 
-	if (!init_properties(ctl)) {
-		rr_exit(ctl);
-		free(ctl);
-		return NULL;
+static int rr_set(void *priv, enum TVoutCtlAttr attr, int value,
+		  unsigned int *sequence)
+{
+	RRCtl *ctl = priv;
+
+	return output_set(ctl, &ctl->outputs[0], attr, value, sequence);
+}
+
+/* Only SetCrtcConfig has a reply */
+static bool rr_reply_ok(void *priv, enum TVoutCtlAttr attr, const void *reply)
+{
+	RRCtl *ctl = priv;
+	const xcb_randr_set_crtc_config_reply_t *r = reply;
+
+	if (attr != TVOUT_CTL_ENABLE)
+		return true;
+
+	/* We missed a config change somehow, refetch next time. */
+	if (r->status == XCB_RANDR_SET_CONFIG_INVALID_CONFIG_TIME) {
+		ctl->config_valid = false;
+		ctl->modes_valid = false;
 	}
 
-	process_events(ctl);
+	return r->status == XCB_RANDR_SET_CONFIG_SUCCESS;
+}
 
-	ctl->ui_notify = ui_notify;
-	ctl->ui_data = ui_data;
+static int rr_check(void *priv, enum TVoutCtlAttr attr, int value)
+{
+	const RRCtl *ctl = priv;
 
-	return ctl;
+	return output_check(&ctl->outputs[0], attr, value);
 }
 
-void tvout_ctl_exit(TVoutCtl *ctl)
+static int rr_get(void *priv, enum TVoutCtlAttr attr)
 {
-	if (!ctl)
-		return;
+	const RRCtl *ctl = priv;
+
+	return output_get(&ctl->outputs[0], attr);
+}
+
+static int rr_num_outputs(void *priv)
+{
+	const RRCtl *ctl = priv;
+
+	return ctl->num_outputs;
+}
+
+static const char *rr_output_name(void *priv, int output)
+{
+	const RRCtl *ctl = priv;
 
-	free_properties(ctl);
-	rr_exit(ctl);
+	return ctl->outputs[output].name;
+}
+
+static int rr_set_output(void *priv, int output, enum TVoutCtlAttr attr,
+			 int value)
+{
+	RRCtl *ctl = priv;
+
+	return output_set(ctl, &ctl->outputs[output], attr, value, NULL);
+}
+
+static int rr_get_output(void *priv, int output, enum TVoutCtlAttr attr)
+{
+	const RRCtl *ctl = priv;
+
+	return output_get(&ctl->outputs[output], attr);
+}
+
+static void rr_exit(void *priv)
+{
+	RRCtl *ctl = priv;
+
+	rr_events_exit(ctl);
+	batch_clear(&ctl->refetch);
+	batch_clear(&ctl->crtc_set);
+	batch_clear(&ctl->probe);
+	free(ctl->resources);
+	free_outputs(ctl);
 	free(ctl);
 }
+
+static void *rr_probe_start(TVoutCtl *tvout)
+{
+	const xcb_query_extension_reply_t *ext;
+	RRCtl *ctl;
+
+	ext = xcb_get_extension_data(tvout->conn, &xcb_randr_id);
+	if (!ext || !ext->present)
+		return NULL;
+
+	ctl = calloc(1, sizeof *ctl);
+	if (!ctl)
+		return NULL;
+
+	ctl->tvout = tvout;
+	ctl->dpy = tvout->dpy;
+	ctl->conn = tvout->conn;
+	ctl->root = DefaultRootWindow(tvout->dpy);
+	ctl->event_base = ext->first_event;
+	ctl->output_name = getenv("TVOUT_CTL_OUTPUT");
+	if (ctl->output_name && !*ctl->output_name)
+		ctl->output_name = NULL;
+	ctl->dirty_head = -1;
+	ctl->refetch_head = -1;
+	batch_init(&ctl->refetch, ctl->conn);
+	batch_init(&ctl->crtc_set, ctl->conn);
+
+	if (!probe_start(ctl)) {
+		rr_exit(ctl);
+		return NULL;
+	}
+
+	return ctl;
+}
+
+const TVoutCtlBackend xrandr_backend = {
+	.name = "xrandr",
+	.ext = &xcb_randr_id,
+	.probe_start = rr_probe_start,
+	.probe_step = rr_probe_step,
+	.exit = rr_exit,
+	.handle_event = rr_handle_event,
+	.events_done = rr_events_done,
+	.needs_dispatch = rr_needs_dispatch,
+	.check = rr_check,
+	.set = rr_set,
+	.reply_ok = rr_reply_ok,
+	.get = rr_get,
+	.num_outputs = rr_num_outputs,
+	.output_name = rr_output_name,
+	.set_output = rr_set_output,
+	.get_output = rr_get_output,
+};
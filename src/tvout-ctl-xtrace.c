@@ -0,0 +1,858 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * A preload module that records the X traffic of a process, or
+ * plays it back with no X server around:
+ *
+ *   LD_PRELOAD=tvout-ctl-xtrace.so TVOUT_CTL_RECORD=file app
+ *   LD_PRELOAD=tvout-ctl-xtrace.so TVOUT_CTL_REPLAY=file app
+ *
+ * Recording logs every request, reply and event on the process's
+ * X connections with timestamps. Only the authorization data of
+ * the connection setup is blanked out. On replay, connect() hands
+ * out a socket with a thread of ours at the other end. The thread
+ * sends each chunk the server sent once the application has sent
+ * the requests that came before it, and as much later as it took
+ * originally. So the backends run on the device's replies and
+ * events, driver quirks and all, on the device's timeline.
+ *
+ * The application has to send the very same requests both times.
+ * That takes the same $TVOUT_CTL_BACKEND, the same probe cache
+ * (leave $XDG_RUNTIME_DIR unset for none), TVOUT_CTL_INIT_NO_DAEMON
+ * and libX11 and libxcb that behave the same. A connection whose
+ * requests go their own way is closed, and the place printed.
+ */
+
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define XTRACE_MAGIC 0x54565854 /* "TVXT" */
+#define XTRACE_VERSION 1
+
+/*
+ * The file is an XTraceHeader followed by XTraceChunks, each
+ * followed by its data. Both are in the byte order of the
+ * machine that wrote them.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+} XTraceHeader;
+
+enum {
+	/* connect() succeeded, no data */
+	XTRACE_CONNECT,
+	/* Client to server */
+	XTRACE_SEND,
+	/* Server to client */
+	XTRACE_RECV,
+};
+
+typedef struct {
+	/* ns since the first connection */
+	uint64_t time;
+	uint32_t len;
+	uint16_t conn;
+	uint16_t type;
+} XTraceChunk;
+
+#define MAX_CONNS 16
+
+/* The fixed part of the connection setup request */
+#define SETUP_SIZE 12
+
+#define PAD4(n) (((n) + 3) & ~3)
+
+/* Looked up before anything can get called */
+#define REAL(name) real_##name
+#define RESOLVE(name) (real_##name = dlsym(RTLD_NEXT, #name))
+
+static int (*real_connect)(int, const struct sockaddr *, socklen_t);
+static int (*real_close)(int);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_readv)(int, const struct iovec *, int);
+static ssize_t (*real_recv)(int, void *, size_t, int);
+static ssize_t (*real_recvmsg)(int, struct msghdr *, int);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_writev)(int, const struct iovec *, int);
+static ssize_t (*real_send)(int, const void *, size_t, int);
+static ssize_t (*real_sendmsg)(int, const struct msghdr *, int);
+
+typedef struct {
+	/* -1 if the slot is free */
+	int fd;
+	int id;
+	/* Sent so far, to find the authorization data */
+	uint64_t sent;
+	uint8_t setup[SETUP_SIZE];
+	uint64_t auth_start;
+	uint64_t auth_end;
+} RecordConn;
+
+typedef struct {
+	XTraceChunk chunk;
+	const uint8_t *data;
+} ReplayChunk;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* Connections so far, which is also the next id */
+static int num_ids;
+static uint64_t start_time;
+
+static FILE *record;
+static RecordConn record_conns[MAX_CONNS];
+static int num_record_conns;
+
+static bool replay;
+static uint8_t *replay_file;
+static ReplayChunk *replay_chunks;
+static int num_replay_chunks;
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Local sockets as libxcb names them, and the TCP ports */
+static bool is_x_address(const struct sockaddr *addr, socklen_t len)
+{
+	static const char prefix[] = "/tmp/.X11-unix/X";
+	const struct sockaddr_un *un = (const void *) addr;
+	const char *path = un->sun_path;
+	int port;
+
+	switch (addr->sa_family) {
+	case AF_UNIX:
+		if (len <= offsetof(struct sockaddr_un, sun_path))
+			return false;
+		/* Abstract */
+		if (!path[0])
+			path++;
+		return strncmp(path, prefix, sizeof prefix - 1) == 0;
+	case AF_INET:
+		port = ntohs(((const struct sockaddr_in *) addr)->sin_port);
+		break;
+	case AF_INET6:
+		port = ntohs(((const struct sockaddr_in6 *) addr)->sin6_port);
+		break;
+	default:
+		return false;
+	}
+
+	return port >= 6000 && port < 6100;
+}
+
+static unsigned int setup_card16(const uint8_t *setup, int offset)
+{
+	if (setup[0] == 'l')
+		return setup[offset] | setup[offset + 1] << 8;
+
+	return setup[offset] << 8 | setup[offset + 1];
+}
+
+/* With the authorization protocol name and data */
+static uint64_t setup_size(const uint8_t *setup)
+{
+	return SETUP_SIZE + PAD4(setup_card16(setup, 6)) +
+		PAD4(setup_card16(setup, 8));
+}
+
+static RecordConn *record_find(int fd)
+{
+	int i;
+
+	for (i = 0; i < num_record_conns; i++)
+		if (record_conns[i].fd == fd)
+			return &record_conns[i];
+
+	return NULL;
+}
+
+static void record_chunk(int id, int type, const uint8_t *data, size_t len)
+{
+	XTraceChunk chunk = {
+		.time = monotonic_ns() - start_time,
+		.len = len,
+		.conn = id,
+		.type = type,
+	};
+
+	fwrite(&chunk, sizeof chunk, 1, record);
+	fwrite(data, 1, len, record);
+}
+
+/*
+ * The setup comes in one piece from libxcb, but nothing says it
+ * has to, so this goes byte by byte.
+ */
+static void blank_auth(RecordConn *c, uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len && c->sent + i < c->auth_end; i++) {
+		uint64_t pos = c->sent + i;
+
+		if (pos < SETUP_SIZE) {
+			c->setup[pos] = data[i];
+			if (pos == SETUP_SIZE - 1) {
+				c->auth_end = setup_size(c->setup);
+				c->auth_start = c->auth_end -
+					PAD4(setup_card16(c->setup, 8));
+			}
+		} else if (pos >= c->auth_start) {
+			data[i] = 0;
+		}
+	}
+}
+
+static void record_io(int fd, int type, const struct iovec *iov,
+		      int iovcnt, ssize_t len)
+{
+	RecordConn *c;
+	uint8_t *data;
+	size_t n = 0;
+	int i;
+
+	if (!record || len <= 0)
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	c = record ? record_find(fd) : NULL;
+	if (!c)
+		goto out;
+
+	data = malloc(len);
+	if (!data)
+		goto out;
+
+	for (i = 0; i < iovcnt && n < (size_t) len; i++) {
+		size_t chunk = iov[i].iov_len;
+
+		if (chunk > len - n)
+			chunk = len - n;
+		memcpy(data + n, iov[i].iov_base, chunk);
+		n += chunk;
+	}
+
+	if (type == XTRACE_SEND) {
+		blank_auth(c, data, len);
+		c->sent += len;
+	}
+
+	record_chunk(c->id, type, data, len);
+	free(data);
+
+ out:
+	pthread_mutex_unlock(&lock);
+}
+
+static void record_connect(int fd)
+{
+	RecordConn *c;
+
+	pthread_mutex_lock(&lock);
+
+	if (!num_ids)
+		start_time = monotonic_ns();
+
+	c = record_find(-1);
+	if (!c && num_record_conns < MAX_CONNS)
+		c = &record_conns[num_record_conns++];
+
+	if (c) {
+		memset(c, 0, sizeof *c);
+		c->fd = fd;
+		c->id = num_ids;
+		/* Until the fixed part is in */
+		c->auth_end = SETUP_SIZE;
+
+		record_chunk(c->id, XTRACE_CONNECT, NULL, 0);
+	}
+
+	num_ids++;
+
+	pthread_mutex_unlock(&lock);
+}
+
+static void record_close(int fd)
+{
+	RecordConn *c;
+
+	pthread_mutex_lock(&lock);
+
+	c = record_find(fd);
+	if (c) {
+		c->fd = -1;
+		fflush(record);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+/* What the server sent, and what it had been sent before that */
+typedef struct {
+	const uint8_t *data;
+	uint32_t len;
+	/* Client bytes, as recorded */
+	uint64_t need;
+	/* ns after the last of those, or after connect() */
+	uint64_t delay;
+	/* When the client got to need this time around */
+	uint64_t met;
+} ReplayOut;
+
+typedef struct {
+	int fd;
+	int id;
+	uint64_t connect_time;
+
+	/* All the client sent, and the size of its setup */
+	uint8_t *expect;
+	uint64_t expect_len;
+	uint64_t expect_setup;
+
+	ReplayOut *out;
+	int num_out;
+
+	/* What the client has sent this time */
+	uint64_t got;
+	uint8_t setup[SETUP_SIZE];
+	/* 0 until the fixed part is in */
+	uint64_t got_setup;
+} Replay;
+
+static void replay_free(Replay *r)
+{
+	free(r->expect);
+	free(r->out);
+	free(r);
+}
+
+static Replay *replay_new(int id)
+{
+	uint64_t sent = 0, last = 0;
+	bool connected = false;
+	Replay *r;
+	int i;
+
+	r = calloc(1, sizeof *r);
+	if (!r)
+		return NULL;
+
+	r->id = id;
+
+	for (i = 0; i < num_replay_chunks; i++) {
+		const ReplayChunk *c = &replay_chunks[i];
+
+		if (c->chunk.conn != id)
+			continue;
+
+		switch (c->chunk.type) {
+		case XTRACE_CONNECT:
+			connected = true;
+			last = c->chunk.time;
+			break;
+		case XTRACE_SEND:
+			r->expect_len += c->chunk.len;
+			break;
+		case XTRACE_RECV:
+			r->num_out++;
+			break;
+		}
+	}
+
+	r->expect = malloc(r->expect_len ?: 1);
+	r->out = calloc(r->num_out ?: 1, sizeof r->out[0]);
+	if (!connected || !r->expect || !r->out) {
+		replay_free(r);
+		return NULL;
+	}
+
+	r->num_out = 0;
+
+	for (i = 0; i < num_replay_chunks; i++) {
+		const ReplayChunk *c = &replay_chunks[i];
+		ReplayOut *out;
+
+		if (c->chunk.conn != id)
+			continue;
+
+		switch (c->chunk.type) {
+		case XTRACE_SEND:
+			memcpy(r->expect + sent, c->data, c->chunk.len);
+			sent += c->chunk.len;
+			last = c->chunk.time;
+			break;
+		case XTRACE_RECV:
+			out = &r->out[r->num_out++];
+			out->data = c->data;
+			out->len = c->chunk.len;
+			out->need = sent;
+			out->delay = c->chunk.time - last;
+			break;
+		}
+	}
+
+	if (r->expect_len >= SETUP_SIZE)
+		r->expect_setup = setup_size(r->expect);
+
+	return r;
+}
+
+/* The recorded byte the client's next one corresponds to */
+static uint64_t replay_pos(const Replay *r)
+{
+	if (r->got_setup && r->got >= r->got_setup)
+		return r->got - r->got_setup + r->expect_setup;
+
+	/* Only the whole setup counts. */
+	if (r->got < r->expect_setup)
+		return r->got;
+
+	return r->expect_setup ? r->expect_setup - 1 : 0;
+}
+
+/*
+ * Checks the client's bytes against the recording. The setup
+ * is only checked for the byte order, since the authorization
+ * data may well differ.
+ */
+static bool replay_check(Replay *r, const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++, r->got++) {
+		uint64_t pos;
+
+		if (r->got < SETUP_SIZE) {
+			r->setup[r->got] = data[i];
+			if (r->got == 0 && r->expect_len && data[i] != r->expect[0])
+				return false;
+			if (r->got == SETUP_SIZE - 1)
+				r->got_setup = setup_size(r->setup);
+			continue;
+		}
+
+		if (r->got < r->got_setup)
+			continue;
+
+		pos = replay_pos(r);
+		if (pos < r->expect_len && data[i] != r->expect[pos])
+			return false;
+	}
+
+	return true;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len)
+{
+	while (len) {
+		ssize_t n = REAL(write)(fd, data, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		data += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static void *replay_main(void *data)
+{
+	Replay *r = data;
+	uint64_t now = r->connect_time;
+	int next = 0, stamped = 0;
+
+	for (;;) {
+		struct pollfd pfd = {
+			.fd = r->fd,
+			.events = POLLIN,
+		};
+		struct timespec ts, *timeout = NULL;
+		uint8_t buf[4096];
+		ssize_t n;
+
+		/* The requests are in, so the clock starts. */
+		while (stamped < r->num_out && r->out[stamped].need <= replay_pos(r))
+			r->out[stamped++].met = now;
+
+		if (next < stamped) {
+			const ReplayOut *out = &r->out[next];
+			uint64_t due = out->met + out->delay;
+
+			now = monotonic_ns();
+			if (due <= now) {
+				if (!write_all(r->fd, out->data, out->len))
+					break;
+				next++;
+				continue;
+			}
+
+			ts.tv_sec = (due - now) / 1000000000ULL;
+			ts.tv_nsec = (due - now) % 1000000000ULL;
+			timeout = &ts;
+		}
+
+		if (ppoll(&pfd, 1, timeout, NULL) < 0 && errno != EINTR)
+			break;
+
+		now = monotonic_ns();
+
+		if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR)))
+			continue;
+
+		n = REAL(read)(r->fd, buf, sizeof buf);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		if (!replay_check(r, buf, n)) {
+			fprintf(stderr, "tvout-ctl-xtrace: connection %d differs "
+				"from the recording at byte %llu\n", r->id,
+				(unsigned long long) replay_pos(r));
+			break;
+		}
+	}
+
+	REAL(close)(r->fd);
+	replay_free(r);
+
+	return NULL;
+}
+
+/* The application's socket becomes our socketpair. */
+static int replay_connect(int fd)
+{
+	int fl, fdfl, sv[2];
+	pthread_attr_t attr;
+	pthread_t thread;
+	Replay *r = NULL;
+	int id;
+
+	pthread_mutex_lock(&lock);
+	id = num_ids++;
+	pthread_mutex_unlock(&lock);
+
+	if (replay_file)
+		r = replay_new(id);
+	if (!r) {
+		errno = ECONNREFUSED;
+		return -1;
+	}
+
+	fl = fcntl(fd, F_GETFL);
+	fdfl = fcntl(fd, F_GETFD);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+		replay_free(r);
+		return -1;
+	}
+
+	if (dup2(sv[0], fd) < 0) {
+		REAL(close)(sv[0]);
+		REAL(close)(sv[1]);
+		replay_free(r);
+		return -1;
+	}
+	REAL(close)(sv[0]);
+
+	fcntl(fd, F_SETFL, fl);
+	fcntl(fd, F_SETFD, fdfl);
+
+	r->fd = sv[1];
+	r->connect_time = monotonic_ns();
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, replay_main, r)) {
+		pthread_attr_destroy(&attr);
+		REAL(close)(sv[1]);
+		replay_free(r);
+		errno = ECONNREFUSED;
+		return -1;
+	}
+	pthread_attr_destroy(&attr);
+
+	return 0;
+}
+
+/* Loads all of the file, and leaves nothing behind on failure. */
+static bool replay_load(const char *path)
+{
+	XTraceHeader header;
+	ReplayChunk *chunks = NULL;
+	uint8_t *file = NULL;
+	size_t size, pos;
+	long end;
+	FILE *f;
+	int n, num;
+
+	f = fopen(path, "re");
+	if (!f)
+		return false;
+
+	if (fseek(f, 0, SEEK_END) < 0 || (end = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) < 0)
+		goto err;
+	size = end;
+
+	file = malloc(size ?: 1);
+	if (!file || fread(file, 1, size, f) != size)
+		goto err;
+
+	fclose(f);
+	f = NULL;
+
+	if (size < sizeof header)
+		goto err;
+
+	memcpy(&header, file, sizeof header);
+	if (header.magic != XTRACE_MAGIC || header.version != XTRACE_VERSION)
+		goto err;
+
+	/* Once to count, once to fill in */
+	for (n = 0; n < 2; n++) {
+		num = 0;
+
+		for (pos = sizeof header; pos + sizeof (XTraceChunk) <= size;) {
+			XTraceChunk chunk;
+
+			memcpy(&chunk, file + pos, sizeof chunk);
+			pos += sizeof chunk;
+
+			if (chunk.len > size - pos)
+				goto err;
+
+			if (chunks) {
+				chunks[num].chunk = chunk;
+				chunks[num].data = file + pos;
+			}
+			num++;
+
+			pos += chunk.len;
+		}
+
+		if (!chunks) {
+			chunks = calloc(num ?: 1, sizeof chunks[0]);
+			if (!chunks)
+				goto err;
+		}
+	}
+
+	replay_file = file;
+	replay_chunks = chunks;
+	num_replay_chunks = num;
+
+	return true;
+
+ err:
+	if (f)
+		fclose(f);
+	free(chunks);
+	free(file);
+
+	return false;
+}
+
+__attribute__((constructor))
+static void xtrace_init(void)
+{
+	const char *path;
+
+	RESOLVE(connect);
+	RESOLVE(close);
+	RESOLVE(read);
+	RESOLVE(readv);
+	RESOLVE(recv);
+	RESOLVE(recvmsg);
+	RESOLVE(write);
+	RESOLVE(writev);
+	RESOLVE(send);
+	RESOLVE(sendmsg);
+
+	path = getenv("TVOUT_CTL_REPLAY");
+	if (path && *path) {
+		/* Without the file there's no server either. */
+		replay = true;
+		if (!replay_load(path))
+			fprintf(stderr, "tvout-ctl-xtrace: can't replay %s\n", path);
+	}
+
+	path = getenv("TVOUT_CTL_RECORD");
+	if (path && *path && !replay) {
+		XTraceHeader header = {
+			.magic = XTRACE_MAGIC,
+			.version = XTRACE_VERSION,
+		};
+
+		record = fopen(path, "we");
+		if (record)
+			fwrite(&header, sizeof header, 1, record);
+		else
+			fprintf(stderr, "tvout-ctl-xtrace: can't record to %s\n", path);
+	}
+
+	/* Child processes would overwrite the recording. */
+	unsetenv("TVOUT_CTL_RECORD");
+	unsetenv("TVOUT_CTL_REPLAY");
+}
+
+__attribute__((destructor))
+static void xtrace_exit(void)
+{
+	pthread_mutex_lock(&lock);
+	if (record)
+		fclose(record);
+	record = NULL;
+	pthread_mutex_unlock(&lock);
+}
+
+int connect(int fd, const struct sockaddr *addr, socklen_t len)
+{
+	int r;
+
+	if (replay && addr && is_x_address(addr, len))
+		return replay_connect(fd);
+
+	r = REAL(connect)(fd, addr, len);
+
+	if (record && r == 0 && addr && is_x_address(addr, len))
+		record_connect(fd);
+
+	return r;
+}
+
+int close(int fd)
+{
+	if (record)
+		record_close(fd);
+
+	return REAL(close)(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	ssize_t r = REAL(read)(fd, buf, count);
+	struct iovec iov = { buf, count, };
+
+	record_io(fd, XTRACE_RECV, &iov, 1, r);
+
+	return r;
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	ssize_t r = REAL(readv)(fd, iov, iovcnt);
+
+	record_io(fd, XTRACE_RECV, iov, iovcnt, r);
+
+	return r;
+}
+
+ssize_t recv(int fd, void *buf, size_t len, int flags)
+{
+	ssize_t r = REAL(recv)(fd, buf, len, flags);
+	struct iovec iov = { buf, len, };
+
+	if (!(flags & MSG_PEEK))
+		record_io(fd, XTRACE_RECV, &iov, 1, r);
+
+	return r;
+}
+
+ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
+{
+	ssize_t r = REAL(recvmsg)(fd, msg, flags);
+
+	if (!(flags & MSG_PEEK))
+		record_io(fd, XTRACE_RECV, msg->msg_iov, msg->msg_iovlen, r);
+
+	return r;
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	ssize_t r = REAL(write)(fd, buf, count);
+	struct iovec iov = { (void *) buf, count, };
+
+	record_io(fd, XTRACE_SEND, &iov, 1, r);
+
+	return r;
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	ssize_t r = REAL(writev)(fd, iov, iovcnt);
+
+	record_io(fd, XTRACE_SEND, iov, iovcnt, r);
+
+	return r;
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+	ssize_t r = REAL(send)(fd, buf, len, flags);
+	struct iovec iov = { (void *) buf, len, };
+
+	record_io(fd, XTRACE_SEND, &iov, 1, r);
+
+	return r;
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	ssize_t r = REAL(sendmsg)(fd, msg, flags);
+
+	record_io(fd, XTRACE_SEND, msg->msg_iov, msg->msg_iovlen, r);
+
+	return r;
+}
@@ -17,15 +17,28 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <X11/Xlib.h>
+#include <X11/Xlibint.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/extensions/Xvlib.h>
+#include <xcb/xcb.h>
+#include <xcb/xv.h>
 
 #include "tvout-ctl.h"
+#include "tvout-ctl-batch.h"
+#include "tvout-ctl-cache.h"
+#include "tvout-ctl-private.h"
+#include "tvout-ctl-usdt.h"
 
 enum {
   ATTR_ENABLE,
@@ -42,116 +55,398 @@ static const char *atom_names[NUM_ATTRS] = {
   [ATTR_SCALE ] = "XV_OMAP_TVOUT_SCALE",
 };
 
-struct _TVoutCtl {
+/* What gets stored in the probe cache */
+typedef struct {
+  uint32_t port;
+  uint32_t atoms[NUM_ATTRS];
+} XvCache;
+
+enum {
+  PROBE_CACHED,
+  PROBE_ADAPTORS,
+  PROBE_PORTS,
+  PROBE_ATTRIBUTES,
+  PROBE_DONE,
+  PROBE_FAILED,
+};
+
+typedef struct {
+  TVoutCtl *tvout;
   Display *dpy;
+  xcb_connection_t *conn;
   XvPortID port;
   int event_base;
+  bool selected;
   Atom atoms[NUM_ATTRS];
   int values[NUM_ATTRS];
-  TVoutCtlNotify ui_notify;
-  void *ui_data;
-};
-
-static bool xv_init (TVoutCtl *ctl)
+  /* Attributes to verify, and the ones being verified */
+  unsigned int dirty;
+  unsigned int verifying;
+  Batch verify;
+  /* The first notify behind each */
+  CtlEventTime dirty_time;
+  CtlEventTime verify_time;
+  int probe_state;
+  Batch probe;
+  xcb_xv_query_adaptors_reply_t *adaptors;
+} XvCtl;
+
+static int count_attributes (const xcb_xv_query_port_attributes_reply_t *reply)
 {
-  Display *dpy;
-  unsigned int version, revision, request_base, event_base, error_base;
-  XvAdaptorInfo *adaptors;
-  unsigned int num_adaptors;
-  unsigned int adaptor_idx;
+  xcb_xv_attribute_info_iterator_t iter;
   int found = 0;
-  int r;
-  XvPortID port = 0;
 
-  dpy = XOpenDisplay (NULL);
-  if (!dpy)
-    return false;
+  if (!reply)
+    return 0;
 
-  r = XvQueryExtension (dpy, &version, &revision, &request_base, &event_base, &error_base);
-  if (r != Success){
-    XCloseDisplay (dpy);
-    return false;
+  iter = xcb_xv_query_port_attributes_attributes_iterator (reply);
+
+  for (; iter.rem; xcb_xv_attribute_info_next (&iter)) {
+    const char *name = xcb_xv_attribute_info_name (iter.data);
+    /* the name is not necessarily NUL terminated */
+    size_t len = strnlen (name, xcb_xv_attribute_info_name_length (iter.data));
+    int atom_idx;
+
+    for (atom_idx = 0; atom_idx < NUM_ATTRS; atom_idx++) {
+      if (strlen (atom_names[atom_idx]) == len &&
+          !strncmp (name, atom_names[atom_idx], len)) {
+        found++;
+        break;
+      }
+    }
   }
 
-  r = XvQueryAdaptors (dpy, DefaultRootWindow (dpy), &num_adaptors, &adaptors);
-  if (r != Success) {
-    XCloseDisplay (dpy);
-    return false;
+  return found;
+}
+
+static Bool xv_wire_to_port_notify (Display *dpy, XEvent *event, xEvent *wire)
+{
+  const xcb_xv_port_notify_event_t *w = (const void *) wire;
+  XvPortNotifyEvent *e = (XvPortNotifyEvent *) event;
+
+  e->type = w->response_type & 0x7f;
+  e->serial = _XSetLastRequestRead (dpy, (xGenericReply *) wire);
+  e->send_event = (w->response_type & 0x80) != 0;
+  e->display = dpy;
+  e->time = w->time;
+  e->port_id = w->port;
+  e->attribute = w->attribute;
+  e->value = w->value;
+
+  return True;
+}
+
+/*
+ * The event base comes from the prefetched extension reply,
+ * and we convert the notifies for Xlib ourselves, since
+ * XvQueryExtension() would be a blocking round trip.
+ */
+static void xv_events_register (XvCtl *ctl)
+{
+  ctl_wire_to_event (ctl->tvout, ctl->event_base + XvPortNotify,
+                     xv_wire_to_port_notify);
+}
+
+static void xv_events_init (XvCtl *ctl)
+{
+  xv_events_register (ctl);
+
+  xcb_xv_select_port_notify (ctl->conn, ctl->port, True);
+  ctl->selected = true;
+}
+
+static void xv_events_exit (XvCtl *ctl)
+{
+  /*
+   * The selection is per client, so on a shared Display the
+   * application may have made it as well. Leave it be, the
+   * application just ignores the notifies.
+   */
+  if (ctl->selected && !ctl->tvout->shared)
+    xcb_xv_select_port_notify (ctl->conn, ctl->port, False);
+  ctl->selected = false;
+}
+
+static bool send_adaptors (XvCtl *ctl)
+{
+  int attr_idx;
+
+  /* The atoms don't depend on the port so ask for them right away. */
+  for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++) {
+    const char *name = atom_names[attr_idx];
+
+    if (batch_add (&ctl->probe, xcb_intern_atom (ctl->conn, True, strlen (name), name).sequence) < 0)
+      return false;
   }
 
-  for (adaptor_idx = 0; adaptor_idx < num_adaptors; adaptor_idx++) {
-    unsigned int port_idx;
+  return batch_add (&ctl->probe, xcb_xv_query_adaptors (ctl->conn, DefaultRootWindow (ctl->dpy)).sequence) >= 0;
+}
 
-    for (port_idx = 0; port_idx < adaptors[adaptor_idx].num_ports; port_idx++) {
-      XvAttribute *attrs;
-      int num_attrs;
-      int attr_idx;
+static bool recv_adaptors (XvCtl *ctl)
+{
+  int attr_idx;
 
-      port = adaptors[adaptor_idx].base_id + port_idx;
+  for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++) {
+    xcb_intern_atom_reply_t *reply = batch_reply (&ctl->probe, attr_idx);
 
-      attrs = XvQueryPortAttributes (dpy, port, &num_attrs);
-      if (!attrs)
-        continue;
+    if (!reply || reply->atom == None)
+      return false;
 
-      found = 0;
+    ctl->atoms[attr_idx] = reply->atom;
+  }
 
-      for (attr_idx = 0; attr_idx < num_attrs; attr_idx++) {
-        int atom_idx;
+  /* Keep the adaptors around while we look at the ports. */
+  ctl->adaptors = batch_take (&ctl->probe, NUM_ATTRS);
 
-        for (atom_idx = 0; atom_idx < NUM_ATTRS; atom_idx++) {
-          if (!strcmp (attrs[attr_idx].name, atom_names[atom_idx])) {
-            found++;
-            break;
-          }
-        }
-      }
+  return ctl->adaptors != NULL;
+}
+
+static bool send_ports (XvCtl *ctl)
+{
+  xcb_xv_adaptor_info_iterator_t iter;
 
-      XFree (attrs);
+  /* Query the attributes of every port in one go. */
+  iter = xcb_xv_query_adaptors_info_iterator (ctl->adaptors);
 
-      if (found == NUM_ATTRS)
-        break;
+  for (; iter.rem; xcb_xv_adaptor_info_next (&iter)) {
+    unsigned int port_idx;
+
+    for (port_idx = 0; port_idx < iter.data->num_ports; port_idx++) {
+      xcb_xv_port_t port = iter.data->base_id + port_idx;
+
+      if (batch_add (&ctl->probe, xcb_xv_query_port_attributes (ctl->conn, port).sequence) < 0)
+        return false;
     }
+  }
+
+  return true;
+}
+
+static bool recv_ports (XvCtl *ctl)
+{
+  xcb_xv_adaptor_info_iterator_t iter;
+  int slot = 0;
 
-    if (found == NUM_ATTRS)
+  /* Walk the ports again in the same order to match up the replies. */
+  iter = xcb_xv_query_adaptors_info_iterator (ctl->adaptors);
+
+  for (; iter.rem && !ctl->port; xcb_xv_adaptor_info_next (&iter)) {
+    unsigned int port_idx;
+
+    for (port_idx = 0; port_idx < iter.data->num_ports; port_idx++, slot++) {
+      if (count_attributes (batch_reply (&ctl->probe, slot)) != NUM_ATTRS)
+        continue;
+
+      ctl->port = iter.data->base_id + port_idx;
       break;
+    }
   }
 
-  XvFreeAdaptorInfo (adaptors);
+  free (ctl->adaptors);
+  ctl->adaptors = NULL;
 
-  if (found != NUM_ATTRS) {
-    XCloseDisplay (dpy);
-    return false;
+  return ctl->port != 0;
+}
+
+static bool send_attributes_values (XvCtl *ctl)
+{
+  int attr_idx;
+
+  for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++) {
+    if (batch_add (&ctl->probe, xcb_xv_get_port_attribute (ctl->conn, ctl->port,
+                                                           ctl->atoms[attr_idx]).sequence) < 0)
+      return false;
   }
 
-  ctl->dpy = dpy;
-  ctl->event_base = event_base;
-  ctl->port = port;
+  return true;
+}
+
+static bool send_attributes (XvCtl *ctl)
+{
+  xv_events_init (ctl);
+
+  return send_attributes_values (ctl);
+}
+
+static bool recv_attributes (XvCtl *ctl)
+{
+  int attr_idx;
+
+  for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++) {
+    xcb_xv_get_port_attribute_reply_t *reply = batch_reply (&ctl->probe, attr_idx);
+
+    if (!reply)
+      return false;
+
+    ctl->values[attr_idx] = reply->value;
+  }
+
+  return true;
+}
+
+static void save_cache (XvCtl *ctl)
+{
+  XvCache cache;
+  int attr_idx;
+
+  cache.port = ctl->port;
+  for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++)
+    cache.atoms[attr_idx] = ctl->atoms[attr_idx];
+
+  cache_store (ctl->dpy, "xv", &cache, sizeof cache);
+}
+
+/*
+ * Reading the attributes validates both the port and the atoms.
+ * The checked SelectPortNotify keeps a stale port from ending up
+ * in the Xlib error handler.
+ */
+static bool send_cached (XvCtl *ctl)
+{
+  xv_events_register (ctl);
+
+  if (batch_add (&ctl->probe, xcb_xv_select_port_notify_checked (ctl->conn, ctl->port, True).sequence) < 0)
+    return false;
+
+  return send_attributes_values (ctl);
+}
+
+static bool recv_cached (XvCtl *ctl)
+{
+  int attr_idx;
+
+  if (batch_error (&ctl->probe, 0) != 0)
+    return false;
+
+  for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++) {
+    xcb_xv_get_port_attribute_reply_t *reply = batch_reply (&ctl->probe, attr_idx + 1);
+
+    if (!reply)
+      return false;
+
+    ctl->values[attr_idx] = reply->value;
+  }
 
   return true;
 }
 
-static void xv_exit (TVoutCtl *ctl)
+/* The value reported for TVOUT_CTL_READY */
+static int probe_status (const XvCtl *ctl)
+{
+  switch (ctl->probe_state) {
+  case PROBE_DONE:
+    return 1;
+  case PROBE_FAILED:
+    return -1;
+  default:
+    return 0;
+  }
+}
+
+static void probe_fail (XvCtl *ctl)
 {
-  XCloseDisplay (ctl->dpy);
+  batch_clear (&ctl->probe);
+  free (ctl->adaptors);
+  ctl->adaptors = NULL;
+  ctl->probe_state = PROBE_FAILED;
 }
 
-static void update_ui (TVoutCtl *ctl, int attr_idx, int value)
+/*
+ * Each probe step handles the replies to the requests sent by
+ * the previous step and sends out the requests for the next one.
+ */
+static void probe_advance (XvCtl *ctl)
 {
-  if (!ctl->ui_notify)
+  bool ok = false;
+
+  switch (ctl->probe_state) {
+  case PROBE_CACHED:
+    /* The checked SelectPortNotify made it through? */
+    ctl->selected = batch_error (&ctl->probe, 0) == 0;
+
+    ok = recv_cached (ctl);
+    if (ok) {
+      USDT3 (probe_phase, "xv", PROBE_CACHED, ok);
+      batch_clear (&ctl->probe);
+      ctl->probe_state = PROBE_DONE;
+      return;
+    }
+
+    /* Stale cache, start over. */
+    xv_events_exit (ctl);
+    batch_clear (&ctl->probe);
+    ctl->port = 0;
+    ok = send_adaptors (ctl);
+    break;
+  case PROBE_ADAPTORS:
+    ok = recv_adaptors (ctl);
+    batch_clear (&ctl->probe);
+    ok = ok && send_ports (ctl);
+    break;
+  case PROBE_PORTS:
+    ok = recv_ports (ctl);
+    batch_clear (&ctl->probe);
+    ok = ok && send_attributes (ctl);
+    break;
+  case PROBE_ATTRIBUTES:
+    ok = recv_attributes (ctl);
+    batch_clear (&ctl->probe);
+    if (ok)
+      save_cache (ctl);
+    break;
+  default:
     return;
+  }
+
+  USDT3 (probe_phase, "xv", ctl->probe_state, ok);
 
+  if (!ok) {
+    probe_fail (ctl);
+    return;
+  }
+
+  ctl->probe_state++;
+}
+
+static bool probe_start (XvCtl *ctl)
+{
+  XvCache cache;
+  int attr_idx;
+
+  batch_init (&ctl->probe, ctl->conn);
+
+  if (cache_load (ctl->dpy, "xv", &cache, sizeof cache)) {
+    ctl->port = cache.port;
+    for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++)
+      ctl->atoms[attr_idx] = cache.atoms[attr_idx];
+
+    ctl->probe_state = PROBE_CACHED;
+    return send_cached (ctl);
+  }
+
+  ctl->probe_state = PROBE_ADAPTORS;
+
+  return send_adaptors (ctl);
+}
+
+static void update_ui (XvCtl *ctl, int attr_idx, int value)
+{
   switch (attr_idx) {
   case ATTR_ENABLE:
-    ctl->ui_notify (ctl->ui_data, TVOUT_CTL_ENABLE, value);
+    ctl_notify_received (ctl->tvout, 0, TVOUT_CTL_ENABLE, value,
+                         &ctl->verify_time);
     break;
   case ATTR_TV_STD:
-    ctl->ui_notify (ctl->ui_data, TVOUT_CTL_TV_STD, value);
+    ctl_notify_received (ctl->tvout, 0, TVOUT_CTL_TV_STD, value,
+                         &ctl->verify_time);
     break;
   case ATTR_ASPECT:
-    ctl->ui_notify (ctl->ui_data, TVOUT_CTL_ASPECT, value);
+    ctl_notify_received (ctl->tvout, 0, TVOUT_CTL_ASPECT, value,
+                         &ctl->verify_time);
     break;
   case ATTR_SCALE:
-    ctl->ui_notify (ctl->ui_data, TVOUT_CTL_SCALE, value);
+    ctl_notify_received (ctl->tvout, 0, TVOUT_CTL_SCALE, value,
+                         &ctl->verify_time);
     break;
   }
 }
@@ -161,212 +456,271 @@ union xeu {
   XvPortNotifyEvent port_notify_event;
 };
 
-static void xv_io_func (TVoutCtl *ctl)
+static bool xv_handle_event (void *priv, const XEvent *e)
 {
-  union xeu xe;
-  XvPortNotifyEvent *notify = &xe.port_notify_event;
-  int attr_idx, value, r;
-
-  while (XPending (ctl->dpy)) {
-    XNextEvent (ctl->dpy, &xe.event);
-
-    if (notify->type != ctl->event_base + XvPortNotify)
-      continue;
-
-    for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++) {
-      if (notify->attribute != ctl->atoms[attr_idx])
-        continue;
+  XvCtl *ctl = priv;
+  const XvPortNotifyEvent *notify = &((const union xeu *) e)->port_notify_event;
+  int attr_idx;
 
-      /*
-       * X server bug:
-       * Port notifications will be sent even if the
-       * server rejected the value and notify->value
-       * will contain the invalid value from the client's
-       * rejected request. So double check the real
-       * situation with XvGetPortAttribute() instead
-       * of trusting notify->value implicitly.
-       */
-      if (notify->value == ctl->values[attr_idx])
-        break;
+  if (!ctl->selected ||
+      notify->type != ctl->event_base + XvPortNotify ||
+      notify->port_id != ctl->port)
+    return false;
 
-      r = XvGetPortAttribute (ctl->dpy, ctl->port,
-                              ctl->atoms[attr_idx], &value);
-      if (r != Success)
-        break;
+  USDT2 (xv_event, notify->attribute, notify->value);
 
-      if (ctl->values[attr_idx] == value)
-        break;
+  for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++) {
+    if (notify->attribute != ctl->atoms[attr_idx])
+      continue;
 
-      ctl->values[attr_idx] = value;
-      update_ui (ctl, attr_idx, ctl->values[attr_idx]);
+    /*
+     * X server bug:
+     * Port notifications will be sent even if the
+     * server rejected the value and notify->value
+     * will contain the invalid value from the client's
+     * rejected request. So double check the real
+     * situation with GetPortAttribute instead
+     * of trusting notify->value implicitly.
+     *
+     * The check is done once the queue has been
+     * drained, so a burst of notifies for the same
+     * attribute costs a single request. A notify that
+     * arrives while the attribute is being checked may
+     * carry the value we have only because the reply
+     * hasn't been handled yet, so it's checked again.
+     */
+    if (notify->value == ctl->values[attr_idx] &&
+        !(ctl->verifying & (1 << attr_idx)))
       break;
+
+    CTL_STATS_INC (ctl->tvout, checked_notifies);
+    if (!ctl->dirty) {
+      ctl->dirty_time.received = ctl->tvout->event_time;
+      ctl->dirty_time.server_time = notify->time;
     }
+    ctl->dirty |= 1 << attr_idx;
+    break;
   }
-}
-
-static bool xv_events_init (TVoutCtl *ctl)
-{
-  int r;
-
-  r = XvSelectPortNotify (ctl->dpy, ctl->port, True);
-  if (r != Success)
-    return false;
 
   return true;
 }
 
-static void xv_events_exit (TVoutCtl *ctl)
-{
-  XvSelectPortNotify (ctl->dpy, ctl->port, False);
-}
-
-static bool xv_update_attributes (TVoutCtl *ctl)
+static void verify_send (XvCtl *ctl)
 {
-  int r;
   int attr_idx;
 
-  r = XInternAtoms (ctl->dpy, (char **)atom_names, NUM_ATTRS, True, ctl->atoms);
-  if (!r)
-    return false;
+  if (!ctl->dirty || ctl->verifying)
+    return;
 
   for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++) {
-    r = XvGetPortAttribute (ctl->dpy, ctl->port,
-                            ctl->atoms[attr_idx],
-                            &ctl->values[attr_idx]);
-    if (r != Success)
-      return false;
+    if (!(ctl->dirty & (1 << attr_idx)))
+      continue;
+
+    if (batch_add (&ctl->verify,
+                   xcb_xv_get_port_attribute (ctl->conn, ctl->port,
+                                              ctl->atoms[attr_idx]).sequence) < 0) {
+      batch_clear (&ctl->verify);
+      return;
+    }
   }
 
-  return true;
+  ctl->verifying = ctl->dirty;
+  ctl->verify_time = ctl->dirty_time;
+  ctl->dirty = 0;
+  CTL_STATS_INC (ctl->tvout, attribute_round_trips);
+
+  xcb_flush (ctl->conn);
 }
 
-TVoutCtl *tvout_ctl_init (TVoutCtlNotify ui_notify, void *ui_data)
+static void verify_recv (XvCtl *ctl)
 {
-  TVoutCtl *ctl;
+  int attr_idx, slot = 0;
 
-  ctl = calloc (1, sizeof *ctl);
-  if (!ctl)
-    return NULL;
+  if (!ctl->verifying || !batch_poll (&ctl->verify))
+    return;
 
-  if (!xv_init (ctl)) {
-    free (ctl);
-    return NULL;
-  }
+  for (attr_idx = 0; attr_idx < NUM_ATTRS; attr_idx++) {
+    xcb_xv_get_port_attribute_reply_t *reply;
 
-  if (!xv_events_init (ctl)) {
-    xv_exit (ctl);
-    free (ctl);
-    return NULL;
-  }
+    if (!(ctl->verifying & (1 << attr_idx)))
+      continue;
 
-  if (!xv_update_attributes (ctl)) {
-    xv_events_exit (ctl);
-    xv_exit (ctl);
-    free (ctl);
-    return NULL;
+    reply = batch_reply (&ctl->verify, slot++);
+    if (!reply || reply->value == ctl->values[attr_idx])
+      continue;
+
+    ctl->values[attr_idx] = reply->value;
+    update_ui (ctl, attr_idx, ctl->values[attr_idx]);
   }
 
-  xv_io_func (ctl);
+  batch_clear (&ctl->verify);
+  ctl->verifying = 0;
+}
 
-  ctl->ui_notify = ui_notify;
-  ctl->ui_data = ui_data;
+static bool xv_needs_dispatch (void *priv)
+{
+  XvCtl *ctl = priv;
 
-  return ctl;
+  return ctl->verifying && batch_poll (&ctl->verify);
 }
 
-void tvout_ctl_exit (TVoutCtl *ctl)
+static void xv_events_done (void *priv)
 {
-  if (!ctl)
-    return;
+  XvCtl *ctl = priv;
 
-  xv_events_exit (ctl);
-  xv_exit (ctl);
-  free (ctl);
+  verify_recv (ctl);
+  verify_send (ctl);
 }
 
-int tvout_ctl_fd (TVoutCtl *ctl)
+static void xv_exit (void *priv)
 {
-  if (!ctl)
-    return -1;
+  XvCtl *ctl = priv;
 
-  return ConnectionNumber (ctl->dpy);
+  xv_events_exit (ctl);
+  batch_clear (&ctl->verify);
+  batch_clear (&ctl->probe);
+  free (ctl->adaptors);
+  free (ctl);
 }
 
-void tvout_ctl_fd_ready (TVoutCtl *ctl)
+static void *xv_probe_start (TVoutCtl *tvout)
 {
+  const xcb_query_extension_reply_t *ext;
+  XvCtl *ctl;
+
+  ext = xcb_get_extension_data (tvout->conn, &xcb_xv_id);
+  if (!ext || !ext->present)
+    return NULL;
+
+  ctl = calloc (1, sizeof *ctl);
   if (!ctl)
-    return;
+    return NULL;
 
-  xv_io_func (ctl);
+  ctl->tvout = tvout;
+  ctl->dpy = tvout->dpy;
+  ctl->conn = tvout->conn;
+  ctl->event_base = ext->first_event;
+  batch_init (&ctl->verify, ctl->conn);
+
+  if (!probe_start (ctl)) {
+    xv_exit (ctl);
+    return NULL;
+  }
+
+  return ctl;
 }
 
-static void xv_set_attribute (TVoutCtl *ctl, int attr_idx, int value)
+static int xv_probe_step (void *priv, bool wait)
 {
-  int r;
+  XvCtl *ctl = priv;
+
+  if (wait) {
+    if (batch_wait (&ctl->probe))
+      probe_advance (ctl);
+    else
+      probe_fail (ctl);
+  } else {
+    while (ctl->probe_state < PROBE_DONE && batch_poll (&ctl->probe))
+      probe_advance (ctl);
+  }
 
-  if (!ctl)
-    return;
+  return probe_status (ctl);
+}
 
-  if (value == ctl->values[attr_idx])
-    return;
+static int xv_set_attribute (XvCtl *ctl, int attr_idx, int value,
+                             unsigned int *sequence)
+{
+  if (value == ctl->values[attr_idx]) {
+    CTL_STATS_INC (ctl->tvout, redundant_sets);
+    return 0;
+  }
 
-  r = XvSetPortAttribute (ctl->dpy, ctl->port, ctl->atoms[attr_idx], value);
-  if (r != Success)
-    return;
+  if (sequence)
+    *sequence = xcb_xv_set_port_attribute_checked (ctl->conn, ctl->port,
+                                                   ctl->atoms[attr_idx],
+                                                   value).sequence;
+  else
+    xcb_xv_set_port_attribute (ctl->conn, ctl->port, ctl->atoms[attr_idx], value);
 
-  xv_io_func (ctl);
+  return 1;
 }
 
-int tvout_ctl_set (TVoutCtl *ctl, enum TVoutCtlAttr attr, int value)
+/* Returns the attribute index, or -1 if the value is not valid. */
+static int xv_attr_idx (enum TVoutCtlAttr attr, int value)
 {
   switch (attr) {
   case TVOUT_CTL_ENABLE:
     if (value < 0 || value > 1)
       return -1;
-    xv_set_attribute (ctl, ATTR_ENABLE, value);
-    break;
+    return ATTR_ENABLE;
   case TVOUT_CTL_TV_STD:
     if (value < 0 || value > 1)
       return -1;
-    xv_set_attribute (ctl, ATTR_TV_STD, value);
-    break;
+    return ATTR_TV_STD;
   case TVOUT_CTL_ASPECT:
     if (value < 0 || value > 1)
       return -1;
-    xv_set_attribute (ctl, ATTR_ASPECT, value);
-    break;
+    return ATTR_ASPECT;
   case TVOUT_CTL_SCALE:
     if (value < 1 || value > 100)
       return -1;
-    xv_set_attribute (ctl, ATTR_SCALE, value);
-    break;
+    return ATTR_SCALE;
   default:
     return -1;
   }
+}
+
+static int xv_check (void *priv, enum TVoutCtlAttr attr, int value)
+{
+  const XvCtl *ctl = priv;
+  int attr_idx = xv_attr_idx (attr, value);
+
+  if (attr_idx < 0)
+    return -1;
 
-  return 0;
+  return value != ctl->values[attr_idx];
 }
 
-static int get_attribute (TVoutCtl *ctl, int attr_idx)
+static int xv_set (void *priv, enum TVoutCtlAttr attr, int value,
+                   unsigned int *sequence)
 {
-  if (!ctl)
-    return 0;
+  XvCtl *ctl = priv;
+  int attr_idx = xv_attr_idx (attr, value);
+
+  if (attr_idx < 0)
+    return -1;
 
-  return ctl->values[attr_idx];
+  return xv_set_attribute (ctl, attr_idx, value, sequence);
 }
 
-int tvout_ctl_get (TVoutCtl *ctl, enum TVoutCtlAttr attr)
+static int xv_get (void *priv, enum TVoutCtlAttr attr)
 {
+  const XvCtl *ctl = priv;
+
   switch (attr) {
   case TVOUT_CTL_ENABLE:
-    return get_attribute (ctl, ATTR_ENABLE);
+    return ctl->values[ATTR_ENABLE];
   case TVOUT_CTL_TV_STD:
-    return get_attribute (ctl, ATTR_TV_STD);
+    return ctl->values[ATTR_TV_STD];
   case TVOUT_CTL_ASPECT:
-    return get_attribute (ctl, ATTR_ASPECT);
+    return ctl->values[ATTR_ASPECT];
   case TVOUT_CTL_SCALE:
-    return get_attribute (ctl, ATTR_SCALE);
+    return ctl->values[ATTR_SCALE];
   default:
     return -1;
   }
 }
+
+const TVoutCtlBackend xv_backend = {
+  .name = "xv",
+  .ext = &xcb_xv_id,
+  .probe_start = xv_probe_start,
+  .probe_step = xv_probe_step,
+  .exit = xv_exit,
+  .handle_event = xv_handle_event,
+  .events_done = xv_events_done,
+  .needs_dispatch = xv_needs_dispatch,
+  .check = xv_check,
+  .set = xv_set,
+  .get = xv_get,
+};
@@ -0,0 +1,1604 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xlibint.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+
+#include "tvout-ctl.h"
+#include "tvout-ctl-private.h"
+#include "tvout-ctl-usdt.h"
+
+/* One PAL frame */
+#define DEFAULT_PACE_INTERVAL (40 * 1000000ULL)
+
+static const TVoutCtlBackend *backends[] = {
+#ifdef HAVE_XRANDR_BACKEND
+	&xrandr_backend,
+#endif
+#ifdef HAVE_XV_BACKEND
+	&xv_backend,
+#endif
+#ifdef HAVE_SIM_BACKEND
+	&sim_backend,
+#endif
+	NULL,
+};
+
+/* Rebuilds the snapshot from what the backend knows. */
+static void snapshot_update(TVoutCtl *ctl)
+{
+	TVoutCtlState state;
+	int i;
+
+	for (i = 0; i < NUM_CTL_ATTRS; i++)
+		state.values[i] = ctl->status == 1 ? ctl->get(ctl->priv, i) : -1;
+
+	state.values[TVOUT_CTL_READY] = ctl->status;
+
+	snapshot_write(&ctl->snapshot, &state, 0, 0);
+}
+
+/*
+ * A notification matching the last value we set is taken to be
+ * the answer to it. Anything else means someone else got there
+ * first, and the set won't be answered on its own anymore.
+ */
+static enum TVoutCtlOrigin notify_origin(TVoutCtl *ctl, int output,
+					 enum TVoutCtlAttr attr, int value)
+{
+	unsigned int bit = 1 << attr;
+	bool self;
+
+	if (output != 0 || attr >= NUM_CTL_ATTRS || ctl->client)
+		return TVOUT_CTL_ORIGIN_UNKNOWN;
+
+	self = (ctl->self_pending & bit) && ctl->self_values[attr] == value;
+	ctl->self_pending &= ~bit;
+
+	return self ? TVOUT_CTL_ORIGIN_SELF : TVOUT_CTL_ORIGIN_EXTERNAL;
+}
+
+static void call_notify_ext(TVoutCtl *ctl, int output, enum TVoutCtlAttr attr,
+			    int value, uint64_t received,
+			    unsigned long server_time, enum TVoutCtlOrigin origin)
+{
+	TVoutCtlNotifyInfo info = {
+		.output = output,
+		.attr = attr,
+		.value = value,
+		.server_time = server_time,
+		.received = received,
+		.origin = origin,
+	};
+
+	ctl->notify_ext(ctl->ui_data, &info);
+}
+
+/*
+ * The snapshot and the ui_notify/batch_notify callbacks
+ * only follow output 0.
+ */
+void ctl_notify_received(TVoutCtl *ctl, int output, enum TVoutCtlAttr attr,
+			 int value, const CtlEventTime *when)
+{
+	CtlEventTime now = {
+		.received = ctl->event_time,
+	};
+	enum TVoutCtlOrigin origin = TVOUT_CTL_ORIGIN_UNKNOWN;
+
+	if (!when)
+		when = &now;
+
+	if (ctl->notify_ext)
+		origin = notify_origin(ctl, output, attr, value);
+
+	/* Callbacks calling tvout_ctl_get() must see the new value. */
+	if (output == 0)
+		snapshot_write(&ctl->snapshot, NULL, attr, value);
+
+	if (ctl->thread) {
+		ThreadEvent ev = {
+			.type = THREAD_EVENT_NOTIFY,
+			.output = output,
+			.attr = attr,
+			.value = value,
+			.received = when->received,
+			.server_time = when->server_time,
+			.origin = origin,
+		};
+
+		thread_push(ctl, &ev);
+	} else {
+		USDT3(notify_entry, output, attr, value);
+
+		if (output == 0) {
+			ctl->changed |= 1 << attr;
+
+			if (ctl->ui_notify) {
+				ctl->ui_notify(ctl->ui_data, attr, value);
+				CTL_STATS_INC(ctl, callbacks);
+			}
+		}
+
+		if (ctl->output_notify) {
+			ctl->output_notify(ctl->ui_data, output, attr, value);
+			CTL_STATS_INC(ctl, callbacks);
+		}
+
+		if (ctl->notify_ext) {
+			call_notify_ext(ctl, output, attr, value, when->received,
+					when->server_time, origin);
+			CTL_STATS_INC(ctl, callbacks);
+		}
+
+		USDT3(notify_return, output, attr, value);
+	}
+
+	if (when->received)
+		ctl_stats_latency(ctl, TVOUT_CTL_HIST_EVENT_NOTIFY,
+				  when->received);
+}
+
+void ctl_notify_output(TVoutCtl *ctl, int output, enum TVoutCtlAttr attr,
+		       int value)
+{
+	ctl_notify_received(ctl, output, attr, value, NULL);
+}
+
+void ctl_notify(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value)
+{
+	ctl_notify_output(ctl, 0, attr, value);
+}
+
+static void set_done(TVoutCtl *ctl, TVoutCtlSetDone done, void *data,
+		     enum TVoutCtlAttr attr, int value, int result)
+{
+	if (!done)
+		return;
+
+	if (ctl->thread) {
+		ThreadEvent ev = {
+			.type = THREAD_EVENT_SET_DONE,
+			.attr = attr,
+			.value = value,
+			.result = result,
+			.done = done,
+			.data = data,
+		};
+
+		thread_push(ctl, &ev);
+		return;
+	}
+
+	done(data, attr, value, result);
+	CTL_STATS_INC(ctl, callbacks);
+}
+
+/*
+ * In threaded mode the X connection and everything the
+ * backends know belongs to the event thread, so the API
+ * entry points must take the lock.
+ */
+static void api_lock(TVoutCtl *ctl)
+{
+	if (ctl->thread)
+		thread_lock(ctl);
+}
+
+static void api_unlock(TVoutCtl *ctl)
+{
+	if (ctl->thread)
+		thread_unlock(ctl);
+}
+
+/* Everything that changed since the last call, in one go */
+static void batch_notify(TVoutCtl *ctl)
+{
+	TVoutCtlState state;
+	unsigned int changed = ctl->changed;
+
+	if (!changed)
+		return;
+
+	ctl->changed = 0;
+
+	if (!ctl->batch_notify)
+		return;
+
+	snapshot_read(ctl->view, &state);
+
+	ctl->batch_notify(ctl->ui_data, changed, &state);
+	CTL_STATS_INC(ctl, callbacks);
+}
+
+/*
+ * In client mode tvout-ctld does the work. Notifications that
+ * arrive while we wait for the reply are handled right away.
+ */
+static int remote_call(TVoutCtl *ctl, int type,
+		       const TVoutCtlAttrValue *values, int num_values,
+		       int arg0, int arg1)
+{
+	ProtoMsg msg;
+	int r;
+
+	if (ctl->status != 1 || num_values > PROTO_MAX_VALUES)
+		return -1;
+
+	memset(&msg, 0, sizeof msg);
+	msg.type = type;
+	msg.args[0] = arg0;
+	msg.args[1] = arg1;
+	msg.num_values = num_values;
+	if (num_values > 0)
+		memcpy(msg.values, values, num_values * sizeof values[0]);
+
+	r = client_request(ctl, &msg);
+
+	batch_notify(ctl);
+
+	return r;
+}
+
+static int remote_set(TVoutCtl *ctl, int type, enum TVoutCtlAttr attr,
+		      int value)
+{
+	TVoutCtlAttrValue v = {
+		.attr = attr,
+		.value = value,
+	};
+
+	return remote_call(ctl, type, &v, 1, 0, 0);
+}
+
+uint64_t ctl_monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void ctl_stats_latency(TVoutCtl *ctl, enum TVoutCtlHist hist, uint64_t start)
+{
+	uint64_t us;
+	int bucket = 0;
+
+	if (!ctl->stats_enabled || !start)
+		return;
+
+	us = (ctl_monotonic_ns() - start) / 1000;
+	if (us)
+		bucket = 64 - __builtin_clzll(us);
+	if (bucket >= TVOUT_CTL_HIST_BUCKETS)
+		bucket = TVOUT_CTL_HIST_BUCKETS - 1;
+
+	ctl->stats.hist[hist][bucket]++;
+}
+
+/*
+ * Handles at most max_events events, and stops once the deadline
+ * has passed. Zero means no limit for both. Returns true if there
+ * were events left over.
+ *
+ * XPending() would flush the output buffer on every iteration,
+ * so flush once up front and only read in the loop.
+ */
+static bool process_events_budget(TVoutCtl *ctl, int max_events,
+				  uint64_t deadline)
+{
+	bool more = false;
+	int n = 0;
+
+	CTL_STATS_INC(ctl, drains);
+
+	if (ctl->conn)
+		xcb_flush(ctl->conn);
+
+	/* The application reads a shared Display's events itself. */
+	while (ctl->dpy && !ctl->shared &&
+	       (more = XEventsQueued(ctl->dpy, QueuedAfterReading) > 0)) {
+		XEvent e;
+
+		if ((max_events > 0 && n >= max_events) ||
+		    (deadline && ctl_monotonic_ns() >= deadline))
+			break;
+
+		XNextEvent(ctl->dpy, &e);
+
+		CTL_STATS_INC(ctl, events);
+
+		if (!ctl->event_time && ctl_timing(ctl))
+			ctl->event_time = ctl_monotonic_ns();
+
+		ctl->handle_event(ctl->priv, &e);
+		n++;
+	}
+
+	ctl->filtered = false;
+
+	if (ctl->backend->events_done)
+		ctl->backend->events_done(ctl->priv);
+
+	batch_notify(ctl);
+
+	ctl->event_time = 0;
+
+	return more;
+}
+
+static void process_events(TVoutCtl *ctl)
+{
+	process_events_budget(ctl, 0, 0);
+}
+
+/*
+ * $TVOUT_CTL_BACKEND limits probing to a single backend.
+ * Standalone backends are listed last, so if the first one
+ * is standalone no X backend was built.
+ */
+static bool backend_wanted(const TVoutCtlBackend *backend)
+{
+	const char *name = getenv("TVOUT_CTL_BACKEND");
+
+	if (name && *name)
+		return strcmp(name, backend->name) == 0;
+
+	return !backend->standalone || backends[0]->standalone;
+}
+
+/* None of the wanted backends needs the X server. */
+static bool standalone(void)
+{
+	int i;
+
+	for (i = 0; backends[i]; i++)
+		if (backend_wanted(backends[i]) && !backends[i]->standalone)
+			return false;
+
+	return true;
+}
+
+static void drop_candidate(TVoutCtl *ctl, int i)
+{
+	TVoutCtlCandidate *c = &ctl->candidates[i];
+
+	c->backend->exit(c->priv);
+
+	ctl->num_candidates--;
+	memmove(c, c + 1, (ctl->num_candidates - i) * sizeof *c);
+}
+
+static void drop_candidates(TVoutCtl *ctl)
+{
+	while (ctl->num_candidates)
+		drop_candidate(ctl, ctl->num_candidates - 1);
+}
+
+void ctl_wire_to_event(TVoutCtl *ctl, int event, CtlWireToEvent proc)
+{
+	CtlWireToEvent old;
+
+	/* The extension's own library may have been there first. */
+	old = XESetWireToEvent(ctl->dpy, event, proc);
+	if (old != _XUnknownWireEvent)
+		XESetWireToEvent(ctl->dpy, event, old);
+}
+
+static void probe_backends(TVoutCtl *ctl)
+{
+	int i;
+
+	for (i = 0; backends[i] && ctl->num_candidates < MAX_BACKENDS; i++) {
+		TVoutCtlCandidate *c = &ctl->candidates[ctl->num_candidates];
+
+		if (!backend_wanted(backends[i]))
+			continue;
+
+		c->backend = backends[i];
+		c->priv = backends[i]->probe_start(ctl);
+		if (c->priv)
+			ctl->num_candidates++;
+	}
+}
+
+static bool probe_start(TVoutCtl *ctl)
+{
+	int i;
+
+	batch_init(&ctl->exts, ctl->conn);
+
+	/* Get all the extension queries out in one go. */
+	for (i = 0; backends[i]; i++) {
+		if (backend_wanted(backends[i]) && backends[i]->ext &&
+		    ctl->conn)
+			xcb_prefetch_extension_data(ctl->conn, backends[i]->ext);
+	}
+
+	/*
+	 * xcb only lets us wait for the extension replies, so put
+	 * something we can poll for behind them. Replies come back
+	 * in order, so once it's in so are they.
+	 */
+	if (ctl->conn &&
+	    batch_add(&ctl->exts, xcb_get_input_focus(ctl->conn).sequence) < 0)
+		return false;
+
+	if (ctl->exts.num_slots)
+		return true;
+
+	probe_backends(ctl);
+
+	return ctl->num_candidates > 0;
+}
+
+static void choose_backend(TVoutCtl *ctl, int i)
+{
+	TVoutCtlCandidate c = ctl->candidates[i];
+
+	ctl->num_candidates--;
+	memmove(&ctl->candidates[i], &ctl->candidates[i + 1],
+		(ctl->num_candidates - i) * sizeof c);
+
+	/* We have a winner, the rest can go. */
+	drop_candidates(ctl);
+
+	ctl->backend = c.backend;
+	ctl->priv = c.priv;
+	ctl->handle_event = c.backend->handle_event;
+	ctl->set = c.backend->set;
+	ctl->get = c.backend->get;
+
+	ctl->status = 1;
+	snapshot_update(ctl);
+
+	ctl_stats_latency(ctl, TVOUT_CTL_HIST_INIT, ctl->init_time);
+
+	USDT2(ready, ctl->status, c.backend->name);
+}
+
+/*
+ * All the candidates have their requests in flight at the
+ * same time, so a step costs one round trip no matter how
+ * many backends are being probed. The first backend to find
+ * a usable TV output wins.
+ */
+static void probe_step(TVoutCtl *ctl, bool wait)
+{
+	int i = 0;
+
+	if (ctl->exts.num_slots) {
+		if (wait)
+			batch_wait(&ctl->exts);
+		else if (!batch_poll(&ctl->exts))
+			return;
+
+		batch_clear(&ctl->exts);
+		probe_backends(ctl);
+
+		/* Their first batch is the next round trip. */
+		wait = false;
+	}
+
+	while (i < ctl->num_candidates) {
+		TVoutCtlCandidate *c = &ctl->candidates[i];
+
+		switch (c->backend->probe_step(c->priv, wait)) {
+		case 1:
+			choose_backend(ctl, i);
+			return;
+		case -1:
+			drop_candidate(ctl, i);
+			break;
+		default:
+			i++;
+			break;
+		}
+	}
+
+	if (!ctl->num_candidates) {
+		ctl->status = -1;
+		snapshot_update(ctl);
+
+		USDT2(ready, ctl->status, NULL);
+	}
+}
+
+static bool probe_wait(TVoutCtl *ctl)
+{
+	while (ctl->status == 0) {
+		if (ctl->conn)
+			CTL_STATS_INC(ctl, init_round_trips);
+		probe_step(ctl, true);
+	}
+
+	return ctl->status == 1;
+}
+
+/*
+ * Arms the timer for the nearest set deadline or coalesced
+ * flush, or disarms it.
+ */
+static void timer_update(TVoutCtl *ctl)
+{
+	struct itimerspec its = {};
+	const TVoutCtlPendingSet *p;
+	uint64_t deadline = ctl->next_flush;
+
+	if (ctl->timer_fd < 0)
+		return;
+
+	for (p = ctl->pending; p; p = p->next)
+		if (p->deadline && (!deadline || p->deadline < deadline))
+			deadline = p->deadline;
+
+	its.it_value.tv_sec = deadline / 1000000000ULL;
+	its.it_value.tv_nsec = deadline % 1000000000ULL;
+
+	timerfd_settime(ctl->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void pending_complete(TVoutCtl *ctl, TVoutCtlPendingSet **pp,
+			     int result)
+{
+	TVoutCtlPendingSet *p = *pp;
+
+	*pp = p->next;
+
+	batch_clear(&p->batch);
+
+	if (p->start)
+		ctl_stats_latency(ctl, TVOUT_CTL_HIST_SET_CONFIRM, p->start);
+
+	set_done(ctl, p->done, p->data, p->attr, p->value, result);
+
+	free(p);
+}
+
+static int pending_result(TVoutCtl *ctl, const TVoutCtlPendingSet *p)
+{
+	const void *reply;
+	int error;
+
+	if (!ctl->conn)
+		return TVOUT_CTL_SET_OK;
+
+	if (xcb_connection_has_error(ctl->conn))
+		return TVOUT_CTL_SET_FAILED;
+
+	error = batch_error(&p->batch, 0);
+	if (error)
+		return error;
+
+	reply = batch_reply(&p->batch, 0);
+	if (reply && ctl->backend->reply_ok &&
+	    !ctl->backend->reply_ok(ctl->priv, p->attr, reply))
+		return TVOUT_CTL_SET_FAILED;
+
+	return TVOUT_CTL_SET_OK;
+}
+
+static bool pending_ready(TVoutCtl *ctl, TVoutCtlPendingSet *p)
+{
+	if (!ctl->conn)
+		return ctl->backend->set_done(ctl->priv, p->sequence);
+
+	return batch_poll(&p->batch);
+}
+
+/*
+ * Replies arrive in request order, so once we hit a set
+ * whose fence hasn't come back the rest can't have either.
+ * Only then are the deadlines worth looking at.
+ */
+static void process_pending(TVoutCtl *ctl)
+{
+	TVoutCtlPendingSet **pp = &ctl->pending;
+	uint64_t now;
+
+	if (!ctl->pending)
+		return;
+
+	while (*pp && pending_ready(ctl, *pp))
+		pending_complete(ctl, pp, pending_result(ctl, *pp));
+
+	now = ctl_monotonic_ns();
+
+	while (*pp) {
+		if ((*pp)->deadline && (*pp)->deadline <= now)
+			pending_complete(ctl, pp, TVOUT_CTL_SET_TIMEOUT);
+		else
+			pp = &(*pp)->next;
+	}
+}
+
+static void drop_pending(TVoutCtl *ctl)
+{
+	while (ctl->pending) {
+		TVoutCtlPendingSet *p = ctl->pending;
+
+		ctl->pending = p->next;
+		batch_clear(&p->batch);
+		free(p);
+	}
+}
+
+/* A direct set overrides whatever was left to coalesce. */
+static void coalesce_cancel(TVoutCtl *ctl, enum TVoutCtlAttr attr)
+{
+	if (attr >= 0 && attr < NUM_CTL_ATTRS)
+		ctl->coalesce[attr].pending = false;
+}
+
+/* All the sets to output 0 go through here. */
+static int backend_set(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value,
+		       unsigned int *sequence)
+{
+	int r = ctl->set(ctl->priv, attr, value, sequence);
+
+	USDT3(set_send, attr, value, r);
+
+	if (ctl->notify_ext && r > 0) {
+		ctl->self_pending |= 1 << attr;
+		ctl->self_values[attr] = value;
+	}
+
+	return r;
+}
+
+static int ctl_set_async(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value,
+			 int timeout_ms, TVoutCtlSetDone done, void *data)
+{
+	TVoutCtlPendingSet *p, **pp;
+	unsigned int sequence;
+	int r;
+
+	if (!ctl || ctl->status != 1)
+		return -1;
+
+	if (ctl->client) {
+		r = client_set_async(ctl, attr, value, timeout_ms, done, data);
+		batch_notify(ctl);
+		return r;
+	}
+
+	coalesce_cancel(ctl, attr);
+
+	p = calloc(1, sizeof *p);
+	if (!p)
+		return -1;
+
+	if (ctl->stats_enabled)
+		p->start = ctl_monotonic_ns();
+
+	r = backend_set(ctl, attr, value, &sequence);
+	if (r < 0) {
+		free(p);
+		return -1;
+	}
+
+	if (r == 0) {
+		free(p);
+		set_done(ctl, done, data, attr, value, TVOUT_CTL_SET_OK);
+		return 0;
+	}
+
+	p->attr = attr;
+	p->value = value;
+	p->done = done;
+	p->data = data;
+	p->sequence = sequence;
+	if (timeout_ms > 0)
+		p->deadline = ctl_monotonic_ns() + timeout_ms * 1000000ULL;
+
+	/*
+	 * The set request is checked so any error stays with us
+	 * instead of going to the Xlib error handler. The fence
+	 * has a reply, which tells us the set has been processed
+	 * even when it has no reply of its own.
+	 */
+	batch_init(&p->batch, ctl->conn);
+	if (ctl->conn &&
+	    (batch_add(&p->batch, sequence) < 0 ||
+	     batch_add(&p->batch, xcb_get_input_focus(ctl->conn).sequence) < 0)) {
+		batch_clear(&p->batch);
+		free(p);
+		return -1;
+	}
+
+	for (pp = &ctl->pending; *pp; pp = &(*pp)->next)
+		;
+	*pp = p;
+
+	if (p->deadline)
+		timer_update(ctl);
+
+	if (ctl->conn)
+		xcb_flush(ctl->conn);
+
+	return 0;
+}
+
+int tvout_ctl_set_async(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value,
+			int timeout_ms, TVoutCtlSetDone done, void *data)
+{
+	int r;
+
+	if (!ctl)
+		return -1;
+
+	USDT2(set_entry, attr, value);
+
+	api_lock(ctl);
+	r = ctl_set_async(ctl, attr, value, timeout_ms, done, data);
+	api_unlock(ctl);
+
+	return r;
+}
+
+static int ctl_set(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value)
+{
+	int r;
+
+	if (ctl->client)
+		return remote_set(ctl, PROTO_SET, attr, value);
+
+	if (ctl->status != 1)
+		return -1;
+
+	coalesce_cancel(ctl, attr);
+
+	r = backend_set(ctl, attr, value, NULL);
+	if (r < 0)
+		return -1;
+
+	/* FIXME are we sure to get a notification? */
+	if (r > 0)
+		process_events(ctl);
+
+	return 0;
+}
+
+int tvout_ctl_set(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value)
+{
+	int r;
+
+	if (!ctl)
+		return -1;
+
+	USDT2(set_entry, attr, value);
+
+	api_lock(ctl);
+	r = ctl_set(ctl, attr, value);
+	api_unlock(ctl);
+
+	return r;
+}
+
+static int ctl_set_many(TVoutCtl *ctl, const TVoutCtlAttrValue *values,
+			int num_values)
+{
+	bool sent = false;
+	int i;
+
+	if (ctl->client)
+		return remote_call(ctl, PROTO_SET_MANY, values, num_values, 0, 0);
+
+	if (ctl->status != 1)
+		return -1;
+
+	/* All or nothing */
+	for (i = 0; i < num_values; i++)
+		if (ctl->backend->check(ctl->priv, values[i].attr, values[i].value) < 0)
+			return -1;
+
+	for (i = 0; i < num_values; i++) {
+		coalesce_cancel(ctl, values[i].attr);
+
+		if (ctl->backend->check(ctl->priv, values[i].attr, values[i].value) <= 0)
+			continue;
+
+		if (backend_set(ctl, values[i].attr, values[i].value, NULL) > 0)
+			sent = true;
+	}
+
+	/* One flush and one drain for the lot. */
+	if (sent)
+		process_events(ctl);
+
+	return 0;
+}
+
+int tvout_ctl_set_many(TVoutCtl *ctl, const TVoutCtlAttrValue *values,
+		       int num_values)
+{
+	int r;
+
+	if (!ctl || num_values < 0 || (num_values > 0 && !values))
+		return -1;
+
+	api_lock(ctl);
+	r = ctl_set_many(ctl, values, num_values);
+	api_unlock(ctl);
+
+	return r;
+}
+
+/* Only these make sense to animate */
+static bool attr_smooth(enum TVoutCtlAttr attr)
+{
+	return attr == TVOUT_CTL_SCALE ||
+		attr == TVOUT_CTL_XOFFSET ||
+		attr == TVOUT_CTL_YOFFSET;
+}
+
+/*
+ * Sends the latest value of each coalesced attribute, or
+ * the next step towards it when smoothing, and schedules
+ * another flush if some target hasn't been reached yet.
+ */
+static void coalesce_flush(TVoutCtl *ctl)
+{
+	bool sent = false;
+	bool more = false;
+	int i;
+
+	for (i = 0; i < NUM_CTL_ATTRS; i++) {
+		TVoutCtlCoalesce *c = &ctl->coalesce[i];
+
+		if (!c->pending)
+			continue;
+
+		if (c->steps > 1) {
+			c->value += (c->target - c->value) / c->steps;
+			c->steps--;
+		} else {
+			c->value = c->target;
+			c->steps = 0;
+		}
+
+		c->pending = c->value != c->target;
+		if (c->pending)
+			more = true;
+
+		if (backend_set(ctl, i, c->value, NULL) > 0)
+			sent = true;
+	}
+
+	ctl->last_flush = ctl_monotonic_ns();
+	ctl->next_flush = more ? ctl->last_flush + ctl->pace_interval : 0;
+
+	if (sent && ctl->conn)
+		xcb_flush(ctl->conn);
+}
+
+static int ctl_set_coalesced(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value)
+{
+	TVoutCtlCoalesce *c;
+
+	if (ctl->client)
+		return remote_set(ctl, PROTO_SET_COALESCED, attr, value);
+
+	if (ctl->status != 1)
+		return -1;
+
+	/* Without a timer there's nothing to pace with. */
+	if (ctl->timer_fd < 0)
+		return ctl_set(ctl, attr, value);
+
+	if (ctl->backend->check(ctl->priv, attr, value) < 0)
+		return -1;
+
+	c = &ctl->coalesce[attr];
+
+	/* Mid-animation we carry on from the last value sent. */
+	if (!c->pending)
+		c->value = ctl->get(ctl->priv, attr);
+	c->target = value;
+	c->steps = attr_smooth(attr) ? ctl->smooth_steps : 0;
+	c->pending = true;
+
+	if (ctl->next_flush)
+		return 0;
+
+	/* The first change after a quiet period goes out right away. */
+	if (ctl_monotonic_ns() - ctl->last_flush >= ctl->pace_interval)
+		coalesce_flush(ctl);
+	else
+		ctl->next_flush = ctl->last_flush + ctl->pace_interval;
+
+	timer_update(ctl);
+
+	return 0;
+}
+
+int tvout_ctl_set_coalesced(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value)
+{
+	int r;
+
+	if (!ctl || attr < 0 || attr >= NUM_CTL_ATTRS)
+		return -1;
+
+	api_lock(ctl);
+	r = ctl_set_coalesced(ctl, attr, value);
+	api_unlock(ctl);
+
+	return r;
+}
+
+int tvout_ctl_set_pacing(TVoutCtl *ctl, int interval_ms, int smooth_steps)
+{
+	if (!ctl || interval_ms <= 0 || smooth_steps < 0)
+		return -1;
+
+	/* The daemon's pacing applies to all of its clients. */
+	if (ctl->client)
+		return remote_call(ctl, PROTO_SET_PACING, NULL, 0,
+				   interval_ms, smooth_steps) < 0 ? -1 : 0;
+
+	api_lock(ctl);
+	ctl->pace_interval = interval_ms * 1000000ULL;
+	ctl->smooth_steps = smooth_steps;
+	api_unlock(ctl);
+
+	return 0;
+}
+
+/*
+ * The getters only look at the snapshot, so they can be
+ * called from any thread without taking any locks.
+ */
+int tvout_ctl_get(TVoutCtl *ctl, enum TVoutCtlAttr attr)
+{
+	if (!ctl || attr < 0 || attr >= TVOUT_CTL_NUM_ATTRS)
+		return -1;
+
+	return snapshot_get(ctl->view, attr);
+}
+
+static int ctl_num_outputs(TVoutCtl *ctl)
+{
+	if (ctl->status != 1)
+		return 0;
+
+	/* tvout-ctld only publishes the primary output. */
+	if (ctl->client)
+		return 1;
+
+	if (!ctl->backend->num_outputs)
+		return 1;
+
+	return ctl->backend->num_outputs(ctl->priv);
+}
+
+int tvout_ctl_num_outputs(TVoutCtl *ctl)
+{
+	int r;
+
+	if (!ctl)
+		return 0;
+
+	api_lock(ctl);
+	r = ctl_num_outputs(ctl);
+	api_unlock(ctl);
+
+	return r;
+}
+
+/* The handle is ready and never goes back, so no lock is needed. */
+const char *tvout_ctl_output_name(TVoutCtl *ctl, int output)
+{
+	if (!ctl || output < 0 || output >= tvout_ctl_num_outputs(ctl) ||
+	    !ctl->backend || !ctl->backend->output_name)
+		return NULL;
+
+	return ctl->backend->output_name(ctl->priv, output);
+}
+
+static int ctl_set_output(TVoutCtl *ctl, int output,
+			  enum TVoutCtlAttr attr, int value)
+{
+	int r;
+
+	if (output < 0 || output >= ctl_num_outputs(ctl))
+		return -1;
+
+	if (output == 0)
+		return ctl_set(ctl, attr, value);
+
+	r = ctl->backend->set_output(ctl->priv, output, attr, value);
+	if (r < 0)
+		return -1;
+
+	if (r > 0)
+		process_events(ctl);
+
+	return 0;
+}
+
+int tvout_ctl_set_output(TVoutCtl *ctl, int output,
+			 enum TVoutCtlAttr attr, int value)
+{
+	int r;
+
+	if (!ctl)
+		return -1;
+
+	api_lock(ctl);
+	r = ctl_set_output(ctl, output, attr, value);
+	api_unlock(ctl);
+
+	return r;
+}
+
+int tvout_ctl_get_output(TVoutCtl *ctl, int output, enum TVoutCtlAttr attr)
+{
+	int r = -1;
+
+	if (!ctl)
+		return -1;
+
+	if (output == 0 || attr == TVOUT_CTL_READY)
+		return tvout_ctl_get(ctl, attr);
+
+	if (attr < 0 || attr >= NUM_CTL_ATTRS)
+		return -1;
+
+	api_lock(ctl);
+	if (output > 0 && output < ctl_num_outputs(ctl))
+		r = ctl->backend->get_output(ctl->priv, output, attr);
+	api_unlock(ctl);
+
+	return r;
+}
+
+int tvout_ctl_enable_stats(TVoutCtl *ctl, int enable)
+{
+	if (!ctl || ctl->client)
+		return -1;
+
+	api_lock(ctl);
+	ctl->stats_enabled = enable;
+	api_unlock(ctl);
+
+	return 0;
+}
+
+int tvout_ctl_get_stats(TVoutCtl *ctl, TVoutCtlStats *stats)
+{
+	if (!ctl || !stats || ctl->client)
+		return -1;
+
+	api_lock(ctl);
+	*stats = ctl->stats;
+	api_unlock(ctl);
+
+	return 0;
+}
+
+int tvout_ctl_reset_stats(TVoutCtl *ctl)
+{
+	if (!ctl || ctl->client)
+		return -1;
+
+	api_lock(ctl);
+	memset(&ctl->stats, 0, sizeof ctl->stats);
+	api_unlock(ctl);
+
+	return 0;
+}
+
+int tvout_ctl_get_state(TVoutCtl *ctl, TVoutCtlState *state)
+{
+	if (!ctl || !state)
+		return -1;
+
+	snapshot_read(ctl->view, state);
+
+	return 0;
+}
+
+int tvout_ctl_fd(TVoutCtl *ctl)
+{
+	if (!ctl)
+		return -1;
+
+	if (ctl->thread)
+		return ctl->thread->wake_fd;
+
+	if (ctl->client)
+		return ctl->client->fd;
+
+	return ctl_event_fd(ctl);
+}
+
+int ctl_event_fd(TVoutCtl *ctl)
+{
+	const TVoutCtlCandidate *c = &ctl->candidates[0];
+
+	if (ctl->dpy)
+		return ConnectionNumber(ctl->dpy);
+
+	if (ctl->backend)
+		return ctl->backend->fd(ctl->priv);
+
+	/* Still probing */
+	return ctl->num_candidates ? c->backend->fd(c->priv) : -1;
+}
+
+/* The event thread looks after the timer itself. */
+int tvout_ctl_timer_fd(TVoutCtl *ctl)
+{
+	if (!ctl || ctl->thread)
+		return -1;
+
+	return ctl->timer_fd;
+}
+
+/* Returns true if there's work left. */
+static bool ctl_dispatch_budget(TVoutCtl *ctl, int max_events,
+				uint64_t deadline)
+{
+	uint64_t expirations;
+
+	/* Only clears the readiness, the deadlines are checked later. */
+	if (ctl->timer_fd >= 0)
+		while (read(ctl->timer_fd, &expirations, sizeof expirations) > 0)
+			;
+
+	switch (ctl->status) {
+	case 1:
+		process_events_budget(ctl, max_events, deadline);
+		process_pending(ctl);
+		if (ctl->next_flush && ctl->next_flush <= ctl_monotonic_ns())
+			coalesce_flush(ctl);
+		timer_update(ctl);
+		return ctl_needs_dispatch(ctl);
+	case -1:
+		break;
+	default:
+		probe_step(ctl, false);
+
+		if (ctl->status == 0) {
+			if (ctl->conn)
+				xcb_flush(ctl->conn);
+			break;
+		}
+
+		if (ctl->status == 1)
+			process_events(ctl);
+
+		ctl_notify(ctl, TVOUT_CTL_READY, ctl->status);
+		batch_notify(ctl);
+		break;
+	}
+
+	return false;
+}
+
+void ctl_dispatch(TVoutCtl *ctl)
+{
+	ctl_dispatch_budget(ctl, 0, 0);
+}
+
+/*
+ * Runs the callbacks for whatever the event thread queued up,
+ * at most max_events of them if that's > 0. Returns true if
+ * some were left.
+ */
+static bool thread_dispatch(TVoutCtl *ctl, int max_events)
+{
+	unsigned long callbacks = 0;
+	unsigned int changed = 0;
+	TVoutCtlState state;
+	ThreadEvent ev;
+	int n = 0;
+
+	thread_ack(ctl);
+
+	while ((max_events <= 0 || n++ < max_events) &&
+	       thread_pop(ctl, &ev)) {
+		switch (ev.type) {
+		case THREAD_EVENT_NOTIFY:
+			USDT3(notify_entry, ev.output, ev.attr, ev.value);
+			if (ev.output == 0) {
+				changed |= 1 << ev.attr;
+				if (ctl->ui_notify) {
+					ctl->ui_notify(ctl->ui_data, ev.attr, ev.value);
+					callbacks++;
+				}
+			}
+			if (ctl->output_notify) {
+				ctl->output_notify(ctl->ui_data, ev.output,
+						   ev.attr, ev.value);
+				callbacks++;
+			}
+			if (ctl->notify_ext) {
+				call_notify_ext(ctl, ev.output, ev.attr, ev.value,
+						ev.received, ev.server_time,
+						ev.origin);
+				callbacks++;
+			}
+			USDT3(notify_return, ev.output, ev.attr, ev.value);
+			break;
+		case THREAD_EVENT_SET_DONE:
+			ev.done(ev.data, ev.attr, ev.value, ev.result);
+			callbacks++;
+			break;
+		}
+	}
+
+	if (changed && ctl->batch_notify) {
+		snapshot_read(ctl->view, &state);
+
+		ctl->batch_notify(ctl->ui_data, changed, &state);
+		callbacks++;
+	}
+
+	/*
+	 * The counters, and whether they're enabled, belong to the
+	 * event thread.
+	 */
+	if (callbacks) {
+		thread_lock(ctl);
+		if (ctl->stats_enabled)
+			ctl->stats.callbacks += callbacks;
+		thread_unlock(ctl);
+	}
+
+	return thread_pending(ctl);
+}
+
+/*
+ * Without the daemon the handle is useless. The application
+ * finds out from TVOUT_CTL_READY going to -1.
+ */
+static void client_lost(TVoutCtl *ctl)
+{
+	ctl->status = -1;
+	snapshot_update(ctl);
+	ctl->view = &ctl->snapshot;
+
+	ctl_notify(ctl, TVOUT_CTL_READY, ctl->status);
+}
+
+static bool client_ready(TVoutCtl *ctl, int max_events)
+{
+	int r;
+
+	if (ctl->status != 1)
+		return false;
+
+	r = client_dispatch(ctl, max_events);
+	if (r < 0)
+		client_lost(ctl);
+
+	batch_notify(ctl);
+
+	return r > 0;
+}
+
+void tvout_ctl_fd_ready(TVoutCtl *ctl)
+{
+	tvout_ctl_fd_ready_budget(ctl, 0, 0);
+}
+
+int tvout_ctl_fd_ready_budget(TVoutCtl *ctl, int max_events, int max_us)
+{
+	uint64_t deadline = 0;
+
+	if (!ctl)
+		return 0;
+
+	if (ctl->thread)
+		return thread_dispatch(ctl, max_events);
+
+	if (ctl->client)
+		return client_ready(ctl, max_events);
+
+	if (max_us > 0)
+		deadline = ctl_monotonic_ns() + max_us * 1000ULL;
+
+	return ctl_dispatch_budget(ctl, max_events, deadline);
+}
+
+/*
+ * Xlib and XCB may already have read events and replies off
+ * the socket, for instance while tvout_ctl_set() was draining
+ * the queue. The fd won't become readable for those, so this
+ * has to be checked before going to sleep.
+ */
+bool ctl_needs_dispatch(TVoutCtl *ctl)
+{
+	if (ctl->status != 1)
+		return false;
+
+	if (ctl->filtered)
+		return true;
+
+	if (ctl->dpy && !ctl->shared &&
+	    XEventsQueued(ctl->dpy, QueuedAfterReading) > 0)
+		return true;
+
+	if (ctl->pending && pending_ready(ctl, ctl->pending))
+		return true;
+
+	if (ctl->backend->needs_dispatch &&
+	    ctl->backend->needs_dispatch(ctl->priv))
+		return true;
+
+	return ctl->next_flush && ctl->next_flush <= ctl_monotonic_ns();
+}
+
+int tvout_ctl_needs_dispatch(TVoutCtl *ctl)
+{
+	if (!ctl)
+		return 0;
+
+	if (ctl->thread)
+		return thread_pending(ctl);
+
+	if (ctl->client)
+		return ctl->status == 1 && client_pending(ctl);
+
+	return ctl_needs_dispatch(ctl);
+}
+
+void tvout_ctl_dispatch_pending(TVoutCtl *ctl)
+{
+	tvout_ctl_fd_ready(ctl);
+}
+
+/*
+ * The follow-up work is left to the next tvout_ctl_fd_ready(),
+ * so that a burst of events is handled in one go.
+ */
+int tvout_ctl_filter_event(TVoutCtl *ctl, const XEvent *e)
+{
+	int r = 0;
+
+	if (!ctl || !e || ctl->client)
+		return 0;
+
+	api_lock(ctl);
+
+	if (ctl->status == 1 && !ctl->event_time && ctl_timing(ctl))
+		ctl->event_time = ctl_monotonic_ns();
+
+	if (ctl->status == 1 && ctl->handle_event(ctl->priv, e)) {
+		CTL_STATS_INC(ctl, events);
+		ctl->filtered = true;
+		r = 1;
+	}
+
+	api_unlock(ctl);
+
+	return r;
+}
+
+/*
+ * A shared Display stays open, but whatever we queued up on it
+ * has to go out since the application may not flush for a while.
+ */
+static void close_display(TVoutCtl *ctl)
+{
+	if (!ctl->dpy)
+		return;
+
+	if (ctl->shared)
+		xcb_flush(ctl->conn);
+	else
+		XCloseDisplay(ctl->dpy);
+}
+
+/*
+ * tvout-ctld itself, applications sharing their Display and the
+ * event thread all want the X connection. The daemon has nothing
+ * to offer to a standalone backend.
+ */
+static bool use_daemon(const TVoutCtlConfig *config)
+{
+	return !config->display && !standalone() &&
+		!(config->flags & (TVOUT_CTL_INIT_THREAD |
+				   TVOUT_CTL_INIT_NO_DAEMON));
+}
+
+static void set_callbacks(TVoutCtl *ctl, const TVoutCtlConfig *config)
+{
+	ctl->ui_notify = config->ui_notify;
+	ctl->batch_notify = config->batch_notify;
+	ctl->output_notify = config->output_notify;
+	ctl->notify_ext = config->notify_ext;
+	ctl->ui_data = config->ui_data;
+}
+
+TVoutCtl *tvout_ctl_init_config(const TVoutCtlConfig *config)
+{
+	TVoutCtl *ctl;
+
+	if (!config)
+		return NULL;
+
+	/* The thread would race with the application's Xlib calls. */
+	if (config->display && config->flags & TVOUT_CTL_INIT_THREAD)
+		return NULL;
+
+	ctl = calloc(1, sizeof *ctl);
+	if (!ctl)
+		return NULL;
+
+	ctl->view = &ctl->snapshot;
+	snapshot_update(ctl);
+
+	if (use_daemon(config) &&
+	    client_start(ctl, config->flags & TVOUT_CTL_INIT_ASYNC)) {
+		ctl->status = 1;
+		ctl->timer_fd = -1;
+		set_callbacks(ctl, config);
+		return ctl;
+	}
+
+	ctl->init_time = ctl_monotonic_ns();
+	ctl->stats_enabled = config->flags & TVOUT_CTL_INIT_STATS;
+
+	USDT(init_start);
+
+	if (config->display) {
+		ctl->dpy = config->display;
+		ctl->shared = true;
+	} else if (!standalone()) {
+		ctl->dpy = XOpenDisplay(NULL);
+		if (!ctl->dpy) {
+			free(ctl);
+			return NULL;
+		}
+	}
+
+	if (ctl->dpy)
+		ctl->conn = XGetXCBConnection(ctl->dpy);
+
+	USDT1(display_open, ctl->shared);
+
+	ctl->pace_interval = DEFAULT_PACE_INTERVAL;
+
+	/*
+	 * Only needed for set deadlines and coalescing,
+	 * so failure isn't fatal.
+	 */
+	ctl->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				       TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (!probe_start(ctl)) {
+		if (ctl->timer_fd >= 0)
+			close(ctl->timer_fd);
+		close_display(ctl);
+		free(ctl);
+		return NULL;
+	}
+
+	USDT1(probe_start, ctl->num_candidates);
+
+	if (config->flags & TVOUT_CTL_INIT_ASYNC) {
+		if (ctl->conn)
+			xcb_flush(ctl->conn);
+	} else {
+		if (!probe_wait(ctl)) {
+			batch_clear(&ctl->exts);
+			drop_candidates(ctl);
+			if (ctl->timer_fd >= 0)
+				close(ctl->timer_fd);
+			close_display(ctl);
+			free(ctl);
+			return NULL;
+		}
+
+		process_events(ctl);
+	}
+
+	/* Nobody was listening yet */
+	ctl->changed = 0;
+
+	set_callbacks(ctl, config);
+
+	if (config->flags & TVOUT_CTL_INIT_THREAD &&
+	    !thread_start(ctl)) {
+		tvout_ctl_exit(ctl);
+		return NULL;
+	}
+
+	USDT1(init_done, ctl->status);
+
+	return ctl;
+}
+
+TVoutCtl *tvout_ctl_init(TVoutCtlNotify ui_notify, void *ui_data)
+{
+	TVoutCtlConfig config = {
+		.ui_notify = ui_notify,
+		.ui_data = ui_data,
+	};
+
+	return tvout_ctl_init_config(&config);
+}
+
+TVoutCtl *tvout_ctl_init_async(TVoutCtlNotify ui_notify, void *ui_data)
+{
+	TVoutCtlConfig config = {
+		.ui_notify = ui_notify,
+		.ui_data = ui_data,
+		.flags = TVOUT_CTL_INIT_ASYNC,
+	};
+
+	return tvout_ctl_init_config(&config);
+}
+
+TVoutCtl *tvout_ctl_init_with_display(Display *dpy, TVoutCtlNotify ui_notify,
+				      void *ui_data)
+{
+	TVoutCtlConfig config = {
+		.ui_notify = ui_notify,
+		.ui_data = ui_data,
+		.display = dpy,
+	};
+
+	if (!dpy)
+		return NULL;
+
+	return tvout_ctl_init_config(&config);
+}
+
+void tvout_ctl_exit(TVoutCtl *ctl)
+{
+	if (!ctl)
+		return;
+
+	if (ctl->client) {
+		client_stop(ctl);
+		free(ctl);
+		return;
+	}
+
+	if (ctl->thread)
+		thread_stop(ctl);
+
+	drop_pending(ctl);
+	batch_clear(&ctl->exts);
+	drop_candidates(ctl);
+	if (ctl->backend)
+		ctl->backend->exit(ctl->priv);
+	if (ctl->timer_fd >= 0)
+		close(ctl->timer_fd);
+	close_display(ctl);
+	free(ctl);
+}
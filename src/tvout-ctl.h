@@ -20,12 +20,18 @@
 #ifndef TVOUT_CTL_H
 #define TVOUT_CTL_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef struct _TVoutCtl TVoutCtl;
 
+/* Same as Xlib's, without having to include Xlib.h */
+struct _XDisplay;
+union _XEvent;
+
 enum TVoutCtlAttr {
 	TVOUT_CTL_ENABLE,
 	TVOUT_CTL_TV_STD,
@@ -35,20 +41,325 @@ enum TVoutCtlAttr {
 	TVOUT_CTL_XOFFSET,
 	TVOUT_CTL_YOFFSET,
 	TVOUT_CTL_FULLSCREEN_VIDEO,
+	TVOUT_CTL_READY,
+	TVOUT_CTL_NUM_ATTRS,
 };
 
+/* Values of all the attributes at the same point in time */
+typedef struct {
+	int values[TVOUT_CTL_NUM_ATTRS];
+} TVoutCtlState;
+
+typedef struct {
+	enum TVoutCtlAttr attr;
+	int value;
+} TVoutCtlAttrValue;
+
 typedef void (*TVoutCtlNotify)(void *ui_data, enum TVoutCtlAttr attr, int value);
 
+/* Like TVoutCtlNotify, but for any output. See tvout_ctl_num_outputs(). */
+typedef void (*TVoutCtlOutputNotify)(void *ui_data, int output,
+				     enum TVoutCtlAttr attr, int value);
+
+enum TVoutCtlOrigin {
+	/* Outputs other than 0, and clients of tvout-ctld */
+	TVOUT_CTL_ORIGIN_UNKNOWN,
+	/* Confirms a set made through this handle */
+	TVOUT_CTL_ORIGIN_SELF,
+	/* Someone else changed it */
+	TVOUT_CTL_ORIGIN_EXTERNAL,
+};
+
+typedef struct {
+	int output;
+	enum TVoutCtlAttr attr;
+	int value;
+	/* X server time of the event in ms, 0 if unknown */
+	unsigned long server_time;
+	/*
+	 * CLOCK_MONOTONIC in ns when the event was read off the
+	 * connection, 0 if unknown. For changes that have to be
+	 * read back from the server, it's the time of the event
+	 * that started that, so the round trip is included.
+	 */
+	uint64_t received;
+	enum TVoutCtlOrigin origin;
+} TVoutCtlNotifyInfo;
+
+/* Like TVoutCtlOutputNotify, with the details of the change */
+typedef void (*TVoutCtlNotifyExt)(void *ui_data,
+				  const TVoutCtlNotifyInfo *info);
+
+/*
+ * changed has bit (1 << attr) set for each attribute that
+ * changed since the previous call.
+ */
+typedef void (*TVoutCtlBatchNotify)(void *ui_data, unsigned int changed,
+				    const TVoutCtlState *state);
+
+/* Positive results are X error codes (BadValue etc.) */
+enum TVoutCtlSetResult {
+	TVOUT_CTL_SET_OK = 0,
+	TVOUT_CTL_SET_FAILED = -1,
+	TVOUT_CTL_SET_TIMEOUT = -2,
+};
+
+typedef void (*TVoutCtlSetDone)(void *data, enum TVoutCtlAttr attr,
+				int value, int result);
+
 TVoutCtl *tvout_ctl_init(TVoutCtlNotify ui_notify, void *ui_data);
 
+enum {
+	/* Like tvout_ctl_init_async() */
+	TVOUT_CTL_INIT_ASYNC = 1 << 0,
+	/*
+	 * The X connection is handled by a thread of the library's
+	 * own. tvout_ctl_fd() then becomes readable when there are
+	 * callbacks to run, and tvout_ctl_fd_ready() runs them in
+	 * the calling thread. tvout_ctl_timer_fd() isn't needed.
+	 */
+	TVOUT_CTL_INIT_THREAD = 1 << 1,
+	/*
+	 * Normally, if tvout-ctld is running for the display, the
+	 * handle becomes its client instead of talking to the X
+	 * server. The getters then read the daemon's shared state
+	 * without any syscalls, and tvout_ctl_fd() is the daemon
+	 * socket. A daemon that has no room for another client is
+	 * passed over like a missing one. If the daemon goes away
+	 * TVOUT_CTL_READY is notified with -1, and a new handle is
+	 * needed. This flag makes the handle talk to the X server
+	 * directly, as do a shared Display and TVOUT_CTL_INIT_THREAD.
+	 */
+	TVOUT_CTL_INIT_NO_DAEMON = 1 << 2,
+	/* Collect statistics from the start, see tvout_ctl_get_stats() */
+	TVOUT_CTL_INIT_STATS = 1 << 3,
+};
+
+typedef struct {
+	/* Called for every change, can be NULL */
+	TVoutCtlNotify ui_notify;
+	/*
+	 * Called at most once per tvout_ctl_fd_ready() with
+	 * everything that changed meanwhile, can be NULL.
+	 */
+	TVoutCtlBatchNotify batch_notify;
+	/*
+	 * Called for every change on every output, including the
+	 * ones on output 0 that ui_notify gets as well. Can be NULL.
+	 */
+	TVoutCtlOutputNotify output_notify;
+	void *ui_data;
+	unsigned int flags;
+	/*
+	 * The application's own X connection, NULL to open one.
+	 * See tvout_ctl_init_with_display(). Can't be combined
+	 * with TVOUT_CTL_INIT_THREAD.
+	 */
+	struct _XDisplay *display;
+	/*
+	 * Called for every change on every output, after the
+	 * other callbacks. Can be NULL.
+	 */
+	TVoutCtlNotifyExt notify_ext;
+} TVoutCtlConfig;
+
+TVoutCtl *tvout_ctl_init_config(const TVoutCtlConfig *config);
+
+/*
+ * Only connects to the X server and leaves the rest of the
+ * probing to tvout_ctl_fd_ready(). TVOUT_CTL_READY is notified
+ * with 1 once the handle is usable, or with -1 if probing
+ * failed. Until then tvout_ctl_set() and tvout_ctl_get() fail
+ * with -1, except for tvout_ctl_get(TVOUT_CTL_READY) which
+ * returns 0 while probing is still in progress.
+ */
+TVoutCtl *tvout_ctl_init_async(TVoutCtlNotify ui_notify, void *ui_data);
+
+/*
+ * Uses the application's X connection instead of opening one.
+ * The library then never reads events from it, and never closes
+ * it. The application has to pass every event it gets to
+ * tvout_ctl_filter_event(), and still call tvout_ctl_fd_ready()
+ * when tvout_ctl_fd() becomes readable or tvout_ctl_needs_dispatch()
+ * says so. The Display must stay open until tvout_ctl_exit().
+ */
+TVoutCtl *tvout_ctl_init_with_display(struct _XDisplay *dpy,
+				      TVoutCtlNotify ui_notify, void *ui_data);
+
+/*
+ * Returns 1 if the event was meant for the library. The
+ * application can handle it as well, for instance when it
+ * follows RandR screen changes itself.
+ */
+int tvout_ctl_filter_event(TVoutCtl *ctl, const union _XEvent *e);
+
 void tvout_ctl_exit(TVoutCtl *ctl);
 
 int tvout_ctl_fd(TVoutCtl *ctl);
 void tvout_ctl_fd_ready(TVoutCtl *ctl);
 
+/*
+ * Like tvout_ctl_fd_ready() but handles at most max_events
+ * events and stops after max_us microseconds, 0 meaning no
+ * limit. Returns 1 if work was left over, in which case it
+ * should be called again soon, for example from an idle
+ * callback, since the fd may not become readable again.
+ */
+int tvout_ctl_fd_ready_budget(TVoutCtl *ctl, int max_events, int max_us);
+
+/*
+ * Becomes readable when a tvout_ctl_set_async() deadline
+ * expires or coalesced values are due to be sent. Call
+ * tvout_ctl_fd_ready() then as well. Returns -1 if timers
+ * are not supported.
+ */
+int tvout_ctl_timer_fd(TVoutCtl *ctl);
+
+/*
+ * Returns 1 if there is work to do that won't make the fds
+ * readable, because Xlib or XCB have already read it off the
+ * socket. Main loops should check this before they go to sleep
+ * and call tvout_ctl_dispatch_pending() if it returns 1. See
+ * tvout-ctl-glib.h and tvout-ctl-epoll.h for ready-made
+ * adapters.
+ */
+int tvout_ctl_needs_dispatch(TVoutCtl *ctl);
+
+/* Same as tvout_ctl_fd_ready() */
+void tvout_ctl_dispatch_pending(TVoutCtl *ctl);
+
 int tvout_ctl_set(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value);
+/*
+ * The getters never block and never touch the X connection,
+ * so they can be called from any thread, even while another
+ * thread is in tvout_ctl_fd_ready().
+ */
 int tvout_ctl_get(TVoutCtl *ctl, enum TVoutCtlAttr attr);
 
+/* All the values at once, consistent with each other */
+int tvout_ctl_get_state(TVoutCtl *ctl, TVoutCtlState *state);
+
+/*
+ * Sends the change without waiting for anything. done is
+ * called from tvout_ctl_fd_ready() once the server has
+ * processed the request, with TVOUT_CTL_SET_OK or the X error
+ * it caused. Errors don't go through the Xlib error handler.
+ * If timeout_ms > 0 and the server hasn't answered by then,
+ * done gets TVOUT_CTL_SET_TIMEOUT instead. If the value is
+ * already current done gets TVOUT_CTL_SET_OK right away, which
+ * means before this returns, except with TVOUT_CTL_INIT_THREAD
+ * and for clients of tvout-ctld where it's queued for the next
+ * tvout_ctl_fd_ready() like any other result. Sets still
+ * pending at tvout_ctl_exit() time are dropped silently.
+ * Returns -1 if the value is invalid, 0 otherwise.
+ */
+int tvout_ctl_set_async(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value,
+			int timeout_ms, TVoutCtlSetDone done, void *data);
+
+/*
+ * For slider drags. Only the latest value of each attribute is
+ * kept, and the values are sent at most once per pacing interval
+ * from tvout_ctl_fd_ready(). Falls back to tvout_ctl_set() if
+ * tvout_ctl_timer_fd() isn't available.
+ */
+int tvout_ctl_set_coalesced(TVoutCtl *ctl, enum TVoutCtlAttr attr, int value);
+
+/*
+ * Sets the minimum time between coalesced flushes, 40 ms by
+ * default. With smooth_steps > 0 scale and offsets move to a new
+ * value over that many flushes instead of jumping straight to it.
+ */
+int tvout_ctl_set_pacing(TVoutCtl *ctl, int interval_ms, int smooth_steps);
+
+/*
+ * Sets several attributes at once. Either all the values are
+ * valid or nothing is changed and -1 is returned. Only the
+ * attributes whose value actually changes are sent to the
+ * server, and the requests are flushed together.
+ */
+int tvout_ctl_set_many(TVoutCtl *ctl, const TVoutCtlAttrValue *values,
+		       int num_values);
+
+/*
+ * A handle can drive several TV outputs. Output 0 is the one
+ * all the other calls work on, and the only one whose changes
+ * go to the ui_notify and batch_notify callbacks. Returns 0
+ * until the handle is ready.
+ */
+int tvout_ctl_num_outputs(TVoutCtl *ctl);
+
+/* The output's name, NULL if the backend doesn't name them */
+const char *tvout_ctl_output_name(TVoutCtl *ctl, int output);
+
+/* Like tvout_ctl_set() and tvout_ctl_get() for any output */
+int tvout_ctl_set_output(TVoutCtl *ctl, int output,
+			 enum TVoutCtlAttr attr, int value);
+/*
+ * Only output 0 is served from the snapshot. The others take
+ * the handle lock when the event thread is in use.
+ */
+int tvout_ctl_get_output(TVoutCtl *ctl, int output, enum TVoutCtlAttr attr);
+
+enum TVoutCtlHist {
+	/* tvout_ctl_init() until the handle is ready */
+	TVOUT_CTL_HIST_INIT,
+	/* tvout_ctl_set_async() until the server has answered */
+	TVOUT_CTL_HIST_SET_CONFIRM,
+	/*
+	 * An event read off the connection until the callbacks for
+	 * the change it caused, or until they are queued up for
+	 * tvout_ctl_fd_ready() with TVOUT_CTL_INIT_THREAD.
+	 */
+	TVOUT_CTL_HIST_EVENT_NOTIFY,
+	/*
+	 * A set of TVOUT_CTL_ENABLE to 1 until the output shows up
+	 * as enabled. Only the RandR backend measures this.
+	 */
+	TVOUT_CTL_HIST_ENABLE,
+	TVOUT_CTL_NUM_HISTS,
+};
+
+/*
+ * Bucket 0 counts latencies below 1 us, bucket n those of
+ * [2^(n-1), 2^n) us. The last one takes everything longer.
+ */
+#define TVOUT_CTL_HIST_BUCKETS 32
+
+typedef struct {
+	/* X round trips made after init, by what they were for */
+	unsigned long property_round_trips;
+	unsigned long attribute_round_trips;
+	unsigned long resource_round_trips;
+	/*
+	 * Round trips tvout_ctl_init() waited for while probing, with
+	 * TVOUT_CTL_INIT_STATS. Opening the display isn't included.
+	 */
+	unsigned long init_round_trips;
+	/* Times the event queue was drained, and events read */
+	unsigned long drains;
+	unsigned long events;
+	/*
+	 * Notifies whose value could not be trusted, and had to be
+	 * checked with one of the round trips above
+	 */
+	unsigned long checked_notifies;
+	/* Sets of the value the attribute already had */
+	unsigned long redundant_sets;
+	/* Calls to the notify and set done callbacks */
+	unsigned long callbacks;
+	unsigned long hist[TVOUT_CTL_NUM_HISTS][TVOUT_CTL_HIST_BUCKETS];
+} TVoutCtlStats;
+
+/*
+ * Statistics are only collected while enabled, which they are
+ * not by default. Disabling them keeps what was collected so far.
+ * Clients of tvout-ctld have no statistics of their own, so these
+ * return -1 for them.
+ */
+int tvout_ctl_enable_stats(TVoutCtl *ctl, int enable);
+int tvout_ctl_get_stats(TVoutCtl *ctl, TVoutCtlStats *stats);
+int tvout_ctl_reset_stats(TVoutCtl *ctl);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,500 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * tvout-ctld owns the one X connection and the probe for all the
+ * processes on the display that use the library. The state goes
+ * to a page the clients map, and set requests come in over a Unix
+ * socket. See tvout-ctl-proto.h.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "tvout-ctl.h"
+#include "tvout-ctl-proto.h"
+
+#define MAX_CLIENTS 32
+
+typedef struct {
+	int fd;
+	unsigned int id;
+	/* Dropped once we're done looking at the clients */
+	bool dead;
+} Client;
+
+typedef struct {
+	TVoutCtl *ctl;
+	ProtoPage *page;
+	int listen_fd;
+	Client clients[MAX_CLIENTS];
+	int num_clients;
+	unsigned int next_id;
+	char sock_path[PATH_MAX];
+	char page_path[PATH_MAX];
+} Daemon;
+
+/* Who a tvout_ctl_set_async() was for */
+typedef struct {
+	Daemon *d;
+	unsigned int client_id;
+	uint32_t serial;
+} SetData;
+
+static volatile sig_atomic_t quit;
+
+static void handle_signal(int sig)
+{
+	(void) sig;
+
+	quit = 1;
+}
+
+static Client *find_client(Daemon *d, unsigned int id)
+{
+	int i;
+
+	for (i = 0; i < d->num_clients; i++)
+		if (d->clients[i].id == id && !d->clients[i].dead)
+			return &d->clients[i];
+
+	return NULL;
+}
+
+/* A client that can't keep up is dropped rather than waited for. */
+static void send_msg(Client *c, const ProtoMsg *msg)
+{
+	ssize_t r;
+
+	if (c->dead)
+		return;
+
+	do {
+		r = send(c->fd, msg, sizeof *msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	} while (r < 0 && errno == EINTR);
+
+	if (r != sizeof *msg)
+		c->dead = true;
+}
+
+static void sweep_clients(Daemon *d)
+{
+	int i;
+
+	for (i = d->num_clients - 1; i >= 0; i--) {
+		if (!d->clients[i].dead)
+			continue;
+
+		close(d->clients[i].fd);
+		d->clients[i] = d->clients[--d->num_clients];
+	}
+}
+
+/* The page is written before the clients hear about the change. */
+static void publish(void *data, unsigned int changed,
+		    const TVoutCtlState *state)
+{
+	Daemon *d = data;
+	ProtoMsg msg;
+	int i;
+
+	snapshot_write(&d->page->snapshot, state, 0, 0);
+
+	memset(&msg, 0, sizeof msg);
+	msg.type = PROTO_NOTIFY;
+
+	for (i = 0; i < TVOUT_CTL_NUM_ATTRS; i++) {
+		if (!(changed & (1 << i)))
+			continue;
+
+		msg.values[msg.num_values].attr = i;
+		msg.values[msg.num_values].value = state->values[i];
+		msg.num_values++;
+	}
+
+	for (i = 0; i < d->num_clients; i++)
+		send_msg(&d->clients[i], &msg);
+}
+
+static void set_done(void *data, enum TVoutCtlAttr attr, int value, int result)
+{
+	SetData *sd = data;
+	Client *c;
+	ProtoMsg msg;
+
+	c = find_client(sd->d, sd->client_id);
+	if (c) {
+		memset(&msg, 0, sizeof msg);
+		msg.type = PROTO_SET_DONE;
+		msg.serial = sd->serial;
+		msg.result = result;
+		msg.num_values = 1;
+		msg.values[0].attr = attr;
+		msg.values[0].value = value;
+
+		send_msg(c, &msg);
+	}
+
+	free(sd);
+}
+
+static int set_async(Daemon *d, const Client *c, const ProtoMsg *msg)
+{
+	SetData *sd;
+	int r;
+
+	if (msg->num_values != 1)
+		return -1;
+
+	sd = malloc(sizeof *sd);
+	if (!sd)
+		return -1;
+
+	sd->d = d;
+	sd->client_id = c->id;
+	sd->serial = msg->serial;
+
+	r = tvout_ctl_set_async(d->ctl, msg->values[0].attr, msg->values[0].value,
+				msg->args[0], set_done, sd);
+	if (r < 0)
+		free(sd);
+
+	return r;
+}
+
+/* The clients aren't trusted to send sane attributes. */
+static bool valid_values(const ProtoMsg *msg)
+{
+	int i;
+
+	if (msg->num_values < 0 || msg->num_values > PROTO_MAX_VALUES)
+		return false;
+
+	for (i = 0; i < msg->num_values; i++)
+		if (msg->values[i].attr < 0 ||
+		    msg->values[i].attr >= TVOUT_CTL_READY)
+			return false;
+
+	return true;
+}
+
+static void handle_request(Daemon *d, Client *c, const ProtoMsg *msg)
+{
+	const TVoutCtlAttrValue *v = msg->values;
+	ProtoMsg reply;
+	int r = -1;
+
+	if (!valid_values(msg))
+		goto out;
+
+	switch (msg->type) {
+	case PROTO_SET:
+		if (msg->num_values == 1)
+			r = tvout_ctl_set(d->ctl, v->attr, v->value);
+		break;
+	case PROTO_SET_ASYNC:
+		r = set_async(d, c, msg);
+		break;
+	case PROTO_SET_COALESCED:
+		if (msg->num_values == 1)
+			r = tvout_ctl_set_coalesced(d->ctl, v->attr, v->value);
+		break;
+	case PROTO_SET_MANY:
+		r = tvout_ctl_set_many(d->ctl, v, msg->num_values);
+		break;
+	case PROTO_SET_PACING:
+		r = tvout_ctl_set_pacing(d->ctl, msg->args[0], msg->args[1]);
+		break;
+	default:
+		break;
+	}
+
+ out:
+	memset(&reply, 0, sizeof reply);
+	reply.type = PROTO_REPLY;
+	reply.serial = msg->serial;
+	reply.result = r;
+
+	send_msg(c, &reply);
+}
+
+static void read_client(Daemon *d, Client *c)
+{
+	ProtoMsg msg;
+	ssize_t r;
+
+	while (!c->dead) {
+		r = recv(c->fd, &msg, sizeof msg, MSG_DONTWAIT);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+
+		if (r != sizeof msg) {
+			c->dead = true;
+			return;
+		}
+
+		handle_request(d, c, &msg);
+	}
+}
+
+/*
+ * A client we have no room for sees the socket close before
+ * PROTO_WELCOME, and talks to the X server itself instead.
+ */
+static void accept_clients(Daemon *d)
+{
+	ProtoMsg msg;
+	int fd;
+
+	memset(&msg, 0, sizeof msg);
+	msg.type = PROTO_WELCOME;
+
+	/* The client sockets are used with MSG_DONTWAIT. */
+	while ((fd = accept(d->listen_fd, NULL, NULL)) >= 0) {
+		Client *c;
+
+		if (d->num_clients == MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+
+		c = &d->clients[d->num_clients++];
+		c->fd = fd;
+		c->id = ++d->next_id;
+		c->dead = false;
+
+		send_msg(c, &msg);
+	}
+}
+
+static bool page_init(Daemon *d)
+{
+	TVoutCtlState state;
+	void *page;
+	int fd;
+
+	if (!proto_path("state", d->page_path, sizeof d->page_path))
+		return false;
+
+	fd = open(d->page_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+
+	if (ftruncate(fd, sizeof (ProtoPage)) < 0) {
+		close(fd);
+		return false;
+	}
+
+	page = mmap(NULL, sizeof (ProtoPage), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+		return false;
+
+	d->page = page;
+
+	tvout_ctl_get_state(d->ctl, &state);
+	snapshot_write(&d->page->snapshot, &state, 0, 0);
+
+	d->page->version = PROTO_VERSION;
+	__atomic_store_n(&d->page->magic, PROTO_MAGIC, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static bool socket_addr(struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof *addr);
+	addr->sun_family = AF_UNIX;
+
+	return proto_path("sock", addr->sun_path, sizeof addr->sun_path);
+}
+
+/* Checked first so that we don't touch a live daemon's files. */
+static bool already_running(void)
+{
+	struct sockaddr_un addr;
+	bool running;
+	int fd;
+
+	if (!socket_addr(&addr))
+		return false;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+
+	running = connect(fd, (struct sockaddr *) &addr, sizeof addr) == 0;
+
+	close(fd);
+
+	return running;
+}
+
+static bool socket_init(Daemon *d)
+{
+	struct sockaddr_un addr;
+
+	if (!socket_addr(&addr))
+		return false;
+
+	/* Left behind by a daemon that died */
+	unlink(addr.sun_path);
+
+	d->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (d->listen_fd < 0)
+		return false;
+
+	if (bind(d->listen_fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+	    listen(d->listen_fd, 8) < 0)
+		return false;
+
+	strcpy(d->sock_path, addr.sun_path);
+
+	return true;
+}
+
+static void daemon_exit(Daemon *d)
+{
+	int i;
+
+	for (i = 0; i < d->num_clients; i++)
+		close(d->clients[i].fd);
+
+	if (d->listen_fd >= 0)
+		close(d->listen_fd);
+	if (d->sock_path[0])
+		unlink(d->sock_path);
+
+	if (d->page) {
+		/* Clients that still have it mapped see the handle go away. */
+		snapshot_write(&d->page->snapshot, NULL, TVOUT_CTL_READY, -1);
+		munmap(d->page, sizeof (ProtoPage));
+		unlink(d->page_path);
+	}
+
+	tvout_ctl_exit(d->ctl);
+}
+
+static void run(Daemon *d)
+{
+	while (!quit) {
+		struct pollfd pfds[3 + MAX_CLIENTS];
+		int num_clients = d->num_clients;
+		int i, n = 0, r;
+
+		pfds[n].fd = tvout_ctl_fd(d->ctl);
+		pfds[n++].events = POLLIN;
+		pfds[n].fd = tvout_ctl_timer_fd(d->ctl);
+		pfds[n++].events = POLLIN;
+		pfds[n].fd = d->listen_fd;
+		pfds[n++].events = POLLIN;
+		for (i = 0; i < num_clients; i++) {
+			pfds[n].fd = d->clients[i].fd;
+			pfds[n++].events = POLLIN;
+		}
+
+		r = poll(pfds, n, tvout_ctl_needs_dispatch(d->ctl) ? 0 : -1);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (r == 0 || pfds[0].revents || pfds[1].revents)
+			tvout_ctl_fd_ready(d->ctl);
+
+		if (tvout_ctl_get(d->ctl, TVOUT_CTL_READY) != 1) {
+			fprintf(stderr, "Lost the TV out handle\n");
+			break;
+		}
+
+		for (i = 0; i < num_clients; i++)
+			if (pfds[3 + i].revents)
+				read_client(d, &d->clients[i]);
+
+		if (pfds[2].revents)
+			accept_clients(d);
+
+		sweep_clients(d);
+	}
+}
+
+int main(void)
+{
+	struct sigaction sa;
+	Daemon d;
+	TVoutCtlConfig config;
+
+	if (already_running()) {
+		fprintf(stderr, "tvout-ctld is already running\n");
+		return 1;
+	}
+
+	memset(&d, 0, sizeof d);
+	d.listen_fd = -1;
+
+	memset(&config, 0, sizeof config);
+	config.batch_notify = publish;
+	config.ui_data = &d;
+	config.flags = TVOUT_CTL_INIT_NO_DAEMON;
+
+	d.ctl = tvout_ctl_init_config(&config);
+	if (!d.ctl) {
+		fprintf(stderr, "No TV out found\n");
+		return 1;
+	}
+
+	/* The page has to be valid before anyone can connect. */
+	if (!page_init(&d) || !socket_init(&d)) {
+		fprintf(stderr, "Failed to set up the client interface\n");
+		daemon_exit(&d);
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	run(&d);
+
+	daemon_exit(&d);
+
+	return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool bench_samples_init(BenchSamples *s, int max_samples)
+{
+	memset(s, 0, sizeof *s);
+
+	s->samples = calloc(max_samples, sizeof s->samples[0]);
+	if (!s->samples)
+		return false;
+
+	s->max_samples = max_samples;
+
+	return true;
+}
+
+void bench_samples_free(BenchSamples *s)
+{
+	free(s->samples);
+	memset(s, 0, sizeof *s);
+}
+
+void bench_sample(BenchSamples *s, uint64_t ns)
+{
+	if (s->num_samples < s->max_samples)
+		s->samples[s->num_samples++] = ns;
+}
+
+bool bench_wait(TVoutCtl *ctl, const bool *done, int timeout_ms)
+{
+	uint64_t deadline = bench_now() + timeout_ms * 1000000ULL;
+
+	while (!*done) {
+		struct pollfd pfd[2] = {
+			{ .fd = tvout_ctl_fd(ctl), .events = POLLIN, },
+			{ .fd = tvout_ctl_timer_fd(ctl), .events = POLLIN, },
+		};
+		uint64_t now;
+
+		if (tvout_ctl_needs_dispatch(ctl)) {
+			tvout_ctl_dispatch_pending(ctl);
+			continue;
+		}
+
+		now = bench_now();
+		if (now >= deadline)
+			return false;
+
+		if (poll(pfd, pfd[1].fd >= 0 ? 2 : 1,
+			 (deadline - now + 999999) / 1000000) > 0)
+			tvout_ctl_fd_ready(ctl);
+	}
+
+	return true;
+}
+
+#define JSON_MAX_DEPTH 8
+
+static int json_depth;
+static bool json_first[JSON_MAX_DEPTH] = { true };
+
+static void json_key(const char *key)
+{
+	if (!json_first[json_depth])
+		putchar(',');
+	json_first[json_depth] = false;
+
+	if (json_depth)
+		printf("\n%*s", 2 * json_depth, "");
+
+	if (key)
+		printf("\"%s\": ", key);
+}
+
+void json_begin(const char *key)
+{
+	json_key(key);
+	putchar('{');
+
+	json_first[++json_depth] = true;
+}
+
+void json_end(void)
+{
+	json_depth--;
+	printf("\n%*s}", 2 * json_depth, "");
+
+	if (!json_depth) {
+		putchar('\n');
+		fflush(stdout);
+	}
+}
+
+void json_int(const char *key, long long value)
+{
+	json_key(key);
+	printf("%lld", value);
+}
+
+static void json_double(const char *key, double value)
+{
+	json_key(key);
+	printf("%.3f", value);
+}
+
+void json_string(const char *key, const char *value)
+{
+	json_key(key);
+
+	if (!value) {
+		printf("null");
+		return;
+	}
+
+	putchar('"');
+	for (; *value; value++) {
+		if (*value == '"' || *value == '\\')
+			putchar('\\');
+		putchar(*value);
+	}
+	putchar('"');
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank */
+static double percentile_us(const uint64_t *sorted, int num, int percent)
+{
+	int i = (num * percent + 99) / 100;
+
+	if (i > 0)
+		i--;
+
+	return sorted[i] / 1000.0;
+}
+
+void json_samples(const char *key, const BenchSamples *s)
+{
+	uint64_t *sorted, sum = 0;
+	int i, n = s->num_samples;
+
+	json_begin(key);
+	json_int("count", n);
+	json_int("timeouts", s->timeouts);
+
+	sorted = malloc(n * sizeof sorted[0]);
+	if (n && sorted) {
+		memcpy(sorted, s->samples, n * sizeof sorted[0]);
+		qsort(sorted, n, sizeof sorted[0], compare_samples);
+
+		for (i = 0; i < n; i++)
+			sum += sorted[i];
+
+		json_double("min_us", sorted[0] / 1000.0);
+		json_double("median_us", percentile_us(sorted, n, 50));
+		json_double("p90_us", percentile_us(sorted, n, 90));
+		json_double("p99_us", percentile_us(sorted, n, 99));
+		json_double("max_us", sorted[n - 1] / 1000.0);
+		json_double("mean_us", sum / 1000.0 / n);
+	}
+	free(sorted);
+
+	json_end();
+}
+
+static const char *hist_names[TVOUT_CTL_NUM_HISTS] = {
+	[TVOUT_CTL_HIST_INIT] = "init",
+	[TVOUT_CTL_HIST_SET_CONFIRM] = "set_confirm",
+	[TVOUT_CTL_HIST_EVENT_NOTIFY] = "event_notify",
+	[TVOUT_CTL_HIST_ENABLE] = "enable",
+};
+
+void json_stats(const char *key, const TVoutCtlStats *stats)
+{
+	int i, j;
+
+	json_begin(key);
+	json_int("property_round_trips", stats->property_round_trips);
+	json_int("attribute_round_trips", stats->attribute_round_trips);
+	json_int("resource_round_trips", stats->resource_round_trips);
+	json_int("init_round_trips", stats->init_round_trips);
+	json_int("drains", stats->drains);
+	json_int("events", stats->events);
+	json_int("checked_notifies", stats->checked_notifies);
+	json_int("redundant_sets", stats->redundant_sets);
+	json_int("callbacks", stats->callbacks);
+
+	/* Bucket n counts latencies below 2^n us */
+	json_begin("hist");
+	for (i = 0; i < TVOUT_CTL_NUM_HISTS; i++) {
+		int last = -1;
+
+		for (j = 0; j < TVOUT_CTL_HIST_BUCKETS; j++)
+			if (stats->hist[i][j])
+				last = j;
+
+		if (last < 0 || !hist_names[i])
+			continue;
+
+		json_key(hist_names[i]);
+		putchar('[');
+		for (j = 0; j <= last; j++)
+			printf("%s%lu", j ? ", " : "", stats->hist[i][j]);
+		putchar(']');
+	}
+	json_end();
+
+	json_end();
+}
@@ -0,0 +1,63 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tvout-ctl.h"
+
+/* CLOCK_MONOTONIC in ns */
+uint64_t bench_now(void);
+
+/* Latencies in ns, summarized when printed */
+typedef struct {
+	uint64_t *samples;
+	int num_samples;
+	int max_samples;
+	/* Waits that gave up */
+	int timeouts;
+} BenchSamples;
+
+bool bench_samples_init(BenchSamples *s, int max_samples);
+void bench_samples_free(BenchSamples *s);
+void bench_sample(BenchSamples *s, uint64_t ns);
+
+/*
+ * Runs tvout_ctl_fd_ready() whenever there's something to do
+ * until *done becomes true. Returns false if that takes longer
+ * than timeout_ms.
+ */
+bool bench_wait(TVoutCtl *ctl, const bool *done, int timeout_ms);
+
+/*
+ * The results are printed to stdout as a single JSON object.
+ * Objects nest, and the commas are taken care of.
+ */
+void json_begin(const char *key);
+void json_end(void);
+void json_int(const char *key, long long value);
+void json_string(const char *key, const char *value);
+void json_samples(const char *key, const BenchSamples *s);
+/* The counters, and the histograms that have anything in them */
+void json_stats(const char *key, const TVoutCtlStats *stats);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Gives an output of a test X server, such as Xvfb, the properties
+ * of the OMAP TV output, so that the RandR backend can be pointed
+ * at it with $TVOUT_CTL_OUTPUT. The properties stay on the server
+ * after we're gone. Prints the name of the output.
+ *
+ * Usage: fake-tv-output [output name]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xcb/xcb.h>
+#include <xcb/randr.h>
+
+#include "xrandr-util.h"
+
+typedef struct {
+	const char *name;
+	xcb_atom_t type;
+	/* An inclusive range for integers, the choices for atoms */
+	const char *values[2];
+	int32_t min, max;
+	int32_t value;
+} FakeProp;
+
+/* Same as the X driver, see prop_names[] in tvout-ctl-xrandr.c */
+static const FakeProp props[] = {
+	{ "SignalFormat", XCB_ATOM_ATOM, { "Composite-PAL", "Composite-NTSC" }, },
+	{ "SignalProperties", XCB_ATOM_ATOM, { "PAL", "NTSC" }, },
+	{ "TVAspectRatio", XCB_ATOM_ATOM, { "4:3", "16:9" }, },
+	{ "TVScale", XCB_ATOM_INTEGER, { }, 1, 100, 90, },
+	{ "TVDynamicAspectRatio", XCB_ATOM_INTEGER, { }, 0, 1, 0, },
+	{ "TVXOffset", XCB_ATOM_INTEGER, { }, -128, 128, 0, },
+	{ "TVYOffset", XCB_ATOM_INTEGER, { }, -128, 128, 0, },
+	{ "XvCloneFullscreen", XCB_ATOM_INTEGER, { }, 0, 1, 1, },
+};
+
+#define NUM_PROPS (sizeof props / sizeof props[0])
+
+static bool fake_prop(xcb_connection_t *conn, xcb_randr_output_t output,
+		      const FakeProp *prop)
+{
+	xcb_generic_error_t *error;
+	xcb_atom_t atom;
+	int32_t values[2];
+	uint32_t data;
+
+	atom = xrandr_intern(conn, prop->name);
+	if (atom == XCB_ATOM_NONE)
+		return false;
+
+	if (prop->type == XCB_ATOM_ATOM) {
+		values[0] = xrandr_intern(conn, prop->values[0]);
+		values[1] = xrandr_intern(conn, prop->values[1]);
+		if (values[0] == XCB_ATOM_NONE || values[1] == XCB_ATOM_NONE)
+			return false;
+		data = values[0];
+	} else {
+		values[0] = prop->min;
+		values[1] = prop->max;
+		data = prop->value;
+	}
+
+	xcb_randr_configure_output_property(conn, output, atom, 0,
+					    prop->type == XCB_ATOM_INTEGER,
+					    2, values);
+
+	error = xcb_request_check(conn,
+				  xcb_randr_change_output_property_checked(conn, output, atom,
+									   prop->type, 32,
+									   XCB_PROP_MODE_REPLACE,
+									   1, &data));
+	if (error) {
+		fprintf(stderr, "Failed to set %s: error %d\n",
+			prop->name, error->error_code);
+		free(error);
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	xcb_connection_t *conn;
+	xcb_randr_query_version_reply_t *version;
+	xcb_randr_output_t output;
+	char name[64];
+	unsigned int i;
+	int screen_num;
+
+	conn = xcb_connect(NULL, &screen_num);
+	if (xcb_connection_has_error(conn)) {
+		fprintf(stderr, "Can't open display\n");
+		return 1;
+	}
+
+	version = xcb_randr_query_version_reply(conn,
+						xcb_randr_query_version(conn, 1, 2),
+						NULL);
+	if (!version || (version->major_version == 1 && version->minor_version < 2)) {
+		fprintf(stderr, "RandR 1.2 is needed\n");
+		return 1;
+	}
+	free(version);
+
+	if (!xrandr_find_output(conn, xrandr_root(conn, screen_num),
+				argc > 1 ? argv[1] : NULL,
+				&output, name, sizeof name)) {
+		fprintf(stderr, "No such output\n");
+		return 1;
+	}
+
+	for (i = 0; i < NUM_PROPS; i++)
+		if (!fake_prop(conn, output, &props[i]))
+			return 1;
+
+	printf("%s\n", name);
+
+	xcb_disconnect(conn);
+
+	return 0;
+}
@@ -0,0 +1,1690 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * See fake-x.h. One thread serves all the clients. Whatever
+ * requests have come in are handled in one go, and only then is
+ * the output sent, after the configured latency. So pipelined
+ * requests pay for the latency once, as they would with a real
+ * server.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "fake-x.h"
+
+#define MAX_CLIENTS 8
+#define MAX_ATOMS 256
+#define MAX_SELECTIONS 8
+#define FIRST_DISPLAY 90
+#define NUM_DISPLAYS 100
+
+/* The core requests we know */
+enum {
+	REQ_CREATE_WINDOW = 1,
+	REQ_DESTROY_WINDOW = 4,
+	REQ_INTERN_ATOM = 16,
+	REQ_GET_ATOM_NAME = 17,
+	REQ_GET_PROPERTY = 20,
+	REQ_GET_INPUT_FOCUS = 43,
+	REQ_CREATE_GC = 55,
+	REQ_FREE_GC = 60,
+	REQ_QUERY_EXTENSION = 98,
+};
+
+enum {
+	BAD_REQUEST = 1,
+	BAD_VALUE = 2,
+	BAD_ATOM = 5,
+	BAD_MATCH = 8,
+	BAD_ALLOC = 11,
+	BAD_NAME = 15,
+	BAD_LENGTH = 16,
+};
+
+/* Where the extensions live, like a real server would pick */
+#define RR_MAJOR 140
+#define RR_FIRST_EVENT 89
+#define RR_FIRST_ERROR 147
+#define XV_MAJOR 141
+#define XV_FIRST_EVENT 91
+#define XV_FIRST_ERROR 150
+
+enum {
+	RR_QUERY_VERSION = 0,
+	RR_SELECT_INPUT = 4,
+	RR_GET_SCREEN_RESOURCES = 8,
+	RR_GET_OUTPUT_INFO = 9,
+	RR_LIST_OUTPUT_PROPERTIES = 10,
+	RR_QUERY_OUTPUT_PROPERTY = 11,
+	RR_CHANGE_OUTPUT_PROPERTY = 13,
+	RR_GET_OUTPUT_PROPERTY = 15,
+	RR_GET_CRTC_INFO = 20,
+	RR_SET_CRTC_CONFIG = 21,
+	RR_GET_SCREEN_RESOURCES_CURRENT = 25,
+};
+
+enum {
+	RR_NOTIFY_MASK_CRTC_CHANGE = 1 << 1,
+	RR_NOTIFY_MASK_OUTPUT_CHANGE = 1 << 2,
+	RR_NOTIFY_MASK_OUTPUT_PROPERTY = 1 << 3,
+};
+
+enum {
+	XV_QUERY_EXTENSION = 0,
+	XV_QUERY_ADAPTORS = 1,
+	XV_SELECT_PORT_NOTIFY = 11,
+	XV_SET_PORT_ATTRIBUTE = 13,
+	XV_GET_PORT_ATTRIBUTE = 14,
+	XV_QUERY_PORT_ATTRIBUTES = 15,
+};
+
+#define ATOM_ATOM 4
+#define ATOM_INTEGER 19
+
+#define ROOT 0x100
+#define COLORMAP 0x101
+#define VISUAL 0x102
+#define WIDTH 800
+#define HEIGHT 480
+
+typedef struct {
+	uint32_t id;
+	uint16_t width;
+	uint16_t height;
+	const char *name;
+} Mode;
+
+static const Mode modes[] = {
+	{ 0x60, 800, 480, "800x480", },
+	{ 0x61, 720, 576, "720x576", },
+};
+
+#define NUM_MODES (sizeof modes / sizeof modes[0])
+
+typedef struct {
+	uint32_t id;
+	uint32_t mode;
+	int16_t x;
+	int16_t y;
+	uint16_t rotation;
+} Crtc;
+
+/* Each output can only use the one CRTC */
+typedef struct {
+	uint32_t id;
+	const char *name;
+	uint32_t crtc;
+	uint32_t possible;
+	uint32_t mode;
+	bool tv;
+} Output;
+
+#define NUM_CRTCS 2
+#define NUM_OUTPUTS 2
+#define TV_OUTPUT 0x51
+
+typedef struct {
+	const char *name;
+	uint32_t type;
+	/* The choices for atoms */
+	const char *choices[2];
+	/* An inclusive range for integers */
+	int32_t min, max;
+	int32_t value;
+} PropTemplate;
+
+/* The properties of the TV output, see tests/fake-tv-output.c */
+static const PropTemplate prop_templates[] = {
+	{ "SignalFormat", ATOM_ATOM, { "Composite-PAL", "Composite-NTSC" }, },
+	{ "SignalProperties", ATOM_ATOM, { "PAL", "NTSC" }, },
+	{ "TVAspectRatio", ATOM_ATOM, { "4:3", "16:9" }, },
+	{ "TVScale", ATOM_INTEGER, { }, 1, 100, 90, },
+	{ "TVDynamicAspectRatio", ATOM_INTEGER, { }, 0, 1, 0, },
+	{ "TVXOffset", ATOM_INTEGER, { }, -128, 128, 0, },
+	{ "TVYOffset", ATOM_INTEGER, { }, -128, 128, 0, },
+	{ "XvCloneFullscreen", ATOM_INTEGER, { }, 0, 1, 1, },
+};
+
+#define NUM_PROPS (sizeof prop_templates / sizeof prop_templates[0])
+
+typedef struct {
+	uint32_t atom;
+	uint32_t type;
+	bool range;
+	int32_t valid[2];
+	int32_t value;
+} Prop;
+
+typedef struct {
+	const char *name;
+	int32_t min, max;
+	int32_t value;
+} AttrTemplate;
+
+/* The TV port, the other one only has the colorkey */
+static const AttrTemplate attr_templates[] = {
+	{ "XV_COLORKEY", 0, 0xffffff, 0x10, },
+	{ "XV_OMAP_CLONE_TO_TVOUT", 0, 1, 0, },
+	{ "XV_OMAP_TVOUT_STANDARD", 0, 1, 0, },
+	{ "XV_OMAP_TVOUT_WIDESCREEN", 0, 1, 0, },
+	{ "XV_OMAP_TVOUT_SCALE", 1, 100, 90, },
+};
+
+#define NUM_ATTRS (sizeof attr_templates / sizeof attr_templates[0])
+
+#define XV_ADAPTOR_NAME "Fake overlay"
+#define XV_BASE_PORT 0x70
+#define XV_NUM_PORTS 2
+#define XV_TV_PORT (XV_BASE_PORT + 1)
+
+typedef struct {
+	uint32_t atom;
+	int32_t value;
+} Attr;
+
+typedef struct {
+	int fd;
+	bool setup_done;
+	unsigned int sequence;
+
+	uint8_t *in;
+	size_t in_len;
+	size_t in_max;
+	uint8_t *out;
+	size_t out_len;
+	size_t out_max;
+
+	/* Whether the requests being handled got a reply or an error */
+	bool replied;
+
+	struct {
+		uint32_t window;
+		uint16_t mask;
+	} rr_select[MAX_SELECTIONS];
+	int num_rr_select;
+	bool xv_select[XV_NUM_PORTS];
+} Client;
+
+static struct {
+	pthread_t thread;
+	/* Everything below, the API calls come from other threads */
+	pthread_mutex_t mutex;
+	int listen_fd;
+	int wake_fds[2];
+	FakeXConfig config;
+	uint64_t start;
+
+	Client clients[MAX_CLIENTS];
+
+	char *atoms[MAX_ATOMS];
+	uint32_t num_atoms;
+
+	uint32_t timestamp;
+	uint32_t config_timestamp;
+	Crtc crtcs[NUM_CRTCS];
+	Output outputs[NUM_OUTPUTS];
+	Prop props[NUM_PROPS];
+	Attr attrs[NUM_ATTRS];
+
+	/* For fake_x_xv_set_after_get() */
+	bool after_get;
+	uint32_t after_get_atom;
+	int32_t after_get_value;
+
+	unsigned long round_trips;
+	unsigned long requests;
+} fake = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.listen_fd = -1,
+	.wake_fds = { -1, -1 },
+};
+
+static size_t pad4(size_t len)
+{
+	return (len + 3) & ~3;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* X server time, 0 is CurrentTime */
+static uint32_t server_time(void)
+{
+	return monotonic_ms() - fake.start + 1;
+}
+
+static uint32_t atom_lookup(const char *name, size_t len)
+{
+	uint32_t i;
+
+	for (i = 1; i < fake.num_atoms; i++)
+		if (fake.atoms[i] && strlen(fake.atoms[i]) == len &&
+		    !memcmp(fake.atoms[i], name, len))
+			return i;
+
+	return 0;
+}
+
+static uint32_t atom_intern(const char *name, size_t len)
+{
+	uint32_t atom = atom_lookup(name, len);
+
+	if (atom || fake.num_atoms == MAX_ATOMS)
+		return atom;
+
+	fake.atoms[fake.num_atoms] = strndup(name, len);
+	if (!fake.atoms[fake.num_atoms])
+		return 0;
+
+	return fake.num_atoms++;
+}
+
+static uint32_t intern(const char *name)
+{
+	return atom_intern(name, strlen(name));
+}
+
+/* The buffers are tiny, running out of memory isn't worth handling. */
+static void *grow(void *buf, size_t *max, size_t len)
+{
+	size_t new_max = *max ? *max : 4096;
+
+	while (new_max < len)
+		new_max *= 2;
+
+	if (new_max == *max)
+		return buf;
+
+	buf = realloc(buf, new_max);
+	if (!buf) {
+		fprintf(stderr, "fake-x: out of memory\n");
+		abort();
+	}
+
+	*max = new_max;
+
+	return buf;
+}
+
+static uint8_t *out_reserve(Client *c, size_t len)
+{
+	uint8_t *p;
+
+	c->out = grow(c->out, &c->out_max, c->out_len + len);
+
+	p = c->out + c->out_len;
+	memset(p, 0, len);
+	c->out_len += len;
+
+	return p;
+}
+
+/* A reply with len more bytes after the first 32, all zeroed */
+static uint8_t *reply(Client *c, size_t len)
+{
+	uint8_t *p = out_reserve(c, 32 + len);
+
+	p[0] = 1;
+	put16(p + 2, c->sequence);
+	put32(p + 4, len / 4);
+
+	c->replied = true;
+
+	return p;
+}
+
+static void error(Client *c, const uint8_t *req, uint8_t code, uint32_t value)
+{
+	uint8_t *p = out_reserve(c, 32);
+
+	p[1] = code;
+	put16(p + 2, c->sequence);
+	put32(p + 4, value);
+	put16(p + 8, req[0] >= 128 ? req[1] : 0);
+	p[10] = req[0];
+
+	c->replied = true;
+}
+
+static uint8_t *event(Client *c, uint8_t type)
+{
+	uint8_t *p = out_reserve(c, 32);
+
+	p[0] = type;
+	put16(p + 2, c->sequence);
+
+	return p;
+}
+
+static void drop_client(Client *c)
+{
+	close(c->fd);
+	free(c->in);
+	free(c->out);
+	memset(c, 0, sizeof *c);
+	c->fd = -1;
+}
+
+static void flush_clients(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		Client *c = &fake.clients[i];
+		size_t done = 0;
+
+		if (c->fd < 0)
+			continue;
+
+		/* A client that's gone is dropped once the read fails. */
+		while (done < c->out_len) {
+			ssize_t r = send(c->fd, c->out + done, c->out_len - done,
+					 MSG_NOSIGNAL);
+
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r <= 0)
+				break;
+			done += r;
+		}
+
+		c->out_len = 0;
+	}
+}
+
+static bool pending_output(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++)
+		if (fake.clients[i].fd >= 0 && fake.clients[i].out_len)
+			return true;
+
+	return false;
+}
+
+/* Returns the length of the setup request, or 0 if it isn't all in */
+static size_t handle_setup(Client *c)
+{
+	static const char vendor[] = "libtvout-ctl fake-x";
+	size_t len, vendor_len = pad4(sizeof vendor - 1);
+	/* Two pixmap formats, one screen with one depth and visual */
+	size_t extra = 32 + vendor_len + 2 * 8 + 40 + 8 + 24;
+	int idx = c - fake.clients;
+	uint8_t *p;
+
+	if (c->in_len < 12)
+		return 0;
+
+	len = 12 + pad4(get16(c->in + 6)) + pad4(get16(c->in + 8));
+	if (c->in_len < len)
+		return 0;
+
+	if (c->in[0] != 'l') {
+		fprintf(stderr, "fake-x: only little endian clients are supported\n");
+		return 0;
+	}
+
+	p = out_reserve(c, 8 + extra);
+	p[0] = 1;
+	put16(p + 2, 11);
+	put16(p + 6, extra / 4);
+	put32(p + 8, 1);
+	put32(p + 12, (idx + 1) << 21);
+	put32(p + 16, 0x1fffff);
+	put16(p + 24, sizeof vendor - 1);
+	put16(p + 26, 0xffff);
+	p[28] = 1;
+	p[29] = 2;
+	p[32] = 32;
+	p[33] = 32;
+	p[34] = 8;
+	p[35] = 255;
+	memcpy(p + 40, vendor, sizeof vendor - 1);
+
+	p += 40 + vendor_len;
+	p[0] = 1;
+	p[1] = 1;
+	p[2] = 32;
+	p[8] = 24;
+	p[9] = 32;
+	p[10] = 32;
+
+	p += 16;
+	put32(p, ROOT);
+	put32(p + 4, COLORMAP);
+	put32(p + 8, 0xffffff);
+	put16(p + 20, WIDTH);
+	put16(p + 22, HEIGHT);
+	put16(p + 24, WIDTH / 4);
+	put16(p + 26, HEIGHT / 4);
+	put16(p + 28, 1);
+	put16(p + 30, 1);
+	put32(p + 32, VISUAL);
+	p[38] = 24;
+	p[39] = 1;
+
+	p += 40;
+	p[0] = 24;
+	put16(p + 2, 1);
+
+	p += 8;
+	put32(p, VISUAL);
+	/* TrueColor */
+	p[4] = 4;
+	p[5] = 8;
+	put16(p + 6, 256);
+	put32(p + 8, 0xff0000);
+	put32(p + 12, 0x00ff00);
+	put32(p + 16, 0x0000ff);
+
+	c->setup_done = true;
+	c->replied = true;
+
+	return len;
+}
+
+static void intern_atom(Client *c, const uint8_t *req, size_t len)
+{
+	size_t name_len = get16(req + 4);
+	uint32_t atom;
+	uint8_t *p;
+
+	if (8 + name_len > len) {
+		error(c, req, BAD_LENGTH, 0);
+		return;
+	}
+
+	/* only_if_exists */
+	if (req[1])
+		atom = atom_lookup((const char *) req + 8, name_len);
+	else
+		atom = atom_intern((const char *) req + 8, name_len);
+
+	if (!atom && !req[1]) {
+		error(c, req, BAD_ALLOC, 0);
+		return;
+	}
+
+	p = reply(c, 0);
+	put32(p + 8, atom);
+}
+
+static void get_atom_name(Client *c, const uint8_t *req)
+{
+	uint32_t atom = get32(req + 4);
+	size_t name_len;
+	uint8_t *p;
+
+	if (atom >= fake.num_atoms || !fake.atoms[atom]) {
+		error(c, req, BAD_ATOM, atom);
+		return;
+	}
+
+	name_len = strlen(fake.atoms[atom]);
+
+	p = reply(c, pad4(name_len));
+	put16(p + 8, name_len);
+	memcpy(p + 32, fake.atoms[atom], name_len);
+}
+
+static void query_extension(Client *c, const uint8_t *req, size_t len)
+{
+	size_t name_len = get16(req + 4);
+	const char *name = (const char *) req + 8;
+	uint8_t *p;
+
+	if (8 + name_len > len) {
+		error(c, req, BAD_LENGTH, 0);
+		return;
+	}
+
+	p = reply(c, 0);
+
+	if (name_len == 5 && !memcmp(name, "RANDR", 5)) {
+		p[8] = 1;
+		p[9] = RR_MAJOR;
+		p[10] = RR_FIRST_EVENT;
+		p[11] = RR_FIRST_ERROR;
+	} else if (name_len == 6 && !memcmp(name, "XVideo", 6)) {
+		p[8] = 1;
+		p[9] = XV_MAJOR;
+		p[10] = XV_FIRST_EVENT;
+		p[11] = XV_FIRST_ERROR;
+	}
+}
+
+static Output *find_output(uint32_t id)
+{
+	int i;
+
+	for (i = 0; i < NUM_OUTPUTS; i++)
+		if (fake.outputs[i].id == id)
+			return &fake.outputs[i];
+
+	return NULL;
+}
+
+static Crtc *find_crtc(uint32_t id)
+{
+	int i;
+
+	for (i = 0; i < NUM_CRTCS; i++)
+		if (fake.crtcs[i].id == id)
+			return &fake.crtcs[i];
+
+	return NULL;
+}
+
+static const Mode *find_mode(uint32_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_MODES; i++)
+		if (modes[i].id == id)
+			return &modes[i];
+
+	return NULL;
+}
+
+/* Only the TV output has properties */
+static Prop *find_prop(const Output *out, uint32_t atom)
+{
+	unsigned int i;
+
+	if (!out->tv)
+		return NULL;
+
+	for (i = 0; i < NUM_PROPS; i++)
+		if (fake.props[i].atom == atom)
+			return &fake.props[i];
+
+	return NULL;
+}
+
+static void rr_select_input(Client *c, const uint8_t *req)
+{
+	uint32_t window = get32(req + 4);
+	uint16_t mask = get16(req + 8);
+	int i;
+
+	for (i = 0; i < c->num_rr_select; i++)
+		if (c->rr_select[i].window == window)
+			break;
+
+	if (!mask) {
+		if (i < c->num_rr_select)
+			c->rr_select[i] = c->rr_select[--c->num_rr_select];
+		return;
+	}
+
+	if (i == MAX_SELECTIONS) {
+		error(c, req, BAD_ALLOC, 0);
+		return;
+	}
+
+	if (i == c->num_rr_select)
+		c->num_rr_select++;
+
+	c->rr_select[i].window = window;
+	c->rr_select[i].mask = mask;
+}
+
+/* An RRNotify to every selection that wants it, to fill in */
+typedef void (*RRFill)(uint8_t *ev, uint32_t window, const void *data);
+
+static void rr_notify(uint16_t mask, uint8_t subcode, RRFill fill,
+		      const void *data)
+{
+	int i, j;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		Client *c = &fake.clients[i];
+
+		if (c->fd < 0)
+			continue;
+
+		for (j = 0; j < c->num_rr_select; j++) {
+			uint8_t *ev;
+
+			if (!(c->rr_select[j].mask & mask))
+				continue;
+
+			ev = event(c, RR_FIRST_EVENT + 1);
+			ev[1] = subcode;
+			fill(ev, c->rr_select[j].window, data);
+		}
+	}
+}
+
+static void fill_crtc_change(uint8_t *ev, uint32_t window, const void *data)
+{
+	const Crtc *crtc = data;
+	const Mode *mode = find_mode(crtc->mode);
+
+	put32(ev + 4, fake.timestamp);
+	put32(ev + 8, window);
+	put32(ev + 12, crtc->id);
+	put32(ev + 16, crtc->mode);
+	put16(ev + 20, crtc->rotation);
+	put16(ev + 24, crtc->x);
+	put16(ev + 26, crtc->y);
+	put16(ev + 28, mode ? mode->width : 0);
+	put16(ev + 30, mode ? mode->height : 0);
+}
+
+static void fill_output_change(uint8_t *ev, uint32_t window, const void *data)
+{
+	const Output *out = data;
+	const Crtc *crtc = find_crtc(out->crtc);
+
+	put32(ev + 4, fake.timestamp);
+	put32(ev + 8, fake.config_timestamp);
+	put32(ev + 12, window);
+	put32(ev + 16, out->id);
+	put32(ev + 20, out->crtc);
+	put32(ev + 24, crtc ? crtc->mode : 0);
+	put16(ev + 28, crtc ? crtc->rotation : 1);
+}
+
+static void fill_output_property(uint8_t *ev, uint32_t window, const void *data)
+{
+	const Prop *prop = data;
+
+	put32(ev + 4, window);
+	put32(ev + 8, TV_OUTPUT);
+	put32(ev + 12, prop->atom);
+	put32(ev + 16, fake.timestamp);
+}
+
+static void rr_get_screen_resources(Client *c)
+{
+	size_t names_len = 0;
+	unsigned int i;
+	uint8_t *p, *q;
+
+	for (i = 0; i < NUM_MODES; i++)
+		names_len += strlen(modes[i].name);
+
+	p = reply(c, 4 * NUM_CRTCS + 4 * NUM_OUTPUTS + 32 * NUM_MODES +
+		  pad4(names_len));
+	put32(p + 8, fake.timestamp);
+	put32(p + 12, fake.config_timestamp);
+	put16(p + 16, NUM_CRTCS);
+	put16(p + 18, NUM_OUTPUTS);
+	put16(p + 20, NUM_MODES);
+	put16(p + 22, names_len);
+
+	q = p + 32;
+	for (i = 0; i < NUM_CRTCS; i++, q += 4)
+		put32(q, fake.crtcs[i].id);
+	for (i = 0; i < NUM_OUTPUTS; i++, q += 4)
+		put32(q, fake.outputs[i].id);
+	for (i = 0; i < NUM_MODES; i++, q += 32) {
+		put32(q, modes[i].id);
+		put16(q + 4, modes[i].width);
+		put16(q + 6, modes[i].height);
+		put16(q + 26, strlen(modes[i].name));
+	}
+	for (i = 0; i < NUM_MODES; i++) {
+		memcpy(q, modes[i].name, strlen(modes[i].name));
+		q += strlen(modes[i].name);
+	}
+}
+
+static void rr_get_output_info(Client *c, const uint8_t *req)
+{
+	const Output *out = find_output(get32(req + 4));
+	size_t name_len;
+	uint8_t *p;
+
+	if (!out) {
+		error(c, req, RR_FIRST_ERROR, get32(req + 4));
+		return;
+	}
+
+	name_len = strlen(out->name);
+
+	/* The fixed part is 36 bytes, one crtc and one mode */
+	p = reply(c, 4 + 4 + 4 + pad4(name_len));
+	put32(p + 8, fake.timestamp);
+	put32(p + 12, out->crtc);
+	put32(p + 16, out->tv ? 0 : 90);
+	put32(p + 20, out->tv ? 0 : 50);
+	put16(p + 26, 1);
+	put16(p + 28, 1);
+	put16(p + 30, 1);
+	put16(p + 34, name_len);
+	put32(p + 36, out->possible);
+	put32(p + 40, out->mode);
+	memcpy(p + 44, out->name, name_len);
+}
+
+static void rr_list_output_properties(Client *c, const uint8_t *req)
+{
+	const Output *out = find_output(get32(req + 4));
+	unsigned int i, num;
+	uint8_t *p;
+
+	if (!out) {
+		error(c, req, RR_FIRST_ERROR, get32(req + 4));
+		return;
+	}
+
+	num = out->tv ? NUM_PROPS : 0;
+
+	p = reply(c, 4 * num);
+	put16(p + 8, num);
+	for (i = 0; i < num; i++)
+		put32(p + 32 + 4 * i, fake.props[i].atom);
+}
+
+static void rr_query_output_property(Client *c, const uint8_t *req)
+{
+	const Output *out = find_output(get32(req + 4));
+	const Prop *prop;
+	uint8_t *p;
+
+	if (!out) {
+		error(c, req, RR_FIRST_ERROR, get32(req + 4));
+		return;
+	}
+
+	prop = find_prop(out, get32(req + 8));
+	if (!prop) {
+		error(c, req, BAD_NAME, get32(req + 8));
+		return;
+	}
+
+	p = reply(c, 2 * 4);
+	p[9] = prop->range;
+	put32(p + 32, prop->valid[0]);
+	put32(p + 36, prop->valid[1]);
+}
+
+static void rr_change_output_property(Client *c, const uint8_t *req,
+				      size_t len)
+{
+	const Output *out = find_output(get32(req + 4));
+	Prop *prop;
+	int32_t value;
+
+	if (!out) {
+		error(c, req, RR_FIRST_ERROR, get32(req + 4));
+		return;
+	}
+
+	/* Only replacing an existing property with a single value */
+	prop = find_prop(out, get32(req + 8));
+	if (!prop) {
+		error(c, req, BAD_NAME, get32(req + 8));
+		return;
+	}
+
+	if (len < 28 || get32(req + 12) != prop->type || req[16] != 32 ||
+	    req[17] != 0 || get32(req + 20) != 1) {
+		error(c, req, BAD_MATCH, 0);
+		return;
+	}
+
+	value = get32(req + 24);
+
+	if (prop->range ? value < prop->valid[0] || value > prop->valid[1] :
+	    value != prop->valid[0] && value != prop->valid[1]) {
+		error(c, req, BAD_VALUE, value);
+		return;
+	}
+
+	prop->value = value;
+	fake.timestamp = server_time();
+
+	rr_notify(RR_NOTIFY_MASK_OUTPUT_PROPERTY, 2, fill_output_property, prop);
+}
+
+static void rr_get_output_property(Client *c, const uint8_t *req)
+{
+	const Output *out = find_output(get32(req + 4));
+	const Prop *prop;
+	uint32_t type = get32(req + 12);
+	uint8_t *p;
+
+	if (!out) {
+		error(c, req, RR_FIRST_ERROR, get32(req + 4));
+		return;
+	}
+
+	prop = find_prop(out, get32(req + 8));
+	if (!prop) {
+		reply(c, 0);
+		return;
+	}
+
+	/* Offsets and lengths don't matter with a single value. */
+	if (type && type != prop->type) {
+		p = reply(c, 0);
+		p[1] = 32;
+		put32(p + 8, prop->type);
+		put32(p + 12, 4);
+		return;
+	}
+
+	p = reply(c, 4);
+	p[1] = 32;
+	put32(p + 8, prop->type);
+	put32(p + 16, 1);
+	put32(p + 32, prop->value);
+}
+
+static void rr_get_crtc_info(Client *c, const uint8_t *req)
+{
+	const Crtc *crtc = find_crtc(get32(req + 4));
+	const Mode *mode;
+	uint8_t *p, *q;
+	int i, num = 0;
+
+	if (!crtc) {
+		error(c, req, RR_FIRST_ERROR + 1, get32(req + 4));
+		return;
+	}
+
+	for (i = 0; i < NUM_OUTPUTS; i++)
+		if (fake.outputs[i].crtc == crtc->id)
+			num++;
+
+	mode = find_mode(crtc->mode);
+
+	p = reply(c, 4 * num + 4);
+	put32(p + 8, fake.timestamp);
+	put16(p + 12, crtc->x);
+	put16(p + 14, crtc->y);
+	put16(p + 16, mode ? mode->width : 0);
+	put16(p + 18, mode ? mode->height : 0);
+	put32(p + 20, crtc->mode);
+	put16(p + 24, crtc->rotation);
+	put16(p + 26, 1);
+	put16(p + 28, num);
+	put16(p + 30, 1);
+
+	q = p + 32;
+	for (i = 0; i < NUM_OUTPUTS; i++) {
+		if (fake.outputs[i].crtc == crtc->id) {
+			put32(q, fake.outputs[i].id);
+			q += 4;
+		}
+	}
+	for (i = 0; i < NUM_OUTPUTS; i++)
+		if (fake.outputs[i].possible == crtc->id)
+			put32(q, fake.outputs[i].id);
+}
+
+static void rr_set_crtc_config(Client *c, const uint8_t *req, size_t len)
+{
+	Crtc *crtc = find_crtc(get32(req + 4));
+	unsigned int i, j, num;
+	uint32_t mode;
+	uint8_t *p;
+
+	if (len < 28) {
+		error(c, req, BAD_LENGTH, 0);
+		return;
+	}
+
+	if (!crtc) {
+		error(c, req, RR_FIRST_ERROR + 1, get32(req + 4));
+		return;
+	}
+
+	mode = get32(req + 20);
+	num = (len - 28) / 4;
+
+	/* An output list without a mode, or a mode without outputs */
+	if ((mode && (!find_mode(mode) || !num)) || (!mode && num)) {
+		error(c, req, BAD_MATCH, 0);
+		return;
+	}
+
+	for (j = 0; j < num; j++) {
+		const Output *out = find_output(get32(req + 28 + 4 * j));
+
+		if (!out || out->possible != crtc->id) {
+			error(c, req, BAD_MATCH, 0);
+			return;
+		}
+	}
+
+	if (get32(req + 12) != fake.config_timestamp) {
+		/* InvalidConfigTime */
+		p = reply(c, 0);
+		p[1] = 1;
+		put32(p + 8, fake.timestamp);
+		return;
+	}
+
+	fake.timestamp = server_time();
+
+	crtc->mode = mode;
+	crtc->x = get16(req + 16);
+	crtc->y = get16(req + 18);
+	crtc->rotation = get16(req + 24);
+
+	p = reply(c, 0);
+	put32(p + 8, fake.timestamp);
+
+	rr_notify(RR_NOTIFY_MASK_CRTC_CHANGE, 0, fill_crtc_change, crtc);
+
+	for (i = 0; i < NUM_OUTPUTS; i++) {
+		Output *out = &fake.outputs[i];
+		uint32_t new_crtc = out->crtc == crtc->id ? 0 : out->crtc;
+
+		for (j = 0; j < num; j++)
+			if (get32(req + 28 + 4 * j) == out->id)
+				new_crtc = crtc->id;
+
+		if (new_crtc == out->crtc)
+			continue;
+
+		out->crtc = new_crtc;
+		rr_notify(RR_NOTIFY_MASK_OUTPUT_CHANGE, 1, fill_output_change, out);
+	}
+}
+
+static void handle_randr(Client *c, const uint8_t *req, size_t len)
+{
+	uint8_t *p;
+
+	switch (req[1]) {
+	case RR_QUERY_VERSION:
+		p = reply(c, 0);
+		put32(p + 8, 1);
+		put32(p + 12, 3);
+		break;
+	case RR_SELECT_INPUT:
+		rr_select_input(c, req);
+		break;
+	case RR_GET_SCREEN_RESOURCES:
+	case RR_GET_SCREEN_RESOURCES_CURRENT:
+		rr_get_screen_resources(c);
+		break;
+	case RR_GET_OUTPUT_INFO:
+		rr_get_output_info(c, req);
+		break;
+	case RR_LIST_OUTPUT_PROPERTIES:
+		rr_list_output_properties(c, req);
+		break;
+	case RR_QUERY_OUTPUT_PROPERTY:
+		rr_query_output_property(c, req);
+		break;
+	case RR_CHANGE_OUTPUT_PROPERTY:
+		rr_change_output_property(c, req, len);
+		break;
+	case RR_GET_OUTPUT_PROPERTY:
+		rr_get_output_property(c, req);
+		break;
+	case RR_GET_CRTC_INFO:
+		rr_get_crtc_info(c, req);
+		break;
+	case RR_SET_CRTC_CONFIG:
+		rr_set_crtc_config(c, req, len);
+		break;
+	default:
+		fprintf(stderr, "fake-x: unknown RandR request %u\n", req[1]);
+		error(c, req, BAD_REQUEST, 0);
+		break;
+	}
+}
+
+static Attr *find_attr(uint32_t port, uint32_t atom)
+{
+	unsigned int i;
+
+	/* The other port only has the colorkey */
+	for (i = 0; i < (port == XV_TV_PORT ? NUM_ATTRS : 1); i++)
+		if (fake.attrs[i].atom == atom)
+			return &fake.attrs[i];
+
+	return NULL;
+}
+
+static bool valid_port(uint32_t port)
+{
+	return port >= XV_BASE_PORT && port < XV_BASE_PORT + XV_NUM_PORTS;
+}
+
+static void xv_port_notify(uint32_t port, const Attr *attr)
+{
+	int i;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		Client *c = &fake.clients[i];
+		uint8_t *ev;
+
+		if (c->fd < 0 || !c->xv_select[port - XV_BASE_PORT])
+			continue;
+
+		ev = event(c, XV_FIRST_EVENT + 1);
+		put32(ev + 4, fake.timestamp);
+		put32(ev + 8, port);
+		put32(ev + 12, attr->atom);
+		put32(ev + 16, attr->value);
+	}
+}
+
+static void xv_set(uint32_t port, Attr *attr, int32_t value)
+{
+	attr->value = value;
+	fake.timestamp = server_time();
+
+	xv_port_notify(port, attr);
+}
+
+static void xv_query_adaptors(Client *c)
+{
+	size_t name_len = strlen(XV_ADAPTOR_NAME);
+	uint8_t *p, *q;
+
+	/* One adaptor with one format */
+	p = reply(c, 12 + pad4(name_len) + 8);
+	put16(p + 8, 1);
+
+	q = p + 32;
+	put32(q, XV_BASE_PORT);
+	put16(q + 4, name_len);
+	put16(q + 6, XV_NUM_PORTS);
+	put16(q + 8, 1);
+	/* XvInputMask | XvImageMask */
+	q[10] = 0x11;
+	memcpy(q + 12, XV_ADAPTOR_NAME, name_len);
+
+	q += 12 + pad4(name_len);
+	put32(q, VISUAL);
+	q[4] = 24;
+}
+
+static void xv_query_port_attributes(Client *c, const uint8_t *req)
+{
+	uint32_t port = get32(req + 4);
+	unsigned int i, num;
+	size_t text_size = 0;
+	uint8_t *p, *q;
+
+	if (!valid_port(port)) {
+		error(c, req, XV_FIRST_ERROR, port);
+		return;
+	}
+
+	num = port == XV_TV_PORT ? NUM_ATTRS : 1;
+
+	/* The names are NUL terminated, and the size includes that */
+	for (i = 0; i < num; i++)
+		text_size += pad4(strlen(attr_templates[i].name) + 1);
+
+	p = reply(c, 16 * num + text_size);
+	put32(p + 8, num);
+	put32(p + 12, text_size);
+
+	q = p + 32;
+	for (i = 0; i < num; i++) {
+		size_t size = pad4(strlen(attr_templates[i].name) + 1);
+
+		/* XvGettable | XvSettable */
+		put32(q, 3);
+		put32(q + 4, attr_templates[i].min);
+		put32(q + 8, attr_templates[i].max);
+		put32(q + 12, size);
+		memcpy(q + 16, attr_templates[i].name,
+		       strlen(attr_templates[i].name));
+		q += 16 + size;
+	}
+}
+
+static void xv_set_port_attribute(Client *c, const uint8_t *req)
+{
+	uint32_t port = get32(req + 4);
+	int32_t value = get32(req + 12);
+	Attr *attr;
+	int i;
+
+	if (!valid_port(port)) {
+		error(c, req, XV_FIRST_ERROR, port);
+		return;
+	}
+
+	attr = find_attr(port, get32(req + 8));
+	if (!attr) {
+		error(c, req, BAD_MATCH, 0);
+		return;
+	}
+
+	i = attr - fake.attrs;
+	if (value < attr_templates[i].min || value > attr_templates[i].max) {
+		error(c, req, BAD_VALUE, value);
+		return;
+	}
+
+	xv_set(port, attr, value);
+}
+
+static void xv_get_port_attribute(Client *c, const uint8_t *req)
+{
+	uint32_t port = get32(req + 4);
+	Attr *attr;
+	uint8_t *p;
+
+	if (!valid_port(port)) {
+		error(c, req, XV_FIRST_ERROR, port);
+		return;
+	}
+
+	attr = find_attr(port, get32(req + 8));
+	if (!attr) {
+		error(c, req, BAD_MATCH, 0);
+		return;
+	}
+
+	p = reply(c, 0);
+	put32(p + 8, attr->value);
+
+	if (fake.after_get && port == XV_TV_PORT &&
+	    attr->atom == fake.after_get_atom) {
+		fake.after_get = false;
+		xv_set(port, attr, fake.after_get_value);
+	}
+}
+
+static void handle_xv(Client *c, const uint8_t *req)
+{
+	uint32_t port;
+	uint8_t *p;
+
+	switch (req[1]) {
+	case XV_QUERY_EXTENSION:
+		p = reply(c, 0);
+		put16(p + 8, 2);
+		put16(p + 10, 2);
+		break;
+	case XV_QUERY_ADAPTORS:
+		xv_query_adaptors(c);
+		break;
+	case XV_SELECT_PORT_NOTIFY:
+		port = get32(req + 4);
+		if (!valid_port(port))
+			error(c, req, XV_FIRST_ERROR, port);
+		else
+			c->xv_select[port - XV_BASE_PORT] = req[8];
+		break;
+	case XV_SET_PORT_ATTRIBUTE:
+		xv_set_port_attribute(c, req);
+		break;
+	case XV_GET_PORT_ATTRIBUTE:
+		xv_get_port_attribute(c, req);
+		break;
+	case XV_QUERY_PORT_ATTRIBUTES:
+		xv_query_port_attributes(c, req);
+		break;
+	default:
+		fprintf(stderr, "fake-x: unknown Xv request %u\n", req[1]);
+		error(c, req, BAD_REQUEST, 0);
+		break;
+	}
+}
+
+static void destroy_window(uint32_t window)
+{
+	int i, j;
+
+	for (i = 0; i < MAX_CLIENTS; i++) {
+		Client *c = &fake.clients[i];
+
+		for (j = 0; j < c->num_rr_select; j++)
+			if (c->rr_select[j].window == window)
+				c->rr_select[j--] = c->rr_select[--c->num_rr_select];
+	}
+}
+
+static void handle_request(Client *c, const uint8_t *req, size_t len)
+{
+	uint8_t *p;
+
+	switch (req[0]) {
+	/* Xlib makes a GC for every screen */
+	case REQ_CREATE_GC:
+	case REQ_FREE_GC:
+	case REQ_CREATE_WINDOW:
+		break;
+	case REQ_DESTROY_WINDOW:
+		destroy_window(get32(req + 4));
+		break;
+	case REQ_INTERN_ATOM:
+		intern_atom(c, req, len);
+		break;
+	case REQ_GET_ATOM_NAME:
+		get_atom_name(c, req);
+		break;
+	case REQ_GET_PROPERTY:
+		/* There are no window properties */
+		reply(c, 0);
+		break;
+	case REQ_GET_INPUT_FOCUS:
+		p = reply(c, 0);
+		/* PointerRoot */
+		p[1] = 1;
+		put32(p + 8, 1);
+		break;
+	case REQ_QUERY_EXTENSION:
+		query_extension(c, req, len);
+		break;
+	case RR_MAJOR:
+		handle_randr(c, req, len);
+		break;
+	case XV_MAJOR:
+		handle_xv(c, req);
+		break;
+	default:
+		fprintf(stderr, "fake-x: unknown request %u\n", req[0]);
+		error(c, req, BAD_REQUEST, 0);
+		break;
+	}
+}
+
+/* Returns false if the client has to go. */
+static bool handle_input(Client *c)
+{
+	size_t done = 0;
+
+	if (!c->setup_done) {
+		done = handle_setup(c);
+		if (!done)
+			return c->in_len < 12 || c->in[0] == 'l';
+	}
+
+	while (c->in_len - done >= 4) {
+		const uint8_t *req = c->in + done;
+		size_t len = 4 * get16(req + 2);
+
+		/* No BIG-REQUESTS here */
+		if (!len)
+			return false;
+
+		if (c->in_len - done < len)
+			break;
+
+		c->sequence++;
+		fake.requests++;
+		handle_request(c, req, len);
+
+		done += len;
+	}
+
+	memmove(c->in, c->in + done, c->in_len - done);
+	c->in_len -= done;
+
+	return true;
+}
+
+static void serve_client(Client *c)
+{
+	bool output;
+	ssize_t r;
+
+	c->in = grow(c->in, &c->in_max, c->in_len + 4096);
+
+	r = read(c->fd, c->in + c->in_len, c->in_max - c->in_len);
+	if (r < 0 && errno == EINTR)
+		return;
+
+	pthread_mutex_lock(&fake.mutex);
+
+	if (r <= 0) {
+		drop_client(c);
+		pthread_mutex_unlock(&fake.mutex);
+		return;
+	}
+
+	c->in_len += r;
+	c->replied = false;
+
+	if (!handle_input(c)) {
+		drop_client(c);
+		pthread_mutex_unlock(&fake.mutex);
+		return;
+	}
+
+	if (c->replied)
+		fake.round_trips++;
+
+	output = pending_output();
+
+	pthread_mutex_unlock(&fake.mutex);
+
+	if (output && fake.config.latency_us)
+		usleep(fake.config.latency_us);
+
+	pthread_mutex_lock(&fake.mutex);
+	flush_clients();
+	pthread_mutex_unlock(&fake.mutex);
+}
+
+static void accept_client(void)
+{
+	int fd, i;
+
+	fd = accept(fake.listen_fd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	pthread_mutex_lock(&fake.mutex);
+
+	for (i = 0; i < MAX_CLIENTS; i++)
+		if (fake.clients[i].fd < 0)
+			break;
+
+	if (i == MAX_CLIENTS) {
+		fprintf(stderr, "fake-x: too many clients\n");
+		close(fd);
+	} else {
+		fake.clients[i].fd = fd;
+	}
+
+	pthread_mutex_unlock(&fake.mutex);
+}
+
+static void *server_thread(void *data)
+{
+	(void) data;
+
+	for (;;) {
+		struct pollfd pfds[2 + MAX_CLIENTS];
+		Client *clients[MAX_CLIENTS];
+		int i, num = 0;
+
+		pfds[0].fd = fake.wake_fds[0];
+		pfds[0].events = POLLIN;
+		pfds[1].fd = fake.listen_fd;
+		pfds[1].events = POLLIN;
+
+		/* Only this thread adds or drops clients */
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			if (fake.clients[i].fd < 0)
+				continue;
+
+			clients[num] = &fake.clients[i];
+			pfds[2 + num].fd = fake.clients[i].fd;
+			pfds[2 + num].events = POLLIN;
+			num++;
+		}
+
+		if (poll(pfds, 2 + num, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfds[0].revents)
+			break;
+
+		if (pfds[1].revents)
+			accept_client();
+
+		for (i = 0; i < num; i++)
+			if (pfds[2 + i].revents)
+				serve_client(clients[i]);
+	}
+
+	return NULL;
+}
+
+static void model_init(void)
+{
+	unsigned int i, j;
+
+	fake.start = monotonic_ms();
+
+	/* Only the predefined atoms we use have names */
+	fake.atoms[ATOM_ATOM] = strdup("ATOM");
+	fake.atoms[ATOM_INTEGER] = strdup("INTEGER");
+	fake.num_atoms = 69;
+
+	fake.timestamp = server_time();
+	fake.config_timestamp = fake.timestamp;
+
+	fake.crtcs[0] = (Crtc) { 0x40, 0x60, 0, 0, 1, };
+	fake.crtcs[1] = (Crtc) { 0x41, 0, 0, 0, 1, };
+	fake.outputs[0] = (Output) { 0x50, "LCD", 0x40, 0x40, 0x60, false, };
+	fake.outputs[1] = (Output) { TV_OUTPUT, "TV", 0, 0x41, 0x61, true, };
+
+	for (i = 0; i < NUM_PROPS; i++) {
+		const PropTemplate *t = &prop_templates[i];
+		Prop *prop = &fake.props[i];
+
+		prop->atom = intern(t->name);
+		prop->type = t->type;
+		prop->range = t->type == ATOM_INTEGER;
+
+		if (prop->range) {
+			prop->valid[0] = t->min;
+			prop->valid[1] = t->max;
+			prop->value = t->value;
+		} else {
+			for (j = 0; j < 2; j++)
+				prop->valid[j] = intern(t->choices[j]);
+			prop->value = prop->valid[0];
+		}
+	}
+
+	for (i = 0; i < NUM_ATTRS; i++) {
+		fake.attrs[i].atom = intern(attr_templates[i].name);
+		fake.attrs[i].value = attr_templates[i].value;
+	}
+
+	fake.after_get = false;
+	fake.round_trips = 0;
+	fake.requests = 0;
+}
+
+bool fake_x_start(const FakeXConfig *config)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char display[16];
+	int i, n;
+
+	fake.config = *config;
+
+	for (i = 0; i < MAX_CLIENTS; i++)
+		fake.clients[i].fd = -1;
+
+	model_init();
+
+	fake.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fake.listen_fd < 0)
+		goto err;
+
+	/* An abstract socket, which libxcb tries first, so no files. */
+	for (n = FIRST_DISPLAY; n < FIRST_DISPLAY + NUM_DISPLAYS; n++) {
+		int len = snprintf(addr.sun_path + 1, sizeof addr.sun_path - 1,
+				   "/tmp/.X11-unix/X%d", n);
+
+		if (bind(fake.listen_fd, (struct sockaddr *) &addr,
+			 offsetof(struct sockaddr_un, sun_path) + 1 + len) == 0)
+			break;
+
+		if (errno != EADDRINUSE)
+			goto err;
+	}
+
+	if (n == FIRST_DISPLAY + NUM_DISPLAYS ||
+	    listen(fake.listen_fd, MAX_CLIENTS) < 0)
+		goto err;
+
+	if (pipe(fake.wake_fds) < 0)
+		goto err;
+
+	if (pthread_create(&fake.thread, NULL, server_thread, NULL))
+		goto err;
+
+	snprintf(display, sizeof display, ":%d", n);
+	setenv("DISPLAY", display, 1);
+
+	return true;
+
+ err:
+	fprintf(stderr, "fake-x: can't start the server\n");
+	fake_x_stop();
+
+	return false;
+}
+
+void fake_x_stop(void)
+{
+	int i;
+
+	if (fake.wake_fds[1] >= 0) {
+		if (write(fake.wake_fds[1], "", 1) == 1)
+			pthread_join(fake.thread, NULL);
+		close(fake.wake_fds[0]);
+		close(fake.wake_fds[1]);
+	}
+	fake.wake_fds[0] = fake.wake_fds[1] = -1;
+
+	if (fake.listen_fd >= 0)
+		close(fake.listen_fd);
+	fake.listen_fd = -1;
+
+	for (i = 0; i < MAX_CLIENTS; i++)
+		if (fake.clients[i].fd >= 0)
+			drop_client(&fake.clients[i]);
+
+	for (i = 0; i < MAX_ATOMS; i++) {
+		free(fake.atoms[i]);
+		fake.atoms[i] = NULL;
+	}
+	fake.num_atoms = 0;
+}
+
+unsigned long fake_x_round_trips(void)
+{
+	unsigned long round_trips;
+
+	pthread_mutex_lock(&fake.mutex);
+	round_trips = fake.round_trips;
+	pthread_mutex_unlock(&fake.mutex);
+
+	return round_trips;
+}
+
+unsigned long fake_x_requests(void)
+{
+	unsigned long requests;
+
+	pthread_mutex_lock(&fake.mutex);
+	requests = fake.requests;
+	pthread_mutex_unlock(&fake.mutex);
+
+	return requests;
+}
+
+int fake_x_xv_set(const char *name, int value)
+{
+	Attr *attr;
+
+	pthread_mutex_lock(&fake.mutex);
+
+	attr = find_attr(XV_TV_PORT, atom_lookup(name, strlen(name)));
+	if (attr) {
+		xv_set(XV_TV_PORT, attr, value);
+		flush_clients();
+	}
+
+	pthread_mutex_unlock(&fake.mutex);
+
+	return attr ? 0 : -1;
+}
+
+int fake_x_xv_get(const char *name)
+{
+	Attr *attr;
+	int value = -1;
+
+	pthread_mutex_lock(&fake.mutex);
+
+	attr = find_attr(XV_TV_PORT, atom_lookup(name, strlen(name)));
+	if (attr)
+		value = attr->value;
+
+	pthread_mutex_unlock(&fake.mutex);
+
+	return value;
+}
+
+void fake_x_xv_set_after_get(const char *name, int value)
+{
+	pthread_mutex_lock(&fake.mutex);
+
+	fake.after_get = true;
+	fake.after_get_atom = atom_lookup(name, strlen(name));
+	fake.after_get_value = value;
+
+	pthread_mutex_unlock(&fake.mutex);
+}
@@ -0,0 +1,67 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef FAKE_X_H
+#define FAKE_X_H
+
+#include <stdbool.h>
+
+/*
+ * A small X server running in a thread of the test program, for
+ * when there's no Xvfb around, and since Xvfb has no Xv adaptors
+ * anyway. It speaks just enough of the core protocol, RandR 1.3
+ * and Xv for the backends, to little endian clients only. There
+ * is an LCD output, a TV output with the properties of the OMAP
+ * driver, and an Xv port with the XV_OMAP_* attributes.
+ */
+
+typedef struct {
+	/*
+	 * Time to sleep before sending whatever a batch of requests
+	 * produced, to stand in for the latency of a real server.
+	 */
+	unsigned int latency_us;
+} FakeXConfig;
+
+/* Starts the server and points $DISPLAY at it. */
+bool fake_x_start(const FakeXConfig *config);
+void fake_x_stop(void);
+
+/*
+ * Batches of requests that got a reply or an error, which are
+ * the round trips the clients may have waited for. Counted over
+ * all clients, as are the requests.
+ */
+unsigned long fake_x_round_trips(void);
+unsigned long fake_x_requests(void);
+
+/*
+ * Sets an Xv attribute of the TV port as another client would,
+ * notifies included. -1 if there's no such attribute.
+ */
+int fake_x_xv_set(const char *attr, int value);
+int fake_x_xv_get(const char *attr);
+
+/*
+ * Sets the Xv attribute to value right after the reply to the
+ * next GetPortAttribute of it has been sent.
+ */
+void fake_x_xv_set_after_get(const char *attr, int value);
+
+#endif
@@ -0,0 +1,357 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Measures what probing the X backends costs, on the fake X
+ * server of fake-x.c: the round trips the server saw, the
+ * requests, and the wall time of tvout_ctl_init() on its own,
+ * with the probe results cached, and with the async init. Then
+ * a set loop. The server adds $BENCH_LATENCY_US of latency to
+ * every round trip, 1000 by default, and the cost of opening
+ * the display is left out. The results are printed as JSON.
+ *
+ * Usage: probe-bench [iterations], $BENCH_ITERATIONS by default
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+
+#include "tvout-ctl.h"
+#include "bench.h"
+#include "fake-x.h"
+
+#define TIMEOUT_MS 2000
+
+static bool notified;
+static bool ready;
+static int ready_status;
+
+static void notify(void *ui_data, enum TVoutCtlAttr attr, int value)
+{
+	(void) ui_data;
+
+	if (attr == TVOUT_CTL_READY) {
+		ready = true;
+		ready_status = value;
+	} else {
+		notified = true;
+	}
+}
+
+/* What XOpenDisplay() and XCloseDisplay() cost on their own */
+static struct {
+	unsigned long round_trips;
+	unsigned long requests;
+	uint64_t ns;
+} display;
+
+static bool measure_display(int iterations)
+{
+	BenchSamples s;
+	int i;
+
+	bench_samples_init(&s, iterations);
+
+	for (i = 0; i < iterations; i++) {
+		unsigned long round_trips = fake_x_round_trips();
+		unsigned long requests = fake_x_requests();
+		uint64_t start = bench_now();
+		Display *dpy;
+
+		dpy = XOpenDisplay(NULL);
+		if (!dpy) {
+			bench_samples_free(&s);
+			return false;
+		}
+		XCloseDisplay(dpy);
+
+		bench_sample(&s, bench_now() - start);
+		display.round_trips = fake_x_round_trips() - round_trips;
+		display.requests = fake_x_requests() - requests;
+	}
+
+	/* The fastest one, so as not to overstate the init times */
+	display.ns = UINT64_MAX;
+	for (i = 0; i < s.num_samples; i++)
+		if (s.samples[i] < display.ns)
+			display.ns = s.samples[i];
+
+	bench_samples_free(&s);
+
+	return true;
+}
+
+static uint64_t minus_display(uint64_t ns)
+{
+	return ns > display.ns ? ns - display.ns : 0;
+}
+
+static TVoutCtl *open_ctl(unsigned int flags)
+{
+	TVoutCtlConfig config = {
+		.ui_notify = notify,
+		.flags = flags | TVOUT_CTL_INIT_NO_DAEMON | TVOUT_CTL_INIT_STATS,
+	};
+
+	return tvout_ctl_init_config(&config);
+}
+
+/*
+ * tvout_ctl_init() until it returns, and for the async init
+ * also until it's ready. The round trips and the requests are
+ * those of the last iteration, as they're the same every time.
+ */
+static bool bench_init(const char *key, unsigned int flags, int iterations)
+{
+	TVoutCtlStats stats;
+	BenchSamples init_s, ready_s;
+	unsigned long round_trips = 0;
+	unsigned long requests = 0;
+	int i;
+
+	bench_samples_init(&init_s, iterations);
+	bench_samples_init(&ready_s, iterations);
+
+	for (i = 0; i < iterations; i++) {
+		unsigned long start_round_trips = fake_x_round_trips();
+		unsigned long start_requests = fake_x_requests();
+		uint64_t start = bench_now();
+		TVoutCtl *ctl;
+
+		ready = false;
+
+		ctl = open_ctl(flags);
+		if (!ctl)
+			goto err;
+		bench_sample(&init_s, minus_display(bench_now() - start));
+
+		if (flags & TVOUT_CTL_INIT_ASYNC) {
+			if (!bench_wait(ctl, &ready, TIMEOUT_MS) ||
+			    ready_status != 1) {
+				tvout_ctl_exit(ctl);
+				goto err;
+			}
+			bench_sample(&ready_s, minus_display(bench_now() - start));
+		}
+
+		round_trips = fake_x_round_trips() - start_round_trips;
+		requests = fake_x_requests() - start_requests;
+		tvout_ctl_get_stats(ctl, &stats);
+
+		tvout_ctl_exit(ctl);
+	}
+
+	json_begin(key);
+	json_int("round_trips", round_trips - display.round_trips);
+	json_int("requests", requests - display.requests);
+	json_samples("init", &init_s);
+	if (flags & TVOUT_CTL_INIT_ASYNC)
+		json_samples("ready", &ready_s);
+	json_stats("stats", &stats);
+	json_end();
+
+	bench_samples_free(&init_s);
+	bench_samples_free(&ready_s);
+
+	return true;
+
+ err:
+	fprintf(stderr, "%s: tvout_ctl_init() failed\n", key);
+	bench_samples_free(&init_s);
+	bench_samples_free(&ready_s);
+
+	return false;
+}
+
+/* How long tvout_ctl_set() takes, and until the notify */
+static bool bench_set(int iterations)
+{
+	TVoutCtlStats stats;
+	BenchSamples call_s, notify_s;
+	unsigned long round_trips;
+	TVoutCtl *ctl;
+	int i;
+
+	ctl = open_ctl(0);
+	if (!ctl) {
+		fprintf(stderr, "set: tvout_ctl_init() failed\n");
+		return false;
+	}
+
+	bench_samples_init(&call_s, iterations);
+	bench_samples_init(&notify_s, iterations);
+	tvout_ctl_reset_stats(ctl);
+	round_trips = fake_x_round_trips();
+
+	for (i = 0; i < iterations; i++) {
+		uint64_t start;
+
+		notified = false;
+
+		start = bench_now();
+		tvout_ctl_set(ctl, TVOUT_CTL_SCALE, i & 1 ? 90 : 80);
+		bench_sample(&call_s, bench_now() - start);
+
+		if (bench_wait(ctl, &notified, TIMEOUT_MS))
+			bench_sample(&notify_s, bench_now() - start);
+		else
+			notify_s.timeouts++;
+	}
+
+	tvout_ctl_get_stats(ctl, &stats);
+
+	json_begin("set");
+	json_int("round_trips", fake_x_round_trips() - round_trips);
+	json_samples("call", &call_s);
+	json_samples("notify", &notify_s);
+	json_stats("stats", &stats);
+	json_end();
+
+	bench_samples_free(&call_s);
+	bench_samples_free(&notify_s);
+
+	tvout_ctl_exit(ctl);
+
+	return true;
+}
+
+static void cache_clean(const char *dir)
+{
+	struct dirent *d;
+	DIR *dp;
+
+	dp = opendir(dir);
+	if (!dp)
+		return;
+
+	while ((d = readdir(dp)))
+		if (d->d_name[0] != '.')
+			unlinkat(dirfd(dp), d->d_name, 0);
+
+	closedir(dp);
+}
+
+static bool bench_backend(const char *backend, const char *cache_dir,
+			  int iterations)
+{
+	TVoutCtl *ctl;
+	bool ok;
+
+	setenv("TVOUT_CTL_BACKEND", backend, 1);
+
+	json_begin(backend);
+
+	ok = bench_init("init", 0, iterations) &&
+		bench_init("init_async", TVOUT_CTL_INIT_ASYNC, iterations);
+
+	/* The first init fills the cache */
+	setenv("XDG_RUNTIME_DIR", cache_dir, 1);
+	ctl = ok ? open_ctl(0) : NULL;
+	if (ctl) {
+		tvout_ctl_exit(ctl);
+		ok = bench_init("init_cached", 0, iterations);
+	}
+	unsetenv("XDG_RUNTIME_DIR");
+	cache_clean(cache_dir);
+
+	ok = ok && ctl && bench_set(iterations);
+
+	json_end();
+
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *env = getenv("BENCH_ITERATIONS");
+	const char *latency = getenv("BENCH_LATENCY_US");
+	static const char *const backends[] = {
+#ifdef HAVE_XV_BACKEND
+		"xv",
+#endif
+#ifdef HAVE_XRANDR_BACKEND
+		"xrandr",
+#endif
+		NULL
+	};
+	FakeXConfig config = {
+		.latency_us = latency ? strtoul(latency, NULL, 0) : 1000,
+	};
+	char cache_dir[] = "/tmp/probe-bench-XXXXXX";
+	int iterations = 1000;
+	bool ok = true;
+	int i;
+
+	/* make check runs us without arguments */
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	else if (env)
+		iterations = atoi(env);
+
+	if (iterations <= 0)
+		iterations = 1;
+
+	/* Probe for real, each time */
+	unsetenv("XDG_RUNTIME_DIR");
+
+	if (!mkdtemp(cache_dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	if (!fake_x_start(&config)) {
+		fprintf(stderr, "Couldn't start the fake X server\n");
+		rmdir(cache_dir);
+		return 1;
+	}
+
+	json_begin(NULL);
+	json_int("iterations", iterations);
+	json_int("latency_us", config.latency_us);
+
+	if (measure_display(iterations)) {
+		json_begin("display");
+		json_int("round_trips", display.round_trips);
+		json_int("requests", display.requests);
+		json_int("ns", display.ns);
+		json_end();
+
+		for (i = 0; ok && backends[i]; i++)
+			ok = bench_backend(backends[i], cache_dir, iterations);
+	} else {
+		fprintf(stderr, "XOpenDisplay() failed\n");
+		ok = false;
+	}
+
+	json_end();
+
+	fake_x_stop();
+	rmdir(cache_dir);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,373 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Measures the library's own overhead on the sim backend, with
+ * no X server involved. The cheap calls are timed BATCH at a
+ * time and reported per call. fan_out_N delivers N changes per
+ * tvout_ctl_fd_ready() to all four kinds of callbacks. The
+ * results are printed as JSON.
+ *
+ * Usage: sim-bench [iterations], $BENCH_ITERATIONS by default
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tvout-ctl.h"
+#include "tvout-ctl-sim.h"
+#include "bench.h"
+
+#define BATCH 100
+#define TIMEOUT_MS 2000
+
+static int callbacks;
+static bool notified;
+
+static void notify(void *ui_data, enum TVoutCtlAttr attr, int value)
+{
+	(void) ui_data;
+	(void) attr;
+	(void) value;
+
+	callbacks++;
+	notified = true;
+}
+
+static void batch_notify(void *ui_data, unsigned int changed,
+			 const TVoutCtlState *state)
+{
+	(void) ui_data;
+	(void) changed;
+	(void) state;
+
+	callbacks++;
+}
+
+static void output_notify(void *ui_data, int output,
+			  enum TVoutCtlAttr attr, int value)
+{
+	(void) ui_data;
+	(void) output;
+	(void) attr;
+	(void) value;
+
+	callbacks++;
+}
+
+static void notify_ext(void *ui_data, const TVoutCtlNotifyInfo *info)
+{
+	(void) ui_data;
+	(void) info;
+
+	callbacks++;
+}
+
+static void set_done(void *data, enum TVoutCtlAttr attr, int value,
+		     int result)
+{
+	bool *done = data;
+
+	(void) attr;
+	(void) value;
+	(void) result;
+
+	*done = true;
+}
+
+static TVoutCtl *open_ctl(unsigned int flags, bool fan_out)
+{
+	TVoutCtlConfig config = {
+		.ui_notify = notify,
+		.flags = flags | TVOUT_CTL_INIT_NO_DAEMON | TVOUT_CTL_INIT_STATS,
+	};
+	TVoutCtl *ctl;
+
+	if (fan_out) {
+		config.batch_notify = batch_notify;
+		config.output_notify = output_notify;
+		config.notify_ext = notify_ext;
+	}
+
+	ctl = tvout_ctl_init_config(&config);
+	if (!ctl)
+		return NULL;
+
+	/* Reports every change on the next tvout_ctl_fd_ready() */
+	if (tvout_ctl_sim_set_latency(ctl, 0) < 0) {
+		tvout_ctl_exit(ctl);
+		return NULL;
+	}
+
+	return ctl;
+}
+
+static void drain(TVoutCtl *ctl)
+{
+	while (tvout_ctl_needs_dispatch(ctl))
+		tvout_ctl_dispatch_pending(ctl);
+}
+
+static void print_phase(TVoutCtl *ctl, const char *key,
+			const char *samples_key, const BenchSamples *s)
+{
+	TVoutCtlStats stats;
+
+	tvout_ctl_get_stats(ctl, &stats);
+
+	json_begin(key);
+	json_samples(samples_key, s);
+	json_stats("stats", &stats);
+	json_end();
+}
+
+/* tvout_ctl_get() and tvout_ctl_get_state() */
+static void bench_get(TVoutCtl *ctl, int iterations)
+{
+	BenchSamples get_s, state_s;
+	TVoutCtlState state;
+	int i, j;
+
+	bench_samples_init(&get_s, iterations);
+	bench_samples_init(&state_s, iterations);
+
+	for (i = 0; i < iterations; i++) {
+		uint64_t start = bench_now();
+
+		for (j = 0; j < BATCH; j++)
+			tvout_ctl_get(ctl, TVOUT_CTL_SCALE);
+		bench_sample(&get_s, (bench_now() - start) / BATCH);
+
+		start = bench_now();
+		for (j = 0; j < BATCH; j++)
+			tvout_ctl_get_state(ctl, &state);
+		bench_sample(&state_s, (bench_now() - start) / BATCH);
+	}
+
+	json_begin("get");
+	json_samples("get", &get_s);
+	json_samples("get_state", &state_s);
+	json_end();
+
+	bench_samples_free(&get_s);
+	bench_samples_free(&state_s);
+}
+
+/* tvout_ctl_set() to the current value, which sends nothing */
+static void bench_set_redundant(TVoutCtl *ctl, int iterations)
+{
+	int value = tvout_ctl_get(ctl, TVOUT_CTL_SCALE);
+	BenchSamples s;
+	int i, j;
+
+	bench_samples_init(&s, iterations);
+	tvout_ctl_reset_stats(ctl);
+
+	for (i = 0; i < iterations; i++) {
+		uint64_t start = bench_now();
+
+		for (j = 0; j < BATCH; j++)
+			tvout_ctl_set(ctl, TVOUT_CTL_SCALE, value);
+		bench_sample(&s, (bench_now() - start) / BATCH);
+	}
+
+	print_phase(ctl, "set_redundant", "call", &s);
+
+	bench_samples_free(&s);
+}
+
+/* How long tvout_ctl_set() takes, and until the notify */
+static void bench_set(TVoutCtl *ctl, int iterations)
+{
+	TVoutCtlStats stats;
+	BenchSamples call_s, notify_s;
+	int i;
+
+	bench_samples_init(&call_s, iterations);
+	bench_samples_init(&notify_s, iterations);
+	tvout_ctl_reset_stats(ctl);
+
+	for (i = 0; i < iterations; i++) {
+		uint64_t start;
+
+		notified = false;
+
+		start = bench_now();
+		tvout_ctl_set(ctl, TVOUT_CTL_SCALE, i & 1 ? 90 : 80);
+		bench_sample(&call_s, bench_now() - start);
+
+		if (bench_wait(ctl, &notified, TIMEOUT_MS))
+			bench_sample(&notify_s, bench_now() - start);
+		else
+			notify_s.timeouts++;
+	}
+
+	tvout_ctl_get_stats(ctl, &stats);
+
+	json_begin("set");
+	json_samples("call", &call_s);
+	json_samples("notify", &notify_s);
+	json_stats("stats", &stats);
+	json_end();
+
+	bench_samples_free(&call_s);
+	bench_samples_free(&notify_s);
+}
+
+/* tvout_ctl_set_async() until done */
+static void bench_set_async(TVoutCtl *ctl, const char *key, int iterations)
+{
+	BenchSamples s;
+	int i;
+
+	bench_samples_init(&s, iterations);
+	tvout_ctl_reset_stats(ctl);
+
+	for (i = 0; i < iterations; i++) {
+		bool done = false;
+		uint64_t start = bench_now();
+
+		tvout_ctl_set_async(ctl, TVOUT_CTL_SCALE, i & 1 ? 90 : 80,
+				    TIMEOUT_MS, set_done, &done);
+
+		if (bench_wait(ctl, &done, TIMEOUT_MS))
+			bench_sample(&s, bench_now() - start);
+		else
+			s.timeouts++;
+	}
+
+	print_phase(ctl, key, "done", &s);
+
+	bench_samples_free(&s);
+}
+
+/*
+ * One tvout_ctl_fd_ready() delivering num_changes changes made
+ * by "someone else", to however many callbacks there are.
+ */
+static void bench_fd_ready(TVoutCtl *ctl, const char *key, int num_changes,
+			   int iterations)
+{
+	TVoutCtlStats stats;
+	BenchSamples s;
+	int i, j;
+
+	bench_samples_init(&s, iterations);
+	tvout_ctl_reset_stats(ctl);
+	callbacks = 0;
+
+	for (i = 0; i < iterations; i++) {
+		uint64_t start;
+
+		for (j = 0; j < num_changes; j++)
+			tvout_ctl_sim_change(ctl, TVOUT_CTL_XOFFSET,
+					     (i * num_changes + j) & 1 ? 10 : 20);
+
+		start = bench_now();
+		tvout_ctl_fd_ready(ctl);
+		bench_sample(&s, bench_now() - start);
+
+		/* Whatever didn't fit in one go */
+		drain(ctl);
+	}
+
+	tvout_ctl_get_stats(ctl, &stats);
+
+	json_begin(key);
+	json_int("changes", num_changes);
+	json_int("callbacks", callbacks);
+	json_samples("latency", &s);
+	json_stats("stats", &stats);
+	json_end();
+
+	bench_samples_free(&s);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *env = getenv("BENCH_ITERATIONS");
+	int iterations = 1000;
+	TVoutCtl *ctl;
+
+	/* make check runs us without arguments */
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	else if (env)
+		iterations = atoi(env);
+
+	if (iterations <= 0)
+		iterations = 1;
+
+	setenv("TVOUT_CTL_BACKEND", "sim", 1);
+
+	ctl = open_ctl(0, false);
+	if (!ctl) {
+		fprintf(stderr, "The sim backend isn't available\n");
+		return 1;
+	}
+
+	json_begin(NULL);
+	json_string("backend", "sim");
+	json_int("iterations", iterations);
+	json_int("batch", BATCH);
+
+	bench_get(ctl, iterations);
+	bench_set_redundant(ctl, iterations);
+	bench_set(ctl, iterations);
+	bench_set_async(ctl, "set_async", iterations);
+	bench_fd_ready(ctl, "fd_ready", 1, iterations);
+
+	tvout_ctl_exit(ctl);
+
+	/* ui_notify, batch_notify, output_notify and notify_ext */
+	ctl = open_ctl(0, true);
+	if (!ctl)
+		goto err;
+
+	bench_fd_ready(ctl, "fan_out_1", 1, iterations);
+	bench_fd_ready(ctl, "fan_out_8", 8, iterations);
+	bench_fd_ready(ctl, "fan_out_64", 64, iterations);
+
+	tvout_ctl_exit(ctl);
+
+	/* Through the library's event thread */
+	ctl = open_ctl(TVOUT_CTL_INIT_THREAD, false);
+	if (!ctl)
+		goto err;
+
+	bench_set_async(ctl, "thread_set_async", iterations);
+
+	tvout_ctl_exit(ctl);
+
+	json_end();
+
+	return 0;
+
+ err:
+	json_end();
+	fprintf(stderr, "The sim backend isn't available\n");
+
+	return 1;
+}
@@ -0,0 +1,289 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Reads the attributes from several threads while others set
+ * them and the event drain runs, on the sim backend. Build with
+ * --enable-tsan to have ThreadSanitizer look at it as well. It
+ * runs once with TVOUT_CTL_INIT_THREAD, where the sets come from
+ * threads of their own, and once with the event drain and the
+ * sets in the main thread.
+ *
+ * TVOUT_CTL_XOFFSET only ever goes up, so the readers check
+ * that they never see it go back, on top of the ranges.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tvout-ctl.h"
+#include "tvout-ctl-sim.h"
+#include "bench.h"
+
+#define NUM_READERS 4
+#define NUM_CHANGES 2000
+#define TIMEOUT_MS 10000
+
+/* Starts from the default, and goes up one at a time */
+#define FIRST_XOFFSET 0
+#define LAST_XOFFSET 128
+#define NUM_SETS (LAST_XOFFSET - FIRST_XOFFSET + 1)
+
+static const struct {
+	int min;
+	int max;
+} ranges[TVOUT_CTL_NUM_ATTRS] = {
+	[TVOUT_CTL_ENABLE] = { 0, 1, },
+	[TVOUT_CTL_TV_STD] = { 0, 1, },
+	[TVOUT_CTL_ASPECT] = { 0, 1, },
+	[TVOUT_CTL_SCALE] = { 1, 100, },
+	[TVOUT_CTL_DYNAMIC_ASPECT] = { 0, 1, },
+	[TVOUT_CTL_XOFFSET] = { -128, 128, },
+	[TVOUT_CTL_YOFFSET] = { -128, 128, },
+	[TVOUT_CTL_FULLSCREEN_VIDEO] = { 0, 1, },
+	[TVOUT_CTL_READY] = { 1, 1, },
+};
+
+typedef struct {
+	TVoutCtl *ctl;
+	int stop;
+	int failed;
+	int sets_left;
+	int changes_left;
+	/* Touched by the callbacks only, which run in the main thread */
+	int notifies;
+	TVoutCtlState notified;
+} Stress;
+
+static void fail(Stress *s, const char *what, int attr, int value)
+{
+	if (!__atomic_exchange_n(&s->failed, 1, __ATOMIC_RELAXED))
+		fprintf(stderr, "%s: attribute %d is %d\n", what, attr, value);
+}
+
+static void *reader_main(void *data)
+{
+	Stress *s = data;
+	int last = FIRST_XOFFSET;
+
+	while (!__atomic_load_n(&s->stop, __ATOMIC_RELAXED)) {
+		TVoutCtlState state;
+		int i, value;
+
+		value = tvout_ctl_get(s->ctl, TVOUT_CTL_XOFFSET);
+		if (value < last)
+			fail(s, "went back", TVOUT_CTL_XOFFSET, value);
+		last = value;
+
+		tvout_ctl_get_state(s->ctl, &state);
+
+		for (i = 0; i < TVOUT_CTL_NUM_ATTRS; i++)
+			if (state.values[i] < ranges[i].min ||
+			    state.values[i] > ranges[i].max)
+				fail(s, "out of range", i, state.values[i]);
+
+		if (state.values[TVOUT_CTL_XOFFSET] < last)
+			fail(s, "went back", TVOUT_CTL_XOFFSET,
+			     state.values[TVOUT_CTL_XOFFSET]);
+		last = state.values[TVOUT_CTL_XOFFSET];
+	}
+
+	return NULL;
+}
+
+static void notify(void *ui_data, enum TVoutCtlAttr attr, int value)
+{
+	Stress *s = ui_data;
+
+	s->notifies++;
+	s->notified.values[attr] = value;
+}
+
+static void set_done(void *data, enum TVoutCtlAttr attr, int value,
+		     int result)
+{
+	Stress *s = data;
+
+	if (result != TVOUT_CTL_SET_OK)
+		fail(s, "set failed", attr, value);
+
+	__atomic_sub_fetch(&s->sets_left, 1, __ATOMIC_RELAXED);
+}
+
+/* The XOFFSET values, every other one asynchronously */
+static void set_step(Stress *s, int i)
+{
+	int value = FIRST_XOFFSET + i;
+
+	if (i & 1) {
+		if (tvout_ctl_set_async(s->ctl, TVOUT_CTL_XOFFSET, value,
+					TIMEOUT_MS, set_done, s) < 0)
+			fail(s, "set_async", TVOUT_CTL_XOFFSET, value);
+		return;
+	}
+
+	if (tvout_ctl_set(s->ctl, TVOUT_CTL_XOFFSET, value) < 0)
+		fail(s, "set", TVOUT_CTL_XOFFSET, value);
+	__atomic_sub_fetch(&s->sets_left, 1, __ATOMIC_RELAXED);
+}
+
+static void *setter_main(void *data)
+{
+	Stress *s = data;
+	int i;
+
+	for (i = 0; i < NUM_SETS; i++)
+		set_step(s, i);
+
+	return NULL;
+}
+
+#define CHANGE_YOFFSET(i) ((i) % 200 - 100)
+#define CHANGE_SCALE(i) ((i) % 100 + 1)
+
+/* Someone else keeps changing the other attributes. */
+static void change_step(Stress *s, int i)
+{
+	if (tvout_ctl_sim_change(s->ctl, TVOUT_CTL_YOFFSET, CHANGE_YOFFSET(i)) < 0 ||
+	    tvout_ctl_set(s->ctl, TVOUT_CTL_SCALE, CHANGE_SCALE(i)) < 0)
+		fail(s, "change", TVOUT_CTL_SCALE, CHANGE_SCALE(i));
+
+	__atomic_sub_fetch(&s->changes_left, 1, __ATOMIC_RELAXED);
+}
+
+static void *changer_main(void *data)
+{
+	Stress *s = data;
+	int i;
+
+	for (i = 0; i < NUM_CHANGES; i++)
+		change_step(s, i);
+
+	return NULL;
+}
+
+/* Everything has been done, and the last changes notified */
+static bool settled(Stress *s)
+{
+	const int *last = s->notified.values;
+
+	return !__atomic_load_n(&s->sets_left, __ATOMIC_RELAXED) &&
+		!__atomic_load_n(&s->changes_left, __ATOMIC_RELAXED) &&
+		last[TVOUT_CTL_XOFFSET] == LAST_XOFFSET &&
+		last[TVOUT_CTL_YOFFSET] == CHANGE_YOFFSET(NUM_CHANGES - 1) &&
+		last[TVOUT_CTL_SCALE] == CHANGE_SCALE(NUM_CHANGES - 1);
+}
+
+static void dispatch(Stress *s, int timeout_ms)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = tvout_ctl_fd(s->ctl), .events = POLLIN, },
+		{ .fd = tvout_ctl_timer_fd(s->ctl), .events = POLLIN, },
+	};
+
+	if (tvout_ctl_needs_dispatch(s->ctl) ||
+	    poll(pfd, pfd[1].fd >= 0 ? 2 : 1, timeout_ms) > 0)
+		tvout_ctl_fd_ready(s->ctl);
+}
+
+static bool run(unsigned int flags)
+{
+	TVoutCtlConfig config = {
+		.ui_notify = notify,
+		.flags = flags | TVOUT_CTL_INIT_NO_DAEMON,
+	};
+	bool threaded = flags & TVOUT_CTL_INIT_THREAD;
+	pthread_t readers[NUM_READERS], setter, changer;
+	Stress s = {
+		.sets_left = NUM_SETS,
+		.changes_left = NUM_CHANGES,
+	};
+	uint64_t deadline;
+	bool ok;
+	int i;
+
+	config.ui_data = &s;
+
+	s.ctl = tvout_ctl_init_config(&config);
+	if (!s.ctl || tvout_ctl_sim_set_latency(s.ctl, 10) < 0) {
+		fprintf(stderr, "The sim backend isn't available\n");
+		return false;
+	}
+
+	tvout_ctl_get_state(s.ctl, &s.notified);
+
+	for (i = 0; i < NUM_READERS; i++)
+		pthread_create(&readers[i], NULL, reader_main, &s);
+
+	if (threaded) {
+		pthread_create(&setter, NULL, setter_main, &s);
+		pthread_create(&changer, NULL, changer_main, &s);
+	} else {
+		/* Interleaved with the event drain */
+		for (i = 0; i < NUM_SETS || i < NUM_CHANGES; i++) {
+			if (i < NUM_SETS)
+				set_step(&s, i);
+			if (i < NUM_CHANGES)
+				change_step(&s, i);
+			dispatch(&s, 0);
+		}
+	}
+
+	deadline = bench_now() + TIMEOUT_MS * 1000000ULL;
+	while (!(ok = settled(&s)) && bench_now() < deadline)
+		dispatch(&s, 10);
+
+	if (threaded) {
+		pthread_join(setter, NULL);
+		pthread_join(changer, NULL);
+	}
+
+	__atomic_store_n(&s.stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < NUM_READERS; i++)
+		pthread_join(readers[i], NULL);
+
+	if (!ok)
+		fail(&s, "timed out", TVOUT_CTL_XOFFSET,
+		     s.notified.values[TVOUT_CTL_XOFFSET]);
+
+	tvout_ctl_exit(s.ctl);
+
+	printf("%s: %d notifies%s\n", threaded ? "thread" : "inline",
+	       s.notifies, s.failed ? ", FAILED" : "");
+
+	return !s.failed;
+}
+
+int main(void)
+{
+	setenv("TVOUT_CTL_BACKEND", "sim", 1);
+
+	if (!run(TVOUT_CTL_INIT_THREAD) || !run(0))
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,402 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Measures the RandR backend against a live X server, normally the
+ * Xvfb that xvfb-bench.sh sets up. $TVOUT_CTL_OUTPUT has to name
+ * an output with the TV properties, see fake-tv-output.c. The
+ * set and event latencies are measured again through the event
+ * thread of TVOUT_CTL_INIT_THREAD, as thread_*. The results are
+ * printed as JSON.
+ *
+ * Usage: xrandr-bench [iterations]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xcb/xcb.h>
+#include <xcb/randr.h>
+
+#include "tvout-ctl.h"
+#include "bench.h"
+#include "xrandr-util.h"
+
+#define TIMEOUT_MS 2000
+
+/* The change we're waiting to hear about */
+static struct {
+	enum TVoutCtlAttr attr;
+	int value;
+	bool seen;
+	uint64_t time;
+} expect;
+
+static void expect_change(enum TVoutCtlAttr attr, int value)
+{
+	expect.attr = attr;
+	expect.value = value;
+	expect.seen = false;
+}
+
+static void notify(void *ui_data, enum TVoutCtlAttr attr, int value)
+{
+	(void) ui_data;
+
+	if (!expect.seen && attr == expect.attr && value == expect.value) {
+		expect.seen = true;
+		expect.time = bench_now();
+	}
+}
+
+static void set_done(void *data, enum TVoutCtlAttr attr, int value,
+		     int result)
+{
+	bool *done = data;
+
+	(void) attr;
+	(void) value;
+	(void) result;
+
+	*done = true;
+}
+
+static TVoutCtl *open_ctl(unsigned int flags)
+{
+	TVoutCtlConfig config = {
+		.ui_notify = notify,
+		.flags = flags | TVOUT_CTL_INIT_NO_DAEMON | TVOUT_CTL_INIT_STATS,
+	};
+	TVoutCtl *ctl;
+
+	ctl = tvout_ctl_init_config(&config);
+	if (!ctl)
+		fprintf(stderr, "tvout_ctl_init() failed\n");
+
+	return ctl;
+}
+
+static bool bench_init(const char *key, int iterations)
+{
+	TVoutCtlStats stats = { 0 };
+	BenchSamples s;
+	int i;
+
+	if (!bench_samples_init(&s, iterations)) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		uint64_t start = bench_now();
+		TVoutCtl *ctl = open_ctl(0);
+
+		if (!ctl) {
+			bench_samples_free(&s);
+			return false;
+		}
+
+		bench_sample(&s, bench_now() - start);
+
+		if (i == iterations - 1)
+			tvout_ctl_get_stats(ctl, &stats);
+
+		tvout_ctl_exit(ctl);
+	}
+
+	json_begin(key);
+	json_samples("latency", &s);
+	json_stats("stats", &stats);
+	json_end();
+
+	bench_samples_free(&s);
+
+	return true;
+}
+
+/* tvout_ctl_set_async() until done, and until the notify */
+static void bench_set_async(TVoutCtl *ctl, const char *key, int iterations)
+{
+	TVoutCtlStats stats;
+	BenchSamples done_s, notify_s;
+	int i;
+
+	bench_samples_init(&done_s, iterations);
+	bench_samples_init(&notify_s, iterations);
+	tvout_ctl_reset_stats(ctl);
+
+	for (i = 0; i < iterations; i++) {
+		int value = i & 1 ? 90 : 80;
+		bool done = false;
+		uint64_t start;
+
+		expect_change(TVOUT_CTL_SCALE, value);
+
+		start = bench_now();
+		tvout_ctl_set_async(ctl, TVOUT_CTL_SCALE, value, TIMEOUT_MS,
+				    set_done, &done);
+
+		if (bench_wait(ctl, &done, TIMEOUT_MS))
+			bench_sample(&done_s, bench_now() - start);
+		else
+			done_s.timeouts++;
+
+		if (bench_wait(ctl, &expect.seen, TIMEOUT_MS))
+			bench_sample(&notify_s, expect.time - start);
+		else
+			notify_s.timeouts++;
+	}
+
+	tvout_ctl_get_stats(ctl, &stats);
+
+	json_begin(key);
+	json_samples("done", &done_s);
+	json_samples("notify", &notify_s);
+	json_stats("stats", &stats);
+	json_end();
+
+	bench_samples_free(&done_s);
+	bench_samples_free(&notify_s);
+}
+
+/* How long tvout_ctl_set() takes, and until the notify */
+static void bench_set(TVoutCtl *ctl, int iterations)
+{
+	TVoutCtlStats stats;
+	BenchSamples call_s, notify_s;
+	int i;
+
+	bench_samples_init(&call_s, iterations);
+	bench_samples_init(&notify_s, iterations);
+	tvout_ctl_reset_stats(ctl);
+
+	for (i = 0; i < iterations; i++) {
+		int value = i & 1 ? 90 : 80;
+		uint64_t start;
+
+		expect_change(TVOUT_CTL_SCALE, value);
+
+		start = bench_now();
+		tvout_ctl_set(ctl, TVOUT_CTL_SCALE, value);
+		bench_sample(&call_s, bench_now() - start);
+
+		if (bench_wait(ctl, &expect.seen, TIMEOUT_MS))
+			bench_sample(&notify_s, expect.time - start);
+		else
+			notify_s.timeouts++;
+	}
+
+	tvout_ctl_get_stats(ctl, &stats);
+
+	json_begin("set");
+	json_samples("call", &call_s);
+	json_samples("notify", &notify_s);
+	json_stats("stats", &stats);
+	json_end();
+
+	bench_samples_free(&call_s);
+	bench_samples_free(&notify_s);
+}
+
+/* Someone else changes the property, until the notify */
+static bool bench_event_notify(TVoutCtl *ctl, const char *key,
+			       int iterations)
+{
+	xcb_connection_t *conn;
+	const char *wanted = getenv("TVOUT_CTL_OUTPUT");
+	xcb_randr_output_t output;
+	xcb_atom_t atom;
+	TVoutCtlStats stats;
+	BenchSamples s;
+	char name[64];
+	int i, screen_num;
+
+	conn = xcb_connect(NULL, &screen_num);
+	if (xcb_connection_has_error(conn)) {
+		fprintf(stderr, "Can't open display\n");
+		xcb_disconnect(conn);
+		return false;
+	}
+
+	if (!xrandr_find_output(conn, xrandr_root(conn, screen_num),
+				wanted, &output, name, sizeof name)) {
+		if (wanted)
+			fprintf(stderr, "RandR output %s not found\n", wanted);
+		else
+			fprintf(stderr, "No RandR outputs\n");
+		xcb_disconnect(conn);
+		return false;
+	}
+
+	atom = xrandr_intern(conn, "TVScale");
+
+	bench_samples_init(&s, iterations);
+	tvout_ctl_reset_stats(ctl);
+
+	for (i = 0; i < iterations; i++) {
+		uint32_t value = i & 1 ? 75 : 70;
+		uint64_t start;
+
+		expect_change(TVOUT_CTL_SCALE, value);
+
+		start = bench_now();
+		xcb_randr_change_output_property(conn, output, atom,
+						 XCB_ATOM_INTEGER, 32,
+						 XCB_PROP_MODE_REPLACE,
+						 1, &value);
+		xcb_flush(conn);
+
+		if (bench_wait(ctl, &expect.seen, TIMEOUT_MS))
+			bench_sample(&s, expect.time - start);
+		else
+			s.timeouts++;
+	}
+
+	tvout_ctl_get_stats(ctl, &stats);
+
+	json_begin(key);
+	json_samples("latency", &s);
+	json_stats("stats", &stats);
+	json_end();
+
+	bench_samples_free(&s);
+	xcb_disconnect(conn);
+
+	return true;
+}
+
+/* tvout_ctl_set(TVOUT_CTL_ENABLE, 1) until the output is on */
+static void bench_enable(TVoutCtl *ctl, int iterations)
+{
+	TVoutCtlStats stats;
+	BenchSamples s;
+	int i;
+
+	bench_samples_init(&s, iterations);
+	tvout_ctl_reset_stats(ctl);
+
+	for (i = 0; i < iterations; i++) {
+		uint64_t start;
+
+		if (tvout_ctl_get(ctl, TVOUT_CTL_ENABLE)) {
+			expect_change(TVOUT_CTL_ENABLE, 0);
+			tvout_ctl_set(ctl, TVOUT_CTL_ENABLE, 0);
+			bench_wait(ctl, &expect.seen, TIMEOUT_MS);
+		}
+
+		expect_change(TVOUT_CTL_ENABLE, 1);
+
+		start = bench_now();
+		tvout_ctl_set(ctl, TVOUT_CTL_ENABLE, 1);
+
+		if (bench_wait(ctl, &expect.seen, TIMEOUT_MS))
+			bench_sample(&s, expect.time - start);
+		else
+			s.timeouts++;
+	}
+
+	tvout_ctl_get_stats(ctl, &stats);
+
+	json_begin("enable");
+	json_samples("latency", &s);
+	json_stats("stats", &stats);
+	json_end();
+
+	bench_samples_free(&s);
+}
+
+int main(int argc, char *argv[])
+{
+	char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	int iterations = argc > 1 ? atoi(argv[1]) : 100;
+	TVoutCtl *ctl;
+
+	if (iterations <= 0)
+		iterations = 1;
+
+	json_begin(NULL);
+	json_string("backend", "xrandr");
+	json_string("output", getenv("TVOUT_CTL_OUTPUT"));
+	json_int("iterations", iterations);
+
+	/* Without the cache, and then with it */
+	if (runtime_dir)
+		runtime_dir = strdup(runtime_dir);
+	unsetenv("XDG_RUNTIME_DIR");
+	if (!bench_init("init_cold", iterations))
+		goto err;
+
+	if (runtime_dir) {
+		setenv("XDG_RUNTIME_DIR", runtime_dir, 1);
+
+		/* The first one writes the cache */
+		ctl = open_ctl(0);
+		if (!ctl)
+			goto err;
+		tvout_ctl_exit(ctl);
+
+		if (!bench_init("init_warm", iterations))
+			goto err;
+	}
+
+	ctl = open_ctl(0);
+	if (!ctl)
+		goto err;
+
+	bench_set_async(ctl, "set_async", iterations);
+	bench_set(ctl, iterations);
+	if (!bench_event_notify(ctl, "event_notify", iterations)) {
+		tvout_ctl_exit(ctl);
+		goto err;
+	}
+	bench_enable(ctl, iterations);
+
+	tvout_ctl_exit(ctl);
+
+	/* The same with the library's event thread in between */
+	ctl = open_ctl(TVOUT_CTL_INIT_THREAD);
+	if (!ctl)
+		goto err;
+
+	bench_set_async(ctl, "thread_set_async", iterations);
+	if (!bench_event_notify(ctl, "thread_event_notify", iterations)) {
+		tvout_ctl_exit(ctl);
+		goto err;
+	}
+
+	tvout_ctl_exit(ctl);
+	free(runtime_dir);
+
+	json_end();
+
+	return 0;
+
+ err:
+	free(runtime_dir);
+	json_end();
+
+	return 1;
+}
@@ -0,0 +1,102 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "xrandr-util.h"
+
+xcb_window_t xrandr_root(xcb_connection_t *conn, int screen_num)
+{
+	xcb_screen_iterator_t screen;
+
+	screen = xcb_setup_roots_iterator(xcb_get_setup(conn));
+	for (; screen_num > 0; screen_num--)
+		xcb_screen_next(&screen);
+
+	return screen.data->root;
+}
+
+xcb_atom_t xrandr_intern(xcb_connection_t *conn, const char *name)
+{
+	xcb_intern_atom_reply_t *reply;
+	xcb_atom_t atom;
+
+	reply = xcb_intern_atom_reply(conn,
+				      xcb_intern_atom(conn, 0, strlen(name), name),
+				      NULL);
+	if (!reply)
+		return XCB_ATOM_NONE;
+
+	atom = reply->atom;
+	free(reply);
+
+	return atom;
+}
+
+bool xrandr_find_output(xcb_connection_t *conn, xcb_window_t root,
+			const char *wanted, xcb_randr_output_t *output,
+			char *name, int len)
+{
+	xcb_randr_get_screen_resources_current_reply_t *resources;
+	xcb_randr_output_t *outputs;
+	bool found = false;
+	int i, num_outputs;
+
+	resources = xcb_randr_get_screen_resources_current_reply(conn,
+								 xcb_randr_get_screen_resources_current(conn, root),
+								 NULL);
+	if (!resources)
+		return false;
+
+	outputs = xcb_randr_get_screen_resources_current_outputs(resources);
+	num_outputs = xcb_randr_get_screen_resources_current_outputs_length(resources);
+
+	for (i = 0; i < num_outputs && !found; i++) {
+		xcb_randr_get_output_info_reply_t *info;
+		int name_len;
+
+		info = xcb_randr_get_output_info_reply(conn,
+						       xcb_randr_get_output_info(conn, outputs[i],
+										 resources->config_timestamp),
+						       NULL);
+		if (!info)
+			continue;
+
+		name_len = xcb_randr_get_output_info_name_length(info);
+		if (name_len < len &&
+		    (!wanted || ((int) strlen(wanted) == name_len &&
+				 !memcmp(wanted, xcb_randr_get_output_info_name(info), name_len)))) {
+			memcpy(name, xcb_randr_get_output_info_name(info), name_len);
+			name[name_len] = '\0';
+			*output = outputs[i];
+			found = true;
+		}
+
+		free(info);
+	}
+
+	free(resources);
+
+	return found;
+}
@@ -0,0 +1,40 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef XRANDR_UTIL_H
+#define XRANDR_UTIL_H
+
+#include <stdbool.h>
+
+#include <xcb/xcb.h>
+#include <xcb/randr.h>
+
+/* Blocking helpers for the test programs */
+xcb_window_t xrandr_root(xcb_connection_t *conn, int screen_num);
+xcb_atom_t xrandr_intern(xcb_connection_t *conn, const char *name);
+
+/*
+ * The output called wanted, or the first one if that's NULL.
+ * Its name goes to name.
+ */
+bool xrandr_find_output(xcb_connection_t *conn, xcb_window_t root,
+			const char *wanted, xcb_randr_output_t *output,
+			char *name, int len);
+
+#endif
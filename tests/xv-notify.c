@@ -0,0 +1,123 @@
+/*
+ * Maemo TV out control
+ * Copyright (C) 2010-2012  Ville Syrjälä <syrjala@sci.fi>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Checks that the Xv backend ends up with the value the server
+ * has when an attribute changes back while the notify of the
+ * previous change is still being double checked. The notify of
+ * the change back carries the value the backend had before, and
+ * has to be checked all the same. Runs on the fake X server of
+ * fake-x.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tvout-ctl.h"
+#include "bench.h"
+#include "fake-x.h"
+
+#define TIMEOUT_MS 2000
+
+#define SCALE "XV_OMAP_TVOUT_SCALE"
+
+static struct {
+	int value;
+	bool changed;
+} scale;
+
+static void notify(void *ui_data, enum TVoutCtlAttr attr, int value)
+{
+	(void) ui_data;
+
+	if (attr != TVOUT_CTL_SCALE)
+		return;
+
+	scale.value = value;
+	scale.changed = true;
+}
+
+static bool wait_scale(TVoutCtl *ctl, int value)
+{
+	while (scale.value != value) {
+		scale.changed = false;
+		if (!bench_wait(ctl, &scale.changed, TIMEOUT_MS))
+			return false;
+	}
+
+	return true;
+}
+
+int main(void)
+{
+	TVoutCtlConfig config = {
+		.ui_notify = notify,
+		.flags = TVOUT_CTL_INIT_NO_DAEMON,
+	};
+	FakeXConfig fake_config = { 0 };
+	TVoutCtl *ctl;
+	int r = 1;
+
+	setenv("TVOUT_CTL_BACKEND", "xv", 1);
+	unsetenv("XDG_RUNTIME_DIR");
+
+	if (!fake_x_start(&fake_config))
+		return 99;
+
+	ctl = tvout_ctl_init_config(&config);
+	if (!ctl) {
+		fprintf(stderr, "tvout_ctl_init() failed\n");
+		fake_x_stop();
+		return 99;
+	}
+
+	scale.value = tvout_ctl_get(ctl, TVOUT_CTL_SCALE);
+	if (scale.value != 90) {
+		fprintf(stderr, "Scale is %d instead of 90\n", scale.value);
+		goto out;
+	}
+
+	/* Back to 90 right after the server has told us it's 80 */
+	fake_x_xv_set_after_get(SCALE, 90);
+	fake_x_xv_set(SCALE, 80);
+
+	if (!wait_scale(ctl, 80)) {
+		fprintf(stderr, "The change to 80 wasn't notified\n");
+		goto out;
+	}
+
+	if (!wait_scale(ctl, 90)) {
+		fprintf(stderr, "Scale stuck at %d, the server has %d\n",
+			tvout_ctl_get(ctl, TVOUT_CTL_SCALE), fake_x_xv_get(SCALE));
+		goto out;
+	}
+
+	r = 0;
+
+ out:
+	tvout_ctl_exit(ctl);
+	fake_x_stop();
+
+	return r;
+}
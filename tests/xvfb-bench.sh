@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Runs xrandr-bench against a private Xvfb whose output has been
+# given the TV properties by fake-tv-output. The JSON results go
+# to stdout. The first argument, or $BENCH_ITERATIONS, sets how
+# many times each thing is measured.
+#
+# Xvfb has no Xv adaptors, and clients can't make one up, so the
+# Xv backend can't be measured this way.
+
+iterations=${1:-${BENCH_ITERATIONS:-100}}
+
+if ! command -v Xvfb >/dev/null 2>&1; then
+	echo "Xvfb not found, skipping" >&2
+	exit 77
+fi
+
+tmp=`mktemp -d` || exit 99
+xvfb=
+
+cleanup() {
+	test -n "$xvfb" && kill $xvfb 2>/dev/null
+	rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 99' INT TERM
+
+# Xvfb picks a free display and writes its number to fd 3.
+Xvfb -displayfd 3 -nolisten tcp -screen 0 800x480x24 \
+	3>"$tmp/display" 2>"$tmp/xvfb.log" &
+xvfb=$!
+
+i=0
+while test ! -s "$tmp/display"; do
+	i=`expr $i + 1`
+	if test $i -gt 100 || ! kill -0 $xvfb 2>/dev/null; then
+		echo "Xvfb didn't start" >&2
+		cat "$tmp/xvfb.log" >&2
+		exit 99
+	fi
+	sleep 0.1
+done
+
+DISPLAY=:`cat "$tmp/display"`
+export DISPLAY
+
+output=`./fake-tv-output` || exit 99
+
+mkdir "$tmp/runtime" || exit 99
+
+TVOUT_CTL_BACKEND=xrandr TVOUT_CTL_OUTPUT=$output \
+XDG_RUNTIME_DIR="$tmp/runtime" ./xrandr-bench $iterations